@@ -0,0 +1,132 @@
+/**
+ * @file config_check.c
+ * @brief Check that the streaming and the cJSON parser load the same configuration
+ *
+ * Every document is loaded through load_config_stream() and through
+ * load_config_from_buffer(). Both must accept or both must refuse it, as
+ * the table expects, and accepted documents must give equal
+ * configurations. Every strict prefix of a full document is refused too.
+ *
+ * Usage: config_check
+ */
+
+#include "config_compare.h"
+#include "../include/config.h"
+#include "../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *name;
+    const char *json;
+    bool valid;
+} ConfigCase;
+
+#define FULL_CONFIG \
+    "{\n" \
+    "  \"comment\": {\"nested\": [1, -2.5e3, true, false, null, {\"a\": \"]}\"}], \"esc\": \"\\u00e9\\n\"},\n" \
+    "  \"settings\": {\n" \
+    "    \"default_interval\": 2.5, \"default_min_interval_ms\": 500, \"default_max_interval\": 10,\n" \
+    "    \"default_timeout\": 750, \"type\": \"tcp\", \"port\": 443, \"publish\": \"change\",\n" \
+    "    \"rtt_threshold_ms\": 20, \"keepalive\": 30, \"rise\": 2, \"fall\": 3,\n" \
+    "    \"flap_penalty\": 1000, \"flap_suppress\": 2000, \"flap_reuse\": 750, \"flap_half_life\": 60,\n" \
+    "    \"publish_batch\": 64, \"publish_interval_ms\": 250, \"publish_encoding\": \"binary\",\n" \
+    "    \"probe_rate\": 1000, \"probe_burst\": 20, \"subnet_probe_rate\": 50,\n" \
+    "    \"subnet_probe_burst\": 5, \"subnet_prefix\": 24, \"subnet_prefix_v6\": 64\n" \
+    "  },\n" \
+    "  \"ip_addresses\": [\n" \
+    "    \"192.0.2.1\",\n" \
+    "    {\"ip\": \"192.0.2.2\", \"interval_ms\": 1500, \"timeout\": 0, \"active\": false},\n" \
+    "    {\"ip\": \"2001:db8::1\", \"type\": \"http\", \"port\": 8080, \"publish\": \"all\", \"unknown\": [[]]},\n" \
+    "    {\"ip\": \"example\\u002eorg\", \"type\": \"udp\", \"timeout\": 1e12, \"rise\": 1, \"fall\": 1}\n" \
+    "  ]\n" \
+    "}\n"
+
+static const ConfigCase cases[] = {
+    { "full", FULL_CONFIG, true },
+    { "minimal", "{\"ip_addresses\":[\"198.51.100.7\"]}", true },
+    { "empty list", "{\"ip_addresses\":[]}", true },
+    { "first member wins", "{\"ip_addresses\":[\"192.0.2.1\"],\"ip_addresses\":[\"192.0.2.2\"]}", true },
+    { "trailing whitespace", "{\"ip_addresses\":[\"192.0.2.1\"]} \n\t", true },
+
+    { "empty document", "", false },
+    { "not an object", "[\"192.0.2.1\"]", false },
+    { "no ip_addresses", "{\"settings\":{}}", false },
+    { "trailing data", "{\"ip_addresses\":[\"192.0.2.1\"]} x", false },
+    { "second object", "{\"ip_addresses\":[\"192.0.2.1\"]}{}", false },
+    { "trailing comma in list", "{\"ip_addresses\":[\"192.0.2.1\",]}", false },
+    { "leading comma in list", "{\"ip_addresses\":[,\"192.0.2.1\"]}", false },
+    { "missing comma in list", "{\"ip_addresses\":[\"192.0.2.1\" \"192.0.2.2\"]}", false },
+    { "unterminated list", "{\"ip_addresses\":[\"192.0.2.1\"", false },
+    { "list closed by brace", "{\"ip_addresses\":[\"192.0.2.1\"}", false },
+    { "mismatched skipped array", "{\"x\":[1,2},\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "mismatched skipped object", "{\"x\":{\"a\":1],\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "mismatched nested entry", "{\"ip_addresses\":[{\"ip\":\"192.0.2.1\",\"x\":[}]}", false },
+    { "double comma in skipped array", "{\"x\":[1,,2],\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "missing colon", "{\"x\" 1,\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "missing key", "{\"x\":{1:2},\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "invalid literal", "{\"x\":tru,\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "invalid token", "{\"x\":@,\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "invalid escape", "{\"x\":\"\\q\",\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "lone surrogate", "{\"x\":\"\\udc00\",\"ip_addresses\":[\"192.0.2.1\"]}", false },
+    { "unterminated string", "{\"ip_addresses\":[\"192.0.2.1]}", false },
+};
+
+// Loads the document both ways, returns the number of failures
+static int check_document(const char *name, const char *json, size_t length, bool valid) {
+    Config *stream = load_config_stream(json, length);
+    Config *tree = load_config_from_buffer(json, length);
+    int failures = 0;
+
+    if (!stream != !tree) {
+        fprintf(stderr, "FAIL %s: streaming parser %s, cJSON parser %s\n", name,
+                stream ? "accepts" : "refuses", tree ? "accepts" : "refuses");
+        failures++;
+    } else if (!stream == valid) {
+        fprintf(stderr, "FAIL %s: both parsers %s it\n", name, stream ? "accept" : "refuse");
+        failures++;
+    } else if (stream) {
+        int ip;
+        const char *field = config_difference(stream, tree, &ip);
+        if (field) {
+            fprintf(stderr, "FAIL %s: parsers disagree on %s of entry %d\n", name, field, ip);
+            failures++;
+        }
+    }
+
+    free_config(stream);
+    free_config(tree);
+    return failures;
+}
+
+int main(void) {
+    // Refused documents log errors on purpose, keep them out of the output
+    if (init_logger("/dev/null") != 0) {
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    int documents = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        failures += check_document(cases[i].name, cases[i].json, strlen(cases[i].json), cases[i].valid);
+        documents++;
+    }
+
+    // Every cut short version of a document is malformed, whatever bracket it stops in
+    const char *full = FULL_CONFIG;
+    size_t end = strlen(full);
+    while (end > 0 && full[end - 1] != '}') {
+        end--;
+    }
+    for (size_t length = 0; length < end; length++) {
+        char name[64];
+        snprintf(name, sizeof(name), "full cut at byte %zu", length);
+        failures += check_document(name, full, length, false);
+        documents++;
+    }
+
+    close_logger();
+    printf("config parsers: %d documents, %d failures\n", documents, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
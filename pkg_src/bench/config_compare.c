@@ -0,0 +1,78 @@
+/**
+ * @file config_compare.c
+ * @brief Field-by-field comparison of configurations
+ */
+
+#include "config_compare.h"
+#include <string.h>
+
+#define COMPARE(field) \
+    if (a->field != b->field) { \
+        return #field; \
+    }
+
+static const char* policy_difference(const StatusPolicy *a, const StatusPolicy *b) {
+    COMPARE(rise)
+    COMPARE(fall)
+    COMPARE(flap_penalty)
+    COMPARE(flap_suppress)
+    COMPARE(flap_reuse)
+    COMPARE(flap_half_life_ms)
+    return NULL;
+}
+
+static const char* ip_difference(const IPConfig *a, const IPConfig *b) {
+    if (strcmp(a->ip_address, b->ip_address) != 0) {
+        return "ip_address";
+    }
+    COMPARE(interval)
+    COMPARE(interval_ms)
+    COMPARE(min_interval_ms)
+    COMPARE(max_interval_ms)
+    COMPARE(is_active)
+    COMPARE(timeout)
+    COMPARE(probe_type)
+    COMPARE(port)
+    COMPARE(publish_mode)
+    COMPARE(rtt_threshold_ms)
+    COMPARE(keepalive_ms)
+    return policy_difference(&a->status_policy, &b->status_policy);
+}
+
+const char* config_difference(const Config *a, const Config *b, int *ip) {
+    *ip = -1;
+    COMPARE(ip_count)
+    COMPARE(default_interval)
+    COMPARE(default_interval_ms)
+    COMPARE(default_min_interval_ms)
+    COMPARE(default_max_interval_ms)
+    COMPARE(default_timeout)
+    COMPARE(default_probe_type)
+    COMPARE(default_port)
+    COMPARE(default_publish_mode)
+    COMPARE(default_rtt_threshold_ms)
+    COMPARE(default_keepalive_ms)
+    COMPARE(publish_batch)
+    COMPARE(publish_interval_ms)
+    COMPARE(publish_encoding)
+    COMPARE(rate_limits.probe_rate)
+    COMPARE(rate_limits.probe_burst)
+    COMPARE(rate_limits.subnet_rate)
+    COMPARE(rate_limits.subnet_burst)
+    COMPARE(rate_limits.subnet_prefix_v4)
+    COMPARE(rate_limits.subnet_prefix_v6)
+
+    const char *field = policy_difference(&a->default_status_policy, &b->default_status_policy);
+    if (field) {
+        return field;
+    }
+
+    for (int i = 0; i < a->ip_count; i++) {
+        field = ip_difference(&a->ips[i], &b->ips[i]);
+        if (field) {
+            *ip = i;
+            return field;
+        }
+    }
+    return NULL;
+}
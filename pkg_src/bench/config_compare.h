@@ -0,0 +1,24 @@
+/**
+ * @file config_compare.h
+ * @brief Field-by-field comparison of configurations, shared by the config checks
+ */
+
+#ifndef CONFIG_COMPARE_H
+#define CONFIG_COMPARE_H
+
+#include "../include/config.h"
+
+/**
+ * @brief Find the first field in which two configurations differ
+ *
+ * Only the loaded settings and entries are compared, not where they came
+ * from (file name, modification time, snapshot mapping).
+ *
+ * @param a First configuration
+ * @param b Second configuration
+ * @param ip Set to the index of the differing entry, -1 for a setting
+ * @return const char* Name of the differing field, NULL if they are equal
+ */
+const char* config_difference(const Config *a, const Config *b, int *ip);
+
+#endif /* CONFIG_COMPARE_H */
@@ -0,0 +1,405 @@
+/**
+ * @file ipmon_bench.c
+ * @brief Probe throughput, cost and scheduling benchmark for the IP monitor
+ *
+ * Monitors N loopback addresses (127.0.0.0/8 answers every echo request
+ * locally, so no network is needed) and reports, per target count:
+ *   - probes sent per second,
+ *   - CPU time per probe (user + system),
+ *   - resident memory per target,
+ *   - scheduling jitter: how late probes leave relative to their deadline.
+ *
+ * A baseline run measures the legacy approach of spawning ping(8) through
+ * popen() per check, and the stress run shared with seqlock_check checks
+ * that seqlock readers never observe torn status records.
+ *
+ * A config run times loading generated configurations of growing size
+ * through both parsers; constant time per entry shows linear scaling.
+ *
+ * Usage: ipmon_bench [-t 100,1000,...] [-i interval_ms] [-d seconds] [-c 1000,...] [-P] [-S] [-C]
+ */
+
+#include "../include/config.h"
+#include "../include/monitor.h"
+#include "../include/probe_engine.h"
+#include "seqlock_stress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define DEFAULT_TARGETS "100,1000,10000,100000"
+#define DEFAULT_INTERVAL_MS 1000
+#define DEFAULT_DURATION_S 5
+#define BASELINE_WORKERS 16
+#define BASELINE_TARGETS 100
+#define STRESS_DURATION_S 2
+#define DEFAULT_CONFIG_SIZES "1000,10000,100000,1000000"
+#define CONFIG_ENTRY_SIZE 96    // Bytes of generated JSON per entry at most
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double cpu_seconds(int who) {
+    struct rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static long resident_bytes(void) {
+    long pages = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file) {
+        if (fscanf(file, "%*s %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(file);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+static void loopback_address(int index, char *buffer, size_t size) {
+    // Skip 127.0.0.0 so every target is a usable host address
+    unsigned int host = (unsigned int)index + 1;
+    snprintf(buffer, size, "127.%u.%u.%u", (host >> 16) & 0xFF, (host >> 8) & 0xFF, host & 0xFF);
+}
+
+static Config *loopback_config(int count, int interval_ms) {
+    Config *config = (Config *)calloc(1, sizeof(Config));
+    if (!config) {
+        return NULL;
+    }
+    config->ips = (IPConfig *)calloc(count, sizeof(IPConfig));
+    if (!config->ips) {
+        free(config);
+        return NULL;
+    }
+
+    arena_init(&config->strings, 0);
+    config->default_interval_ms = interval_ms;
+    config->default_timeout = interval_ms;
+    for (int i = 0; i < count; i++) {
+        char address[16];
+        loopback_address(i, address, sizeof(address));
+        config->ips[i].ip_address = arena_strdup(&config->strings, address);
+        config->ips[i].interval = interval_ms / 1000;
+        config->ips[i].interval_ms = interval_ms;
+        config->ips[i].timeout = interval_ms;
+        config->ips[i].is_active = true;
+        config->ip_count++;
+    }
+    return config;
+}
+
+// Upper bound of the bucket holding the given fraction of all probes
+static double lateness_percentile_us(const ProbeEngineStats *before, const ProbeEngineStats *after,
+                                     double fraction) {
+    uint64_t total = 0;
+    for (int b = 0; b < PROBE_ENGINE_LATENESS_BUCKETS; b++) {
+        total += after->lateness[b] - before->lateness[b];
+    }
+
+    uint64_t wanted = (uint64_t)(total * fraction);
+    uint64_t seen = 0;
+    for (int b = 0; b < PROBE_ENGINE_LATENESS_BUCKETS; b++) {
+        seen += after->lateness[b] - before->lateness[b];
+        if (seen > wanted) {
+            return (double)(1ULL << b);
+        }
+    }
+    return (double)(1ULL << (PROBE_ENGINE_LATENESS_BUCKETS - 1));
+}
+
+static int bench_engine(int count, int interval_ms, int duration_s) {
+    long rss_before = resident_bytes();
+
+    Config *config = loopback_config(count, interval_ms);
+    Monitor *monitor = config ? init_monitor(config) : NULL;
+    if (!monitor || start_monitoring(monitor) != 0) {
+        fprintf(stderr, "Failed to start monitoring %d targets (raw ICMP needs root or ping_group_range)\n", count);
+        free_monitor(monitor);
+        free_config(config);
+        return -1;
+    }
+
+    // Let the jittered first round go out before measuring
+    usleep(interval_ms * 1000 + 100000);
+    long rss_after = resident_bytes();
+
+    ProbeEngineStats before, after;
+    probe_engine_get_stats(monitor->engine, &before);
+    double wall_start = now_seconds();
+    double cpu_start = cpu_seconds(RUSAGE_SELF);
+
+    sleep(duration_s);
+
+    probe_engine_get_stats(monitor->engine, &after);
+    double wall = now_seconds() - wall_start;
+    double cpu = cpu_seconds(RUSAGE_SELF) - cpu_start;
+    int up = monitor_find_by_status(monitor, STATUS_UP, NULL, 0);
+
+    stop_monitoring(monitor);
+    free_monitor(monitor);
+    free_config(config);
+
+    uint64_t sent = after.sent - before.sent;
+    uint64_t replies = after.replies - before.replies;
+    double mean_us = sent ? (after.lateness_sum_ns - before.lateness_sum_ns) / 1e3 / sent : 0.0;
+
+    printf("%-8d %12.0f %10.2f %10.0f %9.1f %9.0f %9.0f %9.0f %7d\n",
+           count,
+           sent / wall,
+           sent ? cpu * 1e6 / sent : 0.0,
+           (double)(rss_after - rss_before) / count,
+           sent ? 100.0 * replies / sent : 0.0,
+           mean_us,
+           lateness_percentile_us(&before, &after, 0.99),
+           after.lateness_max_ns / 1e3,
+           up);
+    return 0;
+}
+
+typedef struct {
+    int worker;
+    double deadline;
+    atomic_long *probes;
+    atomic_long *failures;
+} BaselineWorker;
+
+// The check_ip() implementation the probe engine replaced: one ping process per probe
+static int popen_check(const char *ip_address, int timeout_ms) {
+    char command[256];
+    char output[1024];
+
+    snprintf(command, sizeof(command), "ping -c 1 -W %d %s 2>&1", (timeout_ms + 999) / 1000, ip_address);
+    FILE *fp = popen(command, "r");
+    if (!fp) {
+        return -1;
+    }
+    while (fgets(output, sizeof(output), fp) != NULL) {
+        // Drain the output like the original parser did
+    }
+    int status = pclose(fp);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void *baseline_worker(void *arg) {
+    BaselineWorker *worker = (BaselineWorker *)arg;
+    char address[16];
+
+    for (int i = worker->worker; now_seconds() < worker->deadline; i += BASELINE_WORKERS) {
+        loopback_address(i % BASELINE_TARGETS, address, sizeof(address));
+        if (popen_check(address, 1000) != 0) {
+            atomic_fetch_add(worker->failures, 1);
+        }
+        atomic_fetch_add(worker->probes, 1);
+    }
+    return NULL;
+}
+
+static void bench_popen_baseline(int duration_s) {
+    if (popen_check("127.0.0.1", 1000) != 0) {
+        printf("popen baseline skipped: ping(8) is not available or cannot reach 127.0.0.1\n");
+        return;
+    }
+
+    atomic_long probes = 0, failures = 0;
+    BaselineWorker workers[BASELINE_WORKERS];
+    pthread_t threads[BASELINE_WORKERS];
+    double wall_start = now_seconds();
+    double cpu_start = cpu_seconds(RUSAGE_SELF) + cpu_seconds(RUSAGE_CHILDREN);
+
+    for (int i = 0; i < BASELINE_WORKERS; i++) {
+        workers[i] = (BaselineWorker){ i, wall_start + duration_s, &probes, &failures };
+        pthread_create(&threads[i], NULL, baseline_worker, &workers[i]);
+    }
+    for (int i = 0; i < BASELINE_WORKERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    double wall = now_seconds() - wall_start;
+    double cpu = cpu_seconds(RUSAGE_SELF) + cpu_seconds(RUSAGE_CHILDREN) - cpu_start;
+    long total = atomic_load(&probes);
+    printf("popen baseline (%d workers): %.0f probes/s, %.1f us CPU/probe, %ld failed\n",
+           BASELINE_WORKERS, total / wall, total ? cpu * 1e6 / total : 0.0, atomic_load(&failures));
+}
+
+static int bench_seqlock_stress(void) {
+    SeqlockStressResult result;
+    if (seqlock_stress_run(STRESS_DURATION_S, &result) != 0) {
+        fprintf(stderr, "Failed to set up seqlock stress run\n");
+        return -1;
+    }
+    printf("seqlock stress: %ld writes, %ld snapshot reads by %d readers, %ld torn\n",
+           result.writes, result.reads, result.readers, result.torn);
+    return result.torn ? -1 : 0;
+}
+
+static char *generate_config(int count, size_t *length) {
+    size_t capacity = (size_t)count * CONFIG_ENTRY_SIZE + 128;
+    char *json = (char *)malloc(capacity);
+    if (!json) {
+        return NULL;
+    }
+
+    size_t used = (size_t)snprintf(json, capacity,
+                                   "{\"settings\":{\"default_interval\":5,\"default_timeout\":1000},"
+                                   "\"ip_addresses\":[");
+    for (int i = 0; i < count; i++) {
+        const char *format = i % 2 ?
+            "%s{\"timeout\":%d,\"active\":true,\"interval_ms\":%d,\"ip\":\"10.%d.%d.%d\"}" :
+            "%s{\"ip\":\"10.%d.%d.%d\",\"interval_ms\":%d,\"timeout\":%d,\"active\":true}";
+        if (i % 2) {
+            used += (size_t)snprintf(json + used, capacity - used, format, i ? "," : "",
+                                     500 + i % 100, 1000 + i % 1000, (i >> 16) & 255, (i >> 8) & 255, i & 255);
+        } else {
+            used += (size_t)snprintf(json + used, capacity - used, format, i ? "," : "",
+                                     (i >> 16) & 255, (i >> 8) & 255, i & 255, 1000 + i % 1000, 500 + i % 100);
+        }
+    }
+    used += (size_t)snprintf(json + used, capacity - used, "]}");
+
+    *length = used;
+    return json;
+}
+
+// Best of a few loads, in nanoseconds per entry
+static double time_config_load(Config *(*load)(const char *, size_t), const char *json, size_t length,
+                               int count) {
+    double best = -1;
+    for (int run = 0; run < 3; run++) {
+        double start = now_seconds();
+        Config *config = load(json, length);
+        double elapsed = now_seconds() - start;
+        if (!config || config->ip_count != count) {
+            free_config(config);
+            return -1;
+        }
+        free_config(config);
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best * 1e9 / count;
+}
+
+static int bench_config(char *sizes) {
+    printf("%-8s %10s %12s %12s\n", "entries", "JSON MB", "cJSON ns/e", "stream ns/e");
+
+    for (char *token = strtok(sizes, ","); token; token = strtok(NULL, ",")) {
+        int count = atoi(token);
+        if (count <= 0) {
+            continue;
+        }
+
+        size_t length;
+        char *json = generate_config(count, &length);
+        if (!json) {
+            fprintf(stderr, "Failed to generate a configuration with %d entries\n", count);
+            return -1;
+        }
+
+        double tree = time_config_load(load_config_from_buffer, json, length, count);
+        double stream = time_config_load(load_config_stream, json, length, count);
+        free(json);
+        if (tree < 0 || stream < 0) {
+            fprintf(stderr, "Failed to load the configuration with %d entries\n", count);
+            return -1;
+        }
+        printf("%-8d %10.1f %12.0f %12.0f\n", count, length / 1e6, tree, stream);
+    }
+    return 0;
+}
+
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [options]\n", program_name);
+    printf("Options:\n");
+    printf("  -t LIST   Comma-separated target counts (default %s)\n", DEFAULT_TARGETS);
+    printf("  -i MS     Probe interval per target in milliseconds (default %d)\n", DEFAULT_INTERVAL_MS);
+    printf("  -d SEC    Measurement duration per run in seconds (default %d)\n", DEFAULT_DURATION_S);
+    printf("  -c LIST   Comma-separated entry counts of the config run (default %s)\n", DEFAULT_CONFIG_SIZES);
+    printf("  -P        Skip the popen() ping baseline\n");
+    printf("  -S        Skip the seqlock stress run\n");
+    printf("  -C        Skip the config loading run\n");
+    printf("  -h        Display this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    char targets[256] = DEFAULT_TARGETS;
+    char config_sizes[256] = DEFAULT_CONFIG_SIZES;
+    int interval_ms = DEFAULT_INTERVAL_MS;
+    int duration_s = DEFAULT_DURATION_S;
+    bool baseline = true;
+    bool stress = true;
+    bool config_run = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:i:d:c:PSCh")) != -1) {
+        switch (opt) {
+            case 't':
+                snprintf(targets, sizeof(targets), "%s", optarg);
+                break;
+            case 'i':
+                interval_ms = atoi(optarg);
+                break;
+            case 'd':
+                duration_s = atoi(optarg);
+                break;
+            case 'c':
+                snprintf(config_sizes, sizeof(config_sizes), "%s", optarg);
+                break;
+            case 'P':
+                baseline = false;
+                break;
+            case 'S':
+                stress = false;
+                break;
+            case 'C':
+                config_run = false;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (interval_ms <= 0 || duration_s <= 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("interval %d ms, %d s per run\n", interval_ms, duration_s);
+    printf("%-8s %12s %10s %10s %9s %9s %9s %9s %7s\n",
+           "targets", "probes/s", "cpu us/pr", "B/target", "reply %", "late us", "p99 <us", "max us", "up");
+
+    int failed = 0;
+    for (char *token = strtok(targets, ","); token; token = strtok(NULL, ",")) {
+        int count = atoi(token);
+        if (count > 0 && bench_engine(count, interval_ms, duration_s) != 0) {
+            failed = 1;
+        }
+    }
+
+    if (baseline) {
+        bench_popen_baseline(duration_s);
+    }
+    if (stress && bench_seqlock_stress() != 0) {
+        failed = 1;
+    }
+    if (config_run && bench_config(config_sizes) != 0) {
+        failed = 1;
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
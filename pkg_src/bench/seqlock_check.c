@@ -0,0 +1,37 @@
+/**
+ * @file seqlock_check.c
+ * @brief Check that IPStore seqlock readers never observe torn status records
+ *
+ * Runs the seqlock stress run (see seqlock_stress.h) and fails if any
+ * reader copied a record while the writer was halfway through it.
+ *
+ * Usage: seqlock_check [seconds]
+ */
+
+#include "seqlock_stress.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_DURATION_S 2
+
+int main(int argc, char *argv[]) {
+    int duration_s = argc > 1 ? atoi(argv[1]) : DEFAULT_DURATION_S;
+    if (duration_s <= 0) {
+        fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    SeqlockStressResult result;
+    if (seqlock_stress_run(duration_s, &result) != 0) {
+        fprintf(stderr, "Failed to set up seqlock stress run\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("seqlock stress: %ld writes, %ld snapshot reads by %d readers, %ld torn\n",
+           result.writes, result.reads, result.readers, result.torn);
+    if (result.torn) {
+        fprintf(stderr, "FAIL: %ld torn reads\n", result.torn);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
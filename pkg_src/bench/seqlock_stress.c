@@ -0,0 +1,115 @@
+/**
+ * @file seqlock_stress.c
+ * @brief Implementation of the IPStore seqlock stress run
+ */
+
+#include "seqlock_stress.h"
+#include "../include/ip_store.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define STRESS_ENTRIES 64
+#define STRESS_READERS 2
+
+typedef struct {
+    IPStore *store;
+    atomic_bool *stop;
+    long reads;
+    long torn;
+} StressReader;
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void *stress_reader(void *arg) {
+    StressReader *reader = (StressReader *)arg;
+    IPStore *store = reader->store;
+
+    while (!atomic_load_explicit(reader->stop, memory_order_relaxed)) {
+        pthread_rwlock_rdlock(&store->layout_lock);
+        for (int i = 0; i < STRESS_ENTRIES; i++) {
+            int32_t rtt_us, failures, last_us;
+            time_t last_checked;
+            unsigned int seq;
+            do {
+                seq = ip_store_read_begin(store, i);
+                rtt_us = store->rtt_us[i];
+                failures = store->failures[i];
+                last_checked = store->last_checked[i];
+                last_us = store->rtt_stats[i].last_us;
+            } while (ip_store_read_retry(store, i, seq));
+
+            // The writer keeps these fields equal, a mismatch is a torn read
+            if (rtt_us != failures || (time_t)failures != last_checked || failures != last_us) {
+                reader->torn++;
+            }
+            reader->reads++;
+        }
+        pthread_rwlock_unlock(&store->layout_lock);
+    }
+    return NULL;
+}
+
+int seqlock_stress_run(int duration_s, SeqlockStressResult *result) {
+    IPStore store;
+    memset(result, 0, sizeof(*result));
+    if (ip_store_init(&store, STRESS_ENTRIES) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < STRESS_ENTRIES; i++) {
+        char address[16];
+        snprintf(address, sizeof(address), "127.0.0.%d", i + 1);
+        IPConfig config = { .ip_address = address, .interval_ms = 1000, .timeout = 1000, .is_active = true };
+        config.min_interval_ms = config.max_interval_ms = config.interval_ms;
+        if (ip_store_add(&store, &config) != i) {
+            ip_store_free(&store);
+            return -1;
+        }
+        store.rtt_us[i] = 0;
+        store.failures[i] = 0;
+        store.last_checked[i] = 0;
+        store.rtt_stats[i].last_us = 0;
+    }
+
+    atomic_bool stop = false;
+    StressReader readers[STRESS_READERS];
+    pthread_t threads[STRESS_READERS];
+    int started = 0;
+    for (; started < STRESS_READERS; started++) {
+        readers[started] = (StressReader){ &store, &stop, 0, 0 };
+        if (pthread_create(&threads[started], NULL, stress_reader, &readers[started]) != 0) {
+            break;
+        }
+    }
+
+    double deadline = now_seconds() + duration_s;
+    for (int value = 1; started && now_seconds() < deadline; value++) {
+        for (int i = 0; i < STRESS_ENTRIES; i++) {
+            ip_store_write_begin(&store, i);
+            store.rtt_us[i] = value;
+            store.failures[i] = value;
+            store.last_checked[i] = value;
+            store.rtt_stats[i].last_us = value;
+            ip_store_write_end(&store, i);
+            result->writes++;
+        }
+    }
+
+    atomic_store(&stop, true);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        result->reads += readers[i].reads;
+        result->torn += readers[i].torn;
+    }
+    result->readers = started;
+
+    ip_store_free(&store);
+    return started ? 0 : -1;
+}
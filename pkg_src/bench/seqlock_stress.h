@@ -0,0 +1,30 @@
+/**
+ * @file seqlock_stress.h
+ * @brief Stress run of the IPStore seqlock, shared by the benchmark and seqlock_check
+ *
+ * One writer thread rewrites the status fields of a few entries as fast as
+ * it can, always to a single value, while reader threads copy them through
+ * the seqlock as monitor_get_ip() does. Any copy whose fields differ is a
+ * torn read.
+ */
+
+#ifndef SEQLOCK_STRESS_H
+#define SEQLOCK_STRESS_H
+
+typedef struct {
+    long writes;            // Records updated by the writer
+    long reads;             // Records copied by the readers
+    long torn;              // Copies that mixed two updates
+    int readers;            // Reader threads
+} SeqlockStressResult;
+
+/**
+ * @brief Run the writer against concurrent readers
+ *
+ * @param duration_s Length of the run in seconds
+ * @param result Counts of the run
+ * @return int 0 if the run took place, -1 if it could not be set up
+ */
+int seqlock_stress_run(int duration_s, SeqlockStressResult *result);
+
+#endif /* SEQLOCK_STRESS_H */
@@ -0,0 +1,176 @@
+/**
+ * @file snapshot_check.c
+ * @brief Check that configuration snapshots load back unchanged and refuse damage
+ *
+ * A configuration parsed from JSON is written as a snapshot and loaded
+ * again, and must equal the parsed one. Copies of the snapshot with any
+ * single byte flipped, with another format version, cut short, or checked
+ * against other JSON must all be refused.
+ *
+ * Usage: snapshot_check
+ */
+
+#include "config_compare.h"
+#include "../include/config.h"
+#include "../include/config_snapshot.h"
+#include "../include/logger.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SNAPSHOT_VERSION_OFFSET 4   // The format version follows the 4-byte magic
+
+static const char json[] =
+    "{\n"
+    "  \"settings\": {\n"
+    "    \"default_interval_ms\": 2500, \"default_timeout\": 750, \"type\": \"tcp\", \"port\": 443,\n"
+    "    \"publish\": \"change\", \"rtt_threshold_ms\": 20, \"keepalive\": 30, \"rise\": 2, \"fall\": 3,\n"
+    "    \"flap_penalty\": 1000, \"flap_suppress\": 2000, \"flap_reuse\": 750, \"flap_half_life\": 60,\n"
+    "    \"publish_batch\": 64, \"publish_interval_ms\": 250, \"publish_encoding\": \"binary\",\n"
+    "    \"probe_rate\": 1000, \"probe_burst\": 20, \"subnet_probe_rate\": 50,\n"
+    "    \"subnet_probe_burst\": 5, \"subnet_prefix\": 24, \"subnet_prefix_v6\": 64\n"
+    "  },\n"
+    "  \"ip_addresses\": [\n"
+    "    \"192.0.2.1\",\n"
+    "    {\"ip\": \"192.0.2.2\", \"interval_ms\": 1500, \"min_interval_ms\": 500, \"active\": false},\n"
+    "    {\"ip\": \"2001:db8::1\", \"type\": \"http\", \"port\": 8080, \"publish\": \"all\"},\n"
+    "    {\"ip\": \"example.org\", \"type\": \"udp\", \"timeout\": 100, \"rise\": 1, \"fall\": 1}\n"
+    "  ]\n"
+    "}\n";
+
+static int write_file(const char *path, const unsigned char *data, size_t size) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return -1;
+    }
+    bool ok = fwrite(data, size, 1, file) == 1;
+    return fclose(file) == 0 && ok ? 0 : -1;
+}
+
+static unsigned char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    unsigned char *data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long length = ftell(file);
+        data = length > 0 ? (unsigned char *)malloc((size_t)length) : NULL;
+        rewind(file);
+        if (data && fread(data, (size_t)length, 1, file) == 1) {
+            *size = (size_t)length;
+        } else {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+// Writes a damaged copy of the snapshot and returns 1 if it is still loaded
+static int loads(const char *path, const unsigned char *data, size_t size, uint64_t json_hash, size_t json_size) {
+    if (write_file(path, data, size) != 0) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return 1;
+    }
+    Config *config = config_snapshot_load(path, json_hash, json_size);
+    free_config(config);
+    return config != NULL;
+}
+
+int main(void) {
+    // Refused snapshots log why on purpose, keep them out of the output
+    if (init_logger("/dev/null") != 0) {
+        return EXIT_FAILURE;
+    }
+
+    char path[] = "/tmp/snapshot_check.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create a temporary file\n");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    size_t json_size = sizeof(json) - 1;
+    uint64_t json_hash = config_snapshot_hash(json, json_size);
+    Config *parsed = load_config_from_buffer(json, json_size);
+    if (!parsed || config_snapshot_write(parsed, path, json_hash, json_size) != 0) {
+        fprintf(stderr, "Failed to set up the snapshot\n");
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    Config *loaded = config_snapshot_load(path, json_hash, json_size);
+    if (!loaded) {
+        fprintf(stderr, "FAIL: the snapshot does not load\n");
+        failures++;
+    } else {
+        int ip;
+        const char *field = config_difference(parsed, loaded, &ip);
+        if (field) {
+            fprintf(stderr, "FAIL: snapshot differs from the JSON in %s of entry %d\n", field, ip);
+            failures++;
+        }
+    }
+    free_config(loaded);
+    free_config(parsed);
+
+    size_t size = 0;
+    unsigned char *data = read_file(path, &size);
+    if (!data) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    int damaged = 0;
+    for (size_t i = 0; i < size; i++) {
+        data[i] ^= 0x01;
+        if (loads(path, data, size, json_hash, json_size)) {
+            fprintf(stderr, "FAIL: snapshot with byte %zu flipped is loaded\n", i);
+            failures++;
+        }
+        data[i] ^= 0x01;
+        damaged++;
+    }
+
+    uint32_t version;
+    memcpy(&version, data + SNAPSHOT_VERSION_OFFSET, sizeof(version));
+    for (int delta = -1; delta <= 1; delta += 2) {
+        uint32_t other = version + (uint32_t)delta;
+        memcpy(data + SNAPSHOT_VERSION_OFFSET, &other, sizeof(other));
+        if (loads(path, data, size, json_hash, json_size)) {
+            fprintf(stderr, "FAIL: snapshot of version %u is loaded as version %u\n", other, version);
+            failures++;
+        }
+        damaged++;
+    }
+    memcpy(data + SNAPSHOT_VERSION_OFFSET, &version, sizeof(version));
+
+    if (loads(path, data, size - 1, json_hash, json_size)) {
+        fprintf(stderr, "FAIL: snapshot cut short is loaded\n");
+        failures++;
+    }
+    if (loads(path, data, size, json_hash + 1, json_size) || loads(path, data, size, json_hash, json_size + 1)) {
+        fprintf(stderr, "FAIL: snapshot of other JSON is loaded\n");
+        failures++;
+    }
+    damaged += 3;
+
+    // The intact copy must still load, or the refusals above prove nothing
+    if (!loads(path, data, size, json_hash, json_size)) {
+        fprintf(stderr, "FAIL: the rewritten snapshot does not load\n");
+        failures++;
+    }
+
+    free(data);
+    unlink(path);
+    close_logger();
+    printf("config snapshot: %zu bytes, %d damaged copies, %d failures\n", size, damaged, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file arena.h
+ * @brief Bump allocator for short-lived and configuration-lifetime data
+ *
+ * Allocations are carved out of a few large blocks and are never freed one
+ * by one; the whole arena is released (or rewound) at once. Parsing a JSON
+ * document through an arena turns the per-node malloc()/free() pairs of
+ * cJSON into a handful of block allocations that leave no holes behind.
+ *
+ * cJSON's allocator is process-wide, so the arena hooks are installed once
+ * and dispatch per thread: between arena_json_begin() and arena_json_end()
+ * cJSON allocations of the calling thread come from the given arena, all
+ * other threads keep using malloc().
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;       // Block being allocated from, older blocks follow
+    size_t block_size;      // Size of the next block, doubled with each new block
+    size_t used;            // Bytes handed out since the last reset
+} Arena;
+
+/**
+ * @brief Initialize an empty arena, no memory is allocated yet
+ *
+ * @param arena Arena to initialize
+ * @param block_size Size of the first block, 0 for a default
+ */
+void arena_init(Arena *arena, size_t block_size);
+
+/**
+ * @brief Allocate memory from the arena, aligned for any type
+ *
+ * @param arena Arena to allocate from
+ * @param size Number of bytes
+ * @return void* Allocated memory, NULL on error
+ */
+void* arena_alloc(Arena *arena, size_t size);
+
+/**
+ * @brief Copy a string into the arena
+ *
+ * @param arena Arena to allocate from
+ * @param string String to copy
+ * @return char* Copy of the string, NULL on error
+ */
+char* arena_strdup(Arena *arena, const char *string);
+
+/**
+ * @brief Check whether memory was allocated from the arena
+ *
+ * @param arena Arena to check
+ * @param pointer Pointer to check
+ * @return bool true if the pointer lies in one of the arena's blocks
+ */
+bool arena_owns(const Arena *arena, const void *pointer);
+
+/**
+ * @brief Discard all allocations, keeping the newest block for reuse
+ *
+ * @param arena Arena to rewind
+ */
+void arena_reset(Arena *arena);
+
+/**
+ * @brief Release all memory of the arena
+ *
+ * @param arena Arena to free
+ */
+void arena_free(Arena *arena);
+
+/**
+ * @brief Route the calling thread's cJSON allocations into an arena
+ *
+ * cJSON_Delete() becomes a no-op for items in the arena, so trees built in
+ * it may simply be dropped. They must not be used after arena_json_end()
+ * and the arena being reset or freed.
+ *
+ * @param arena Arena to allocate from
+ * @return Arena* Arena that was active before, to pass to arena_json_end()
+ */
+Arena* arena_json_begin(Arena *arena);
+
+/**
+ * @brief Restore the cJSON allocator that was active before arena_json_begin()
+ *
+ * @param previous Value returned by the matching arena_json_begin()
+ */
+void arena_json_end(Arena *previous);
+
+#endif /* ARENA_H */
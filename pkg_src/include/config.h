@@ -6,25 +6,112 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "arena.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
 
+typedef enum {
+    PUBLISH_ALL,         // Publish every probe result
+    PUBLISH_CHANGE       // Publish status changes, RTT shifts and keep-alives only
+} PublishMode;
+
+typedef enum {
+    PUBLISH_ENCODING_JSON,   // JSON text, one object per result
+    PUBLISH_ENCODING_BINARY  // Fixed-size little-endian records, see result_codec.h
+} PublishEncoding;
+
+typedef enum {
+    PROBE_ICMP,          // ICMP or ICMPv6 echo request
+    PROBE_TCP,           // TCP connection to the port
+    PROBE_UDP,           // UDP datagram the port echoes back
+    PROBE_HTTP           // HTTP HEAD request over TCP
+} ProbeType;
+
+#define CONFIG_MAX_FIELDS 32     // Fields read from one config object at most
+
 typedef struct {
-    char *ip_address;    // IP address to monitor
+    int probe_rate;      // Probes per second across all targets, 0 for no limit
+    int probe_burst;     // Probes sent back to back under probe_rate, 0 for 10 ms worth
+    int subnet_rate;     // Probes per second into any one subnet, 0 for no limit
+    int subnet_burst;    // Probes sent back to back into one subnet, 0 for 10 ms worth
+    int subnet_prefix_v4; // Prefix length that groups IPv4 addresses into subnets
+    int subnet_prefix_v6; // Prefix length that groups IPv6 addresses into subnets
+} ProbeRateLimits;
+
+typedef struct {
+    int rise;            // Consecutive answered probes that mark an IP UP
+    int fall;            // Consecutive failed probes that mark an IP DOWN
+    int flap_penalty;    // Penalty of one UP/DOWN transition, 0 disables flap damping
+    int flap_suppress;   // Penalty at which an IP is reported FLAPPING
+    int flap_reuse;      // Penalty below which a FLAPPING IP reports UP or DOWN again
+    int flap_half_life_ms; // Time the penalty takes to decay by half
+} StatusPolicy;
+
+typedef enum {
+    CONFIG_VALUE_STRING,
+    CONFIG_VALUE_NUMBER,
+    CONFIG_VALUE_BOOL,
+    CONFIG_VALUE_OTHER   // null, object or array, never read
+} ConfigValueType;
+
+typedef struct {
+    const char *key;     // Member name
+    ConfigValueType type; // Type of the value
+    const char *string;  // Value of a string
+    double number;       // Value of a number
+    bool boolean;        // Value of a bool
+} ConfigField;
+
+typedef struct {
+    char *ip_address;    // Address, host name, CIDR block or range to monitor, owned by the config's arena or snapshot
     int interval;        // Monitoring interval in seconds
+    int interval_ms;     // Monitoring interval in milliseconds
+    int min_interval_ms; // Shortest adaptive interval, at most interval_ms
+    int max_interval_ms; // Longest adaptive interval, at least interval_ms, both equal to it when fixed
     bool is_active;      // Whether monitoring is active
     int timeout;         // Timeout for ping in milliseconds
+    ProbeType probe_type; // How the target is probed
+    int port;            // Port of a TCP, UDP or HTTP probe, 0 for the type's default
+    PublishMode publish_mode; // Which results are published
+    int rtt_threshold_ms; // RTT change that is published in change mode, 0 to ignore RTT
+    int keepalive_ms;    // Longest silence in change mode, 0 for none
+    StatusPolicy status_policy; // How probe results turn into a status
 } IPConfig;
 
 typedef struct {
     IPConfig *ips;       // Array of IP configurations
     int ip_count;        // Number of IPs to monitor
     int default_interval; // Default monitoring interval
+    int default_interval_ms; // Default monitoring interval in milliseconds
+    int default_min_interval_ms; // Default shortest adaptive interval, 0 for the IP's interval
+    int default_max_interval_ms; // Default longest adaptive interval, 0 for the IP's interval
     int default_timeout; // Default timeout 
-    char *filename;      // Filename of the config for reloading
+    ProbeType default_probe_type; // Default probe type
+    int default_port;    // Default port, 0 for the probe type's default
+    PublishMode default_publish_mode; // Default publication mode
+    int default_rtt_threshold_ms; // Default RTT change published in change mode
+    int default_keepalive_ms; // Default keep-alive period in change mode
+    StatusPolicy default_status_policy; // Default rise/fall thresholds and flap damping
+    int publish_batch;   // Results per published message at most
+    int publish_interval_ms; // Longest time a result waits to be published
+    PublishEncoding publish_encoding; // Encoding of published result batches
+    ProbeRateLimits rate_limits; // Limits on the rate probes are sent at
+    Arena strings;       // Holds the address strings of ips
+    void *snapshot;      // Mapped snapshot holding the address strings instead, NULL if none
+    size_t snapshot_size; // Size of the mapped snapshot
+    char *filename;      // Filename of the config for reloading, NULL if loaded from memory
     time_t last_modified; // Last modification time of the config file
+    long last_modified_nsec; // Nanosecond part of the modification time
+    unsigned long inode; // Inode of the loaded config file
 } Config;
 
+typedef struct {
+    int fd;              // inotify descriptor, -1 when not watching
+    char *directory;     // Directory holding the config file
+    char *basename;      // Name of the config file within the directory
+} ConfigWatcher;
+
 /**
  * @brief Load configuration from a JSON file
  * 
@@ -33,6 +120,65 @@ typedef struct {
  */
 Config* load_config(const char *filename);
 
+/**
+ * @brief Load configuration from JSON held in memory
+ * 
+ * The buffer is parsed in place and need not be NUL-terminated. The
+ * resulting configuration has no filename, so it is never reloaded from
+ * disk.
+ * 
+ * @param data JSON text
+ * @param length Length of the JSON text in bytes
+ * @return Config* Pointer to the loaded configuration, NULL on error
+ */
+Config* load_config_from_buffer(const char *data, size_t length);
+
+/**
+ * @brief Load configuration from JSON without building a document tree
+ * 
+ * Entries are parsed one at a time straight into the IPConfig array, so
+ * besides the configuration only one entry's worth of memory is used.
+ * load_config() uses it on the mapped file.
+ * 
+ * @param data JSON text, need not be NUL-terminated
+ * @param length Length of the JSON text in bytes
+ * @return Config* Pointer to the loaded configuration, NULL on error
+ */
+Config* load_config_stream(const char *data, size_t length);
+
+/**
+ * @brief Allocate a configuration holding only defaults
+ * 
+ * @param string_hint Expected bytes of address strings, 0 if unknown
+ * @return Config* New configuration, NULL on error
+ */
+Config* config_create(size_t string_hint);
+
+/**
+ * @brief Apply the members of the "settings" object
+ * 
+ * Shared by the parsers so every input format is read the same way.
+ * Unknown fields and fields of the wrong type are ignored.
+ * 
+ * @param config Configuration to update
+ * @param fields Members of the settings object
+ * @param count Number of members
+ */
+void config_apply_settings(Config *config, const ConfigField *fields, int count);
+
+/**
+ * @brief Append an IP from the members of one "ip_addresses" entry
+ * 
+ * Missing fields take the configured defaults; a plain address string is
+ * passed as a single "ip" field. config->ips must have room for it.
+ * 
+ * @param config Configuration to append to
+ * @param fields Members of the entry
+ * @param count Number of members
+ * @return int 0 on success, -1 if the entry has no "ip" string
+ */
+int config_add_ip(Config *config, const ConfigField *fields, int count);
+
 /**
  * @brief Free resources allocated for configuration
  * 
@@ -48,6 +194,14 @@ void free_config(Config *config);
  */
 bool config_has_changed(Config *config);
 
+/**
+ * @brief Load the configuration file again and replace the current one
+ * 
+ * @param config Pointer to a pointer to the configuration (can be updated)
+ * @return true if the configuration was reloaded, false if loading failed
+ */
+bool reload_config(Config **config);
+
 /**
  * @brief Reload the configuration if the file has been modified
  * 
@@ -56,4 +210,33 @@ bool config_has_changed(Config *config);
  */
 bool reload_config_if_changed(Config **config);
 
+/**
+ * @brief Start watching a configuration file for changes with inotify
+ * 
+ * The file's directory is watched for files closed after writing and files
+ * renamed into place, so both in-place edits and atomic replacement via
+ * rename() are seen.
+ * 
+ * @param watcher Watcher to initialize
+ * @param filename Path to the configuration file
+ * @return int 0 on success, -1 on error
+ */
+int config_watch_init(ConfigWatcher *watcher, const char *filename);
+
+/**
+ * @brief Wait until the configuration file changes or a timeout expires
+ * 
+ * @param watcher Watcher to wait on
+ * @param timeout_ms Longest time to wait in milliseconds, -1 for no limit
+ * @return int 1 if the file changed, 0 on timeout, -1 if the watch was lost
+ */
+int config_watch_wait(ConfigWatcher *watcher, int timeout_ms);
+
+/**
+ * @brief Stop watching and free resources allocated for the watcher
+ * 
+ * @param watcher Watcher to free
+ */
+void config_watch_free(ConfigWatcher *watcher);
+
 #endif /* CONFIG_H */
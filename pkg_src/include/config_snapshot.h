@@ -0,0 +1,56 @@
+/**
+ * @file config_snapshot.h
+ * @brief Binary snapshot of a parsed configuration for fast startup
+ *
+ * After a configuration file has been parsed, its Config is written next
+ * to it (config.json -> config.json.snap) as a fixed header, one fixed-size
+ * record per IP and a blob of NUL-terminated address strings. The header
+ * records a hash and the size of the JSON it was built from. When the JSON
+ * still hashes to the same value the snapshot is mapped instead of parsing
+ * again, and the address strings are used in place.
+ *
+ * Snapshots are a local cache in native byte order; a snapshot from an
+ * older format version or another architecture fails validation and is
+ * simply rebuilt.
+ */
+
+#ifndef CONFIG_SNAPSHOT_H
+#define CONFIG_SNAPSHOT_H
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONFIG_SNAPSHOT_SUFFIX ".snap"
+
+/**
+ * @brief Hash configuration text the way snapshots record it
+ *
+ * @param data Bytes to hash
+ * @param length Number of bytes
+ * @return uint64_t 64-bit hash (xxHash64, seed 0)
+ */
+uint64_t config_snapshot_hash(const void *data, size_t length);
+
+/**
+ * @brief Map a snapshot and build a configuration from it
+ *
+ * @param path Path of the snapshot file
+ * @param json_hash Hash of the current JSON text
+ * @param json_size Size of the current JSON text
+ * @return Config* Configuration, NULL if the snapshot is missing, invalid or stale
+ */
+Config* config_snapshot_load(const char *path, uint64_t json_hash, size_t json_size);
+
+/**
+ * @brief Write a snapshot of a configuration, replacing any previous one atomically
+ *
+ * @param config Configuration to save
+ * @param path Path of the snapshot file
+ * @param json_hash Hash of the JSON text the configuration was parsed from
+ * @param json_size Size of that JSON text
+ * @return int 0 on success, -1 on error
+ */
+int config_snapshot_write(const Config *config, const char *path, uint64_t json_hash, size_t json_size);
+
+#endif /* CONFIG_SNAPSHOT_H */
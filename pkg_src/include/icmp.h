@@ -0,0 +1,165 @@
+/**
+ * @file icmp.h
+ * @brief Native ICMP and ICMPv6 echo request/reply handling
+ *
+ * One socket serves one address family. Addresses are passed around in
+ * binary form as struct in6_addr, IPv4 as ::ffff:a.b.c.d, so callers can
+ * treat both families alike until a socket address is needed.
+ *
+ * Times are CLOCK_MONOTONIC. Kernel timestamps, which the kernel takes on
+ * CLOCK_REALTIME, are moved onto the monotonic clock as they are read, so a
+ * wall-clock step while a probe is in flight does not distort its RTT.
+ */
+
+#ifndef ICMP_H
+#define ICMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define PACKET_SIZE 64          // Size of an echo request, ICMP header included
+#define ICMP_RECV_BUFFER_SIZE 1500
+
+typedef struct {
+    int fd;                     // Socket descriptor, -1 when closed
+    int family;                 // AF_INET or AF_INET6
+    int type;                   // SOCK_DGRAM (unprivileged ping socket) or SOCK_RAW
+    uint16_t ident;             // Echo identifier, only checked on raw sockets
+} IcmpSocket;
+
+typedef struct {
+    struct in6_addr from;       // Source of the reply, IPv4 as ::ffff:a.b.c.d
+    uint16_t sequence;          // Echo sequence number
+    uint32_t cookie;            // Caller cookie echoed back in the payload
+    uint32_t tag;               // Caller tag of the request, see icmp_parse_tx_timestamp()
+    struct timespec sent;       // Time the request was built, carried in the payload
+    struct timespec received;   // Kernel receive timestamp when available, else time of reading
+} IcmpReply;
+
+/**
+ * @brief Open a non-blocking ICMP or ICMPv6 socket
+ *
+ * Tries an unprivileged ping socket first and falls back to a raw socket.
+ * Kernel receive timestamps are enabled on the returned socket, through
+ * SO_TIMESTAMPING where available and SO_TIMESTAMPNS otherwise.
+ *
+ * @param sock Socket to initialize
+ * @param family AF_INET or AF_INET6
+ * @return int 0 on success, -1 on error
+ */
+int icmp_open(IcmpSocket *sock, int family);
+
+/**
+ * @brief Also have the kernel timestamp every request this socket transmits
+ *
+ * Each timestamp is queued on the socket's error queue together with the
+ * request, which makes the socket report EPOLLERR/POLLERR until the queue
+ * is drained with recvmsg(MSG_ERRQUEUE) and icmp_parse_tx_timestamp().
+ * Callers that do not drain it must not enable this.
+ *
+ * @param sock Socket opened by icmp_open()
+ * @return int 0 on success, -1 if the kernel does not support it
+ */
+int icmp_enable_tx_timestamps(const IcmpSocket *sock);
+
+/**
+ * @brief Close an ICMP socket
+ *
+ * @param sock Socket to close
+ */
+void icmp_close(IcmpSocket *sock);
+
+/**
+ * @brief Resolve a host name or literal into a binary address
+ *
+ * Host names take the first address the resolver prefers, of either family.
+ *
+ * @param host Host name, dotted quad or IPv6 literal
+ * @param addr Resolved address, IPv4 as ::ffff:a.b.c.d
+ * @return int AF_INET or AF_INET6 on success, -1 on error
+ */
+int icmp_resolve(const char *host, struct in6_addr *addr);
+
+/**
+ * @brief Build the socket address of a binary address
+ *
+ * @param addr Address, IPv4 as ::ffff:a.b.c.d
+ * @param out Socket address to fill, a sockaddr_in or sockaddr_in6
+ * @return socklen_t Length of the socket address
+ */
+socklen_t icmp_sockaddr(const struct in6_addr *addr, struct sockaddr_storage *out);
+
+/**
+ * @brief Build an echo request into a caller-provided buffer
+ *
+ * @param sock Socket the request will be sent on
+ * @param buf Buffer of at least PACKET_SIZE bytes
+ * @param sequence Echo sequence number
+ * @param cookie Opaque value echoed back by the target
+ * @param tag Opaque value identifying this request in its transmit timestamp and reply
+ * @return size_t Number of bytes written
+ */
+size_t icmp_build_echo(const IcmpSocket *sock, uint8_t *buf, uint16_t sequence, uint32_t cookie,
+                       uint32_t tag);
+
+/**
+ * @brief Build and send a single echo request
+ *
+ * @param sock Socket to send on
+ * @param addr Destination address, of the socket's family
+ * @param addr_len Length of the destination address
+ * @param sequence Echo sequence number
+ * @param cookie Opaque value echoed back by the target
+ * @return int 0 on success, -1 on error
+ */
+int icmp_send_echo(const IcmpSocket *sock, const struct sockaddr *addr, socklen_t addr_len,
+                   uint16_t sequence, uint32_t cookie);
+
+/**
+ * @brief Decode a received datagram into an echo reply
+ *
+ * @param sock Socket the datagram was read from
+ * @param msg Message header filled by recvmsg(), including control data
+ * @param len Number of bytes received
+ * @param reply Decoded reply
+ * @return int 1 if the datagram is one of our echo replies, 0 otherwise
+ */
+int icmp_parse_reply(const IcmpSocket *sock, const struct msghdr *msg, size_t len, IcmpReply *reply);
+
+/**
+ * @brief Decode a message read from the error queue into a transmit timestamp
+ *
+ * @param sock Socket the message was read from
+ * @param msg Message header filled by recvmsg(MSG_ERRQUEUE), including control data
+ * @param len Number of bytes received
+ * @param tag Tag of the timestamped request
+ * @param sent Time the request left, on CLOCK_MONOTONIC
+ * @return int 1 if the message is the transmit timestamp of one of our requests, 0 otherwise
+ */
+int icmp_parse_tx_timestamp(const IcmpSocket *sock, const struct msghdr *msg, size_t len,
+                            uint32_t *tag, struct timespec *sent);
+
+/**
+ * @brief Receive the next pending echo reply without blocking
+ *
+ * Datagrams that are not echo replies for this socket are discarded.
+ *
+ * @param sock Socket to read from
+ * @param reply Decoded reply
+ * @return int 1 if a reply was read, 0 if none is pending, -1 on error
+ */
+int icmp_recv_reply(const IcmpSocket *sock, IcmpReply *reply);
+
+/**
+ * @brief Round-trip time of a reply in microseconds
+ *
+ * @param reply Reply to measure
+ * @return long Round-trip time, never negative
+ */
+long icmp_rtt_us(const IcmpReply *reply);
+
+#endif /* ICMP_H */
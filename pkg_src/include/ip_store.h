@@ -0,0 +1,339 @@
+/**
+ * @file ip_store.h
+ * @brief Structure-of-arrays storage for monitored IPs
+ *
+ * Every per-IP field lives in its own contiguous array indexed by the IP's
+ * position, so sweeps that look at one field (e.g. "which IPs are DOWN")
+ * touch only that array. Addresses are kept in packed binary form and the
+ * configured address strings are interned once in a shared pool. The pool
+ * is one reservation of address space whose pages are committed as strings
+ * fill it, so a string never moves and pointers to it stay valid.
+ *
+ * Status fields have a single writer (the probe engine thread) and any
+ * number of readers. Each IP carries a sequence counter used as a seqlock:
+ * the writer makes it odd while updating and even when done, and readers
+ * retry until they observe the same even value before and after copying.
+ * Readers never block the writer.
+ *
+ * Adding and removing IPs is done by that same writer thread. Readers on
+ * other threads hold the layout lock for reading so arrays are never moved
+ * under them; the probe path itself never takes it. Removed IPs leave a
+ * hole (status IP_STORE_REMOVED) that the next added IP reuses, so the
+ * indices of the remaining IPs never change. The name of a removed IP stays
+ * in the pool, where results still queued for publication and snapshots
+ * from monitor_get_ip() may refer to it; when the same name is configured
+ * again it reuses that copy. The pool therefore grows with the number of
+ * distinct names configured over the store's life, not with reloads, and
+ * never beyond STRING_POOL_RESERVE.
+ *
+ * A CIDR block ("10.0.0.0/16") or address range ("10.0.1.1-10.0.1.254")
+ * is a single entry holding its first address and its size; the probe
+ * engine enumerates the addresses as it sweeps them.
+ */
+
+#ifndef IP_STORE_H
+#define IP_STORE_H
+
+#include "config.h"
+#include "rtt_stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define STRING_POOL_NONE UINT32_MAX
+#define STRING_POOL_RESERVE (1u << 30) // Address space reserved for a pool, the most its strings take
+#define IP_STORE_REMOVED 0xFF   // Status value of a removed entry
+#define IP_STORE_MAX_RANGE (1u << 24) // Most addresses in one block or range, a /8
+
+typedef struct {
+    char *data;             // Concatenated NUL-terminated strings, NULL until the first one
+    size_t length;          // Bytes used in data
+    size_t capacity;        // Bytes of data committed
+    uint32_t *slots;        // Hash table of string offsets + 1, 0 when empty
+    size_t slot_count;      // Number of hash slots, a power of two
+    size_t entries;         // Number of distinct strings
+} StringPool;
+
+typedef struct {
+    uint8_t family;         // AF_INET or AF_INET6, AF_UNSPEC if the name did not resolve
+    struct in6_addr addr;   // Binary address, IPv4 stored as ::ffff:a.b.c.d
+    uint32_t range_size;    // Number of addresses from addr on, 0 for a single address
+    bool host_name;         // Whether the address came from a name lookup
+} IPStoreAddress;
+
+typedef struct {
+    int count;              // Number of entries, removed ones included
+    int live_count;         // Number of entries not removed
+    int capacity;           // Number of IPs the arrays can hold
+    uint32_t *name;         // Pool offset of the configured address string
+    uint8_t *family;        // AF_INET or AF_INET6, AF_UNSPEC if the address did not resolve
+    struct in6_addr *addr;  // Binary address, IPv4 stored as ::ffff:a.b.c.d
+    uint32_t *range_size;   // Number of addresses from addr on, 0 for a single address
+    uint8_t *host_name;     // Whether the address string is a host name, looked up again over time
+    uint8_t *active;        // Whether monitoring is active
+    int32_t *interval_ms;   // Monitoring interval in milliseconds
+    int32_t *min_interval_ms; // Shortest adaptive interval, equal to interval_ms when fixed
+    int32_t *max_interval_ms; // Longest adaptive interval, equal to interval_ms when fixed
+    int32_t *timeout_ms;    // Timeout in milliseconds
+    uint8_t *probe_type;    // ProbeType the IP is probed with
+    uint16_t *port;         // Port of a TCP, UDP or HTTP probe, 0 for the type's default
+    uint8_t *publish_mode;  // PublishMode of the IP's results
+    int32_t *rtt_threshold_us; // RTT change published in change mode, 0 to ignore RTT
+    int32_t *keepalive_ms;  // Longest silence in change mode, 0 for none
+    StatusPolicy *status_policy; // Rise/fall thresholds and flap damping
+    int32_t *published_rtt_us; // RTT of the last published result, -1 if none
+    int64_t *published_ms;  // Wall-clock time of the last published result
+    uint8_t *status;        // Current IPStatus
+    uint8_t *settled;       // IPStatus from the rise/fall thresholds alone, status unless FLAPPING
+    int32_t *rtt_us;        // Last response time in microseconds, -1 if none
+    int32_t *failures;      // Number of consecutive failures
+    int32_t *successes;     // Number of consecutive answered probes
+    int32_t *flap_penalty;  // Flap penalty as of flap_ms
+    int64_t *flap_ms;       // Monotonic time the flap penalty was last decayed
+    uint32_t *alive_count;  // Addresses of a range that answered their last probe
+    RttStats *rtt_stats;    // Round-trip time statistics over a sliding window
+    time_t *last_checked;   // Last time the IP was checked
+    atomic_uint *seq;       // Seqlock counter guarding the status fields
+    StringPool names;       // Interned address strings
+    int32_t *lookup;        // Hash of name offset to index + 1, 0 when empty
+    size_t lookup_size;     // Number of lookup slots, a power of two
+    int *free_slots;        // Indices of removed entries available for reuse
+    int free_count;         // Number of reusable indices
+    pthread_rwlock_t layout_lock; // Held by readers against array reallocation
+} IPStore;
+
+/**
+ * @brief Intern a string, returning the offset of its single stored copy
+ *
+ * @param pool Pool to intern into
+ * @param string String to intern
+ * @return uint32_t Offset of the string in the pool, STRING_POOL_NONE on error
+ */
+uint32_t string_pool_intern(StringPool *pool, const char *string);
+
+/**
+ * @brief Look up an interned string without adding it
+ *
+ * @param pool Pool to search
+ * @param string String to look for
+ * @return uint32_t Offset of the string, STRING_POOL_NONE if absent
+ */
+uint32_t string_pool_find(const StringPool *pool, const char *string);
+
+/**
+ * @brief Free resources allocated for the pool
+ *
+ * @param pool Pool to free
+ */
+void string_pool_free(StringPool *pool);
+
+/**
+ * @brief Parse a CIDR block or an address range
+ *
+ * Blocks of /30 and larger leave out their network and broadcast addresses.
+ * A string with a dash that is not made of two IPv4 addresses is taken to
+ * be a host name.
+ *
+ * @param spec Configured address string
+ * @param first First address of the range in host byte order
+ * @param count Number of addresses in the range
+ * @return int 1 for a block or range, 0 for a single address or host name, -1 if malformed
+ */
+int ip_store_parse_range(const char *spec, uint32_t *first, uint32_t *count);
+
+/**
+ * @brief Initialize an empty store
+ *
+ * @param store Store to initialize
+ * @param capacity Number of IPs to reserve room for
+ * @return int 0 on success, -1 on error
+ */
+int ip_store_init(IPStore *store, int capacity);
+
+/**
+ * @brief Free resources allocated for the store
+ *
+ * @param store Store to free
+ */
+void ip_store_free(IPStore *store);
+
+/**
+ * @brief Work out the address of a configured address string
+ *
+ * Host names are looked up, which may block for a while: call this from a
+ * thread that can afford it, never from the probe engine's.
+ *
+ * @param spec Configured address string
+ * @param address Address to fill, AF_UNSPEC if a host name did not resolve
+ * @return int 0 on success, -1 if the string is a malformed block or range
+ */
+int ip_store_resolve(const char *spec, IPStoreAddress *address);
+
+/**
+ * @brief Add an IP from its configuration, resolving its address
+ *
+ * Same as ip_store_resolve() followed by ip_store_add_resolved(), for
+ * stores that no engine is probing yet.
+ *
+ * @param store Store to add to
+ * @param config Configuration of the IP
+ * @return int Index of the new IP, -1 on error
+ */
+int ip_store_add(IPStore *store, const IPConfig *config);
+
+/**
+ * @brief Add an IP from its configuration and its already resolved address
+ *
+ * Never blocks on a name lookup. Reuses the index of a removed IP when one
+ * is available.
+ *
+ * @param store Store to add to
+ * @param config Configuration of the IP
+ * @param address Address from ip_store_resolve() of config->ip_address
+ * @return int Index of the new IP, -1 on error
+ */
+int ip_store_add_resolved(IPStore *store, const IPConfig *config, const IPStoreAddress *address);
+
+/**
+ * @brief Replace the address of a host name that resolved differently
+ *
+ * Only the single writer of the IP may call this.
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ * @param address New address from ip_store_resolve()
+ * @return true if the address changed
+ */
+bool ip_store_set_address(IPStore *store, int index, const IPStoreAddress *address);
+
+/**
+ * @brief Get the adaptive interval bounds of a configured IP
+ *
+ * Bounds that are unset or on the wrong side of the interval become the
+ * interval itself.
+ *
+ * @param config Configuration of the IP
+ * @param min_ms Shortest interval in milliseconds
+ * @param max_ms Longest interval in milliseconds
+ */
+void ip_store_interval_bounds(const IPConfig *config, int32_t *min_ms, int32_t *max_ms);
+
+/**
+ * @brief Remove an IP, leaving its index free for reuse
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ */
+void ip_store_remove(IPStore *store, int index);
+
+/**
+ * @brief Find the index of an IP by its configured address string
+ *
+ * @param store Store to search
+ * @param name Configured address string
+ * @return int Index of the IP, -1 if it is not in the store
+ */
+int ip_store_find(const IPStore *store, const char *name);
+
+/**
+ * @brief Get the configured address string of an IP
+ *
+ * The pointer stays valid until the store is freed.
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ * @return const char* Address string
+ */
+const char* ip_store_name(const IPStore *store, int index);
+
+/**
+ * @brief Start updating the status fields of an IP
+ *
+ * Only the single writer of the IP may call this.
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ */
+static inline void ip_store_write_begin(IPStore *store, int index) {
+    unsigned int seq = atomic_load_explicit(&store->seq[index], memory_order_relaxed);
+    atomic_store_explicit(&store->seq[index], seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * @brief Publish the status fields of an IP updated since ip_store_write_begin()
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ */
+static inline void ip_store_write_end(IPStore *store, int index) {
+    unsigned int seq = atomic_load_explicit(&store->seq[index], memory_order_relaxed);
+    atomic_store_explicit(&store->seq[index], seq + 1, memory_order_release);
+}
+
+/**
+ * @brief Start a consistent read of the status fields of an IP
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ * @return unsigned int Sequence value to pass to ip_store_read_retry()
+ */
+static inline unsigned int ip_store_read_begin(const IPStore *store, int index) {
+    unsigned int seq;
+    while ((seq = atomic_load_explicit(&store->seq[index], memory_order_acquire)) & 1) {
+        // Writer in progress
+    }
+    return seq;
+}
+
+/**
+ * @brief Check whether a read must be repeated because the writer interfered
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ * @param seq Value returned by ip_store_read_begin()
+ * @return true if the copied fields may be torn and the read must be retried
+ */
+static inline bool ip_store_read_retry(const IPStore *store, int index, unsigned int seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&store->seq[index], memory_order_relaxed) != seq;
+}
+
+/**
+ * @brief Collect the indices of all IPs with a given status
+ *
+ * @param store Store to scan
+ * @param status Status to look for
+ * @param indices Output array, may be NULL to only count
+ * @param max Capacity of the output array
+ * @return int Number of matching IPs, which may exceed max
+ */
+int ip_store_find_status(const IPStore *store, uint8_t status, int *indices, int max);
+
+/**
+ * @brief Get one address of an IP or range in binary form
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ * @param offset Position of the address in a range, 0 for a single address
+ * @param addr Address to fill
+ */
+void ip_store_address(const IPStore *store, int index, uint32_t offset, struct in6_addr *addr);
+
+/**
+ * @brief Get the address of an IP or range as a socket address
+ *
+ * @param store Store holding the IP
+ * @param index Index of the IP
+ * @param offset Position of the address in a range, 0 for a single address
+ * @param addr Socket address to fill, a sockaddr_in or sockaddr_in6
+ * @return socklen_t Length of the socket address, 0 if the IP has no resolved address
+ */
+socklen_t ip_store_sockaddr(const IPStore *store, int index, uint32_t offset, struct sockaddr_storage *addr);
+
+#endif /* IP_STORE_H */
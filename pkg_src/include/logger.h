@@ -23,12 +23,19 @@ int init_logger(const char *log_file);
 
 /**
  * @brief Close the logger and free resources
+ * 
+ * Waits until all queued messages have been written.
  */
 void close_logger(void);
 
 /**
  * @brief Log a message with the specified level
  * 
+ * The message is queued for a background writer thread, so the caller never
+ * waits on disk I/O and lines from concurrent threads never interleave. If
+ * the queue is full the message is dropped and the number of dropped
+ * messages is logged once there is room again.
+ * 
  * @param level Logging level
  * @param format Format string (printf-like)
  * @param ... Variable arguments
@@ -7,30 +7,65 @@
 #define MONITOR_H
 
 #include "config.h"
+#include "ip_store.h"
 #include <stdbool.h>
 #include <time.h>
 
 typedef enum {
     STATUS_UNKNOWN,
     STATUS_UP,
-    STATUS_DOWN
+    STATUS_DOWN,
+    STATUS_FLAPPING         // Going UP and DOWN too often to report either
 } IPStatus;
 
 typedef struct {
-    char *ip_address;       // IP address being monitored
+    const char *ip_address; // IP address being monitored
     IPStatus status;        // Current status
     time_t last_checked;    // Last time this IP was checked
-    int response_time_ms;   // Last response time in milliseconds
+    int response_time_us;   // Last response time in microseconds, -1 if none
     int failures;           // Number of consecutive failures
+    int successes;          // Number of consecutive answered probes
+    int flap_penalty;       // Flap penalty as of the last probe
     bool is_active;         // Whether monitoring is active
     int interval;           // Monitoring interval in seconds
+    int interval_ms;        // Monitoring interval in milliseconds
+    int min_interval_ms;    // Shortest adaptive interval, equal to interval_ms when fixed
+    int max_interval_ms;    // Longest adaptive interval, equal to interval_ms when fixed
     int timeout;            // Timeout in milliseconds
+    ProbeType probe_type;   // How the IP is probed
+    int port;               // Port of a TCP, UDP or HTTP probe, 0 for the type's default
+    uint32_t range_size;    // Number of addresses of a block or range, 0 for a single address
+    uint32_t alive_count;   // Addresses of the range that answered their last probe
 } MonitoredIP;
 
 typedef struct {
-    MonitoredIP *ips;       // Array of monitored IPs
+    uint32_t index;         // Index of the IP in the monitor's store
+    uint32_t name;          // Pool offset of the IP's address string
+    struct in6_addr addr;   // Address probed, IPv4 stored as ::ffff:a.b.c.d, zero if unresolved
+    int32_t rtt_us;         // Round-trip time in microseconds, -1 if the probe failed
+    uint8_t family;         // AF_INET or AF_INET6, AF_UNSPEC if the address did not resolve
+    bool range;             // Whether the address is one of a block or range
+    uint8_t status;         // IPStatus after this probe, of the probed address for a range
+    int64_t time_ms;        // Wall-clock time of the result in milliseconds
+} ProbeResult;
+
+/**
+ * @brief Receives every probe result, on the probe engine thread
+ */
+typedef void (*MonitorResultCallback)(void *user_data, const ProbeResult *result);
+
+struct ProbeEngine;
+struct Resolver;
+
+typedef struct {
+    IPStore store;          // Per-IP state, one array per field
     int ip_count;           // Number of IPs being monitored
     bool running;           // Whether monitoring is running
+    struct ProbeEngine *engine; // Event loop probing all IPs
+    struct Resolver *resolver; // Thread looking host names up again, NULL if none
+    MonitorResultCallback on_result; // Called with every probe result, may be NULL
+    void *on_result_data;   // User data passed to on_result
+    ProbeRateLimits rate_limits; // Limits the engine paces probes by
 } Monitor;
 
 /**
@@ -63,15 +98,114 @@ int start_monitoring(Monitor *monitor);
  */
 void stop_monitoring(Monitor *monitor);
 
+/**
+ * @brief Bring the monitored IPs in line with a new configuration
+ * 
+ * IPs are matched by their configured address string. New IPs are added and
+ * scheduled, IPs missing from the configuration are removed, and IPs whose
+ * settings changed are retuned without losing their status. Untouched IPs
+ * keep probing on their current schedule. The host names of new IPs are
+ * resolved on the calling thread first; while monitoring runs the change
+ * itself is then applied on the probe engine thread between two probe
+ * rounds.
+ * 
+ * @param monitor Monitor to update
+ * @param config New configuration
+ * @return int 0 on success, -1 if some IPs could not be added
+ */
+int monitor_apply_config(Monitor *monitor, const Config *config);
+
 /**
  * @brief Check a specific IP address
  * 
  * @param ip_address IP address to check
  * @param timeout Timeout in milliseconds
- * @return int Response time in ms if reachable, -1 if unreachable
+ * @return int Response time in microseconds if reachable, -1 if unreachable
  */
 int check_ip(const char *ip_address, int timeout);
 
+/**
+ * @brief Record the outcome of one probe and update the IP's status
+ * 
+ * Called from the probe engine thread. The IP goes UP after its policy's
+ * rise answered probes in a row and DOWN after fall failed ones; in between
+ * it keeps its status. Each UP/DOWN transition adds the flap penalty to a
+ * score that halves every flap half-life. Once the score reaches
+ * flap_suppress the IP is reported FLAPPING, until it decays below
+ * flap_reuse and the IP reports the status it settled on again.
+ * 
+ * @param monitor Monitor owning the IP
+ * @param index Index of the IP in the monitor
+ * @param rtt_us Round-trip time in microseconds, -1 if the probe failed
+ */
+void monitor_record_result(Monitor *monitor, int index, long rtt_us);
+
+/**
+ * @brief Record the outcome of one probe of an address in a range
+ * 
+ * Called from the probe engine thread, which tracks whether each address of
+ * the range is alive. The range is UP while any of its addresses answers and
+ * DOWN once none does. In change mode only addresses coming up or going
+ * down are published.
+ * 
+ * @param monitor Monitor owning the range
+ * @param index Index of the range in the monitor
+ * @param offset Position of the probed address in the range
+ * @param rtt_us Round-trip time in microseconds, -1 if the probe failed
+ * @param was_alive Whether the address answered its previous probe
+ */
+void monitor_record_sweep(Monitor *monitor, int index, uint32_t offset, long rtt_us, bool was_alive);
+
+/**
+ * @brief Set the function called with every probe result
+ * 
+ * The callback runs on the probe engine thread and must not block; hand the
+ * result to another thread for anything slow.
+ * 
+ * @param monitor Monitor producing the results
+ * @param callback Function to call, NULL to stop calling it
+ * @param user_data Passed to the callback
+ */
+void monitor_set_result_callback(Monitor *monitor, MonitorResultCallback callback, void *user_data);
+
+/**
+ * @brief Copy the current state of one IP out of the monitor's store
+ * 
+ * The status fields are read as one consistent record without blocking the
+ * probe engine, which may be updating them concurrently.
+ * 
+ * @param monitor Monitor owning the IP
+ * @param index Index of the IP in the monitor
+ * @param ip Snapshot to fill; ip_address points into the monitor's string pool
+ * @return int 0 on success, -1 if the index is out of range or was removed
+ */
+int monitor_get_ip(const Monitor *monitor, int index, MonitoredIP *ip);
+
+/**
+ * @brief Summarize the round-trip times of one IP over the sliding window
+ * 
+ * Covers min/avg/max, jitter, loss and p50/p95/p99 of the last
+ * RTT_STATS_WINDOW_MS at most. Ranges keep no statistics, as their
+ * addresses are unrelated targets: their summary has no probes.
+ * 
+ * @param monitor Monitor owning the IP
+ * @param index Index of the IP in the monitor
+ * @param summary Summary to fill
+ * @return int 0 on success, -1 if the index is out of range or was removed
+ */
+int monitor_get_rtt_stats(const Monitor *monitor, int index, RttSummary *summary);
+
+/**
+ * @brief Collect the indices of all IPs with a given status
+ * 
+ * @param monitor Monitor to scan
+ * @param status Status to look for
+ * @param indices Output array, may be NULL to only count
+ * @param max Capacity of the output array
+ * @return int Number of matching IPs, which may exceed max
+ */
+int monitor_find_by_status(const Monitor *monitor, IPStatus status, int *indices, int max);
+
 /**
  * @brief Get a display-friendly string for the IP status
  * 
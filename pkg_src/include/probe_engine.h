@@ -0,0 +1,105 @@
+/**
+ * @file probe_engine.h
+ * @brief Event-loop probe engine multiplexing all targets over one thread
+ */
+
+#ifndef PROBE_ENGINE_H
+#define PROBE_ENGINE_H
+
+#include "monitor.h"
+
+#include <stdint.h>
+
+#define PROBE_ENGINE_LATENESS_BUCKETS 32
+
+typedef struct ProbeEngine ProbeEngine;
+
+typedef struct {
+    uint64_t sent;              // Echo requests handed to the kernel and other probes started
+    uint64_t replies;           // Matching echo replies received and other probes answered
+    uint64_t timeouts;          // Probes that got no reply in time or could not be sent
+    uint64_t tx_stamped;        // Replies timed from a kernel transmit timestamp
+    uint64_t paced;             // Times a due probe was held back by the rate limits
+    uint64_t lateness_sum_ns;   // Total delay of probes behind their scheduled time
+    uint64_t lateness_max_ns;   // Largest such delay
+    uint64_t lateness[PROBE_ENGINE_LATENESS_BUCKETS]; // Probes per delay bucket, bucket b holds delays below 2^b µs
+} ProbeEngineStats;
+
+/**
+ * @brief Create a probe engine for all IPs of a monitor
+ *
+ * @param monitor Monitor whose IPs will be probed
+ * @return ProbeEngine* Created engine, NULL on error
+ */
+ProbeEngine* probe_engine_create(Monitor *monitor);
+
+/**
+ * @brief Start the engine's event-loop thread
+ *
+ * @param engine Engine to start
+ * @return int 0 on success, -1 on error
+ */
+int probe_engine_start(ProbeEngine *engine);
+
+/**
+ * @brief Stop the event-loop thread and wait for it to exit
+ *
+ * @param engine Engine to stop
+ */
+void probe_engine_stop(ProbeEngine *engine);
+
+/**
+ * @brief Run a function on the engine thread and wait for it to return
+ *
+ * The function runs between two event-loop iterations, so it may change the
+ * monitor's store and call probe_engine_refresh() without racing the probe
+ * path. If the engine thread is not running the function runs directly.
+ *
+ * @param engine Engine whose thread runs the function
+ * @param fn Function to run
+ * @param arg Argument passed to the function
+ */
+void probe_engine_call(ProbeEngine *engine, void (*fn)(void *arg), void *arg);
+
+/**
+ * @brief Resynchronize the engine with a target that changed in the store
+ *
+ * Must be called from the engine thread (see probe_engine_call()) or while
+ * the engine is stopped. New targets get fresh state and a jittered first
+ * probe; retuned targets keep their history and are rescheduled within
+ * their new interval; removed or deactivated targets are unscheduled.
+ *
+ * @param engine Engine to update
+ * @param index Index of the target in the monitor's store
+ * @param reset Whether the index now holds a different target
+ * @return int 0 on success, -1 on error
+ */
+int probe_engine_refresh(ProbeEngine *engine, int index, bool reset);
+
+/**
+ * @brief Copy the engine's counters since it was created
+ *
+ * @param engine Engine to query
+ * @param stats Counters to fill
+ */
+void probe_engine_get_stats(ProbeEngine *engine, ProbeEngineStats *stats);
+
+/**
+ * @brief Apply new probe rate limits
+ *
+ * Must run on the engine thread, through probe_engine_call() while the
+ * engine is started.
+ *
+ * @param engine Engine to update
+ * @param limits New limits
+ */
+void probe_engine_set_rate_limits(ProbeEngine *engine, const ProbeRateLimits *limits);
+
+/**
+ * @brief Free resources allocated for the engine, stopping it first if needed
+ *
+ * @param engine Engine to free
+ */
+void probe_engine_free(ProbeEngine *engine);
+
+#endif /* PROBE_ENGINE_H */
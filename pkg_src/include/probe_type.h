@@ -0,0 +1,83 @@
+/**
+ * @file probe_type.h
+ * @brief Probe types other than ICMP echo, driven by the probe engine's event loop
+ *
+ * Each type is a table of functions over a ProbeSession. start() opens a
+ * non-blocking socket and begins the exchange; the engine then watches the
+ * socket in its epoll set for the events the session asks for and calls
+ * poll() whenever any of them fire, until poll() reports the probe answered
+ * or failed. complete() releases the socket, whether the probe finished or
+ * is abandoned on timeout. Nothing blocks and no type runs a thread of its
+ * own, so every probe in flight costs one descriptor and one session.
+ *
+ * ICMP echo does not go through these functions: its requests share the
+ * engine's two batched sockets (see probe_engine.c), and its entry only
+ * carries its name.
+ */
+
+#ifndef PROBE_TYPE_H
+#define PROBE_TYPE_H
+
+#include "config.h"
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define PROBE_SESSION_BUFFER 16     // Room for the start of an HTTP status line
+
+typedef enum {
+    PROBE_PENDING,              // Waiting for session->events
+    PROBE_ANSWERED,             // The target answered
+    PROBE_FAILED                // The target refused or could not be reached
+} ProbeProgress;
+
+struct ProbeOps;
+
+typedef struct {
+    const struct ProbeOps *ops; // Type of the probe in flight
+    int fd;                     // Socket of the probe in flight, -1 if none
+    uint32_t events;            // epoll events the probe waits for
+    uint32_t armed;             // Events registered with epoll, kept by the engine
+    uint64_t started_ns;        // Monotonic time the probe started
+    const char *host;           // Configured name of the target, sent by HTTP
+    uint16_t port;              // Port probed
+    uint8_t stage;              // Step reached by a probe made of several
+    uint8_t length;             // Bytes of buffer filled
+    char buffer[PROBE_SESSION_BUFFER]; // Start of a response
+} ProbeSession;
+
+typedef struct ProbeOps {
+    const char *name;           // Name of the type in the configuration
+    uint16_t default_port;      // Port probed when none is configured
+
+    /**
+     * Open the socket and begin the exchange. A probe that completes at once
+     * still reports it from its first poll().
+     * Returns 0 with fd and events set, -1 if the probe cannot be sent.
+     */
+    int (*start)(ProbeSession *session, const struct sockaddr *addr, socklen_t addr_len);
+
+    /** Advance the probe on the epoll events its socket reported. */
+    ProbeProgress (*poll)(ProbeSession *session, uint32_t events);
+
+    /** Close the socket of a finished or abandoned probe. */
+    void (*complete)(ProbeSession *session);
+} ProbeOps;
+
+/**
+ * @brief Get the functions of a probe type
+ *
+ * @param type Probe type
+ * @return const ProbeOps* Functions of the type, without any for PROBE_ICMP,
+ *         NULL for an unknown type
+ */
+const ProbeOps* probe_type_ops(ProbeType type);
+
+/**
+ * @brief Look up a probe type by its configured name
+ *
+ * @param name "icmp", "tcp", "udp" or "http"
+ * @return int ProbeType value, -1 if the name is unknown
+ */
+int probe_type_from_name(const char *name);
+
+#endif /* PROBE_TYPE_H */
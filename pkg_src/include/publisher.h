@@ -0,0 +1,71 @@
+/**
+ * @file publisher.h
+ * @brief Batched publishing of probe results off the probe path
+ *
+ * The probe engine pushes every result into a single-producer ring and
+ * returns immediately. A publisher thread drains the ring, formats the
+ * results into one payload (JSON or the compact binary layout described in
+ * result_codec.h) and hands it to a sink (e.g. an MQTT publish)
+ * once the batch holds enough results or its oldest result gets too old.
+ * A slow sink only fills the ring; results that do not fit are dropped
+ * and counted, probing itself never waits.
+ */
+
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#include "monitor.h"
+#include "result_codec.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define PUBLISHER_DEFAULT_BATCH 100
+#define PUBLISHER_DEFAULT_INTERVAL_MS 1000
+
+typedef struct Publisher Publisher;
+
+/**
+ * @brief Delivers one encoded batch of results, on the publisher thread
+ *
+ * Binary payloads are not NUL-terminated and may contain NUL bytes.
+ */
+typedef void (*PublishSink)(void *user_data, const char *payload, size_t length);
+
+/**
+ * @brief Create a publisher and start its thread
+ *
+ * The publisher is not attached to the monitor; pass publisher_push() to
+ * monitor_set_result_callback() to feed it.
+ *
+ * @param monitor Monitor whose results are published, used to look up names
+ * @param batch_size Results per payload at most, flushed as soon as reached
+ * @param interval_ms Longest time a result waits before its batch is flushed
+ * @param encoding Encoding of the payloads
+ * @param sink Function receiving each payload
+ * @param user_data Passed to the sink
+ * @return Publisher* Created publisher, NULL on error
+ */
+Publisher* publisher_create(Monitor *monitor, int batch_size, int interval_ms,
+                            PublishEncoding encoding, PublishSink sink, void *user_data);
+
+/**
+ * @brief Queue a result for publishing
+ *
+ * Matches MonitorResultCallback. Never blocks; the result is dropped if the
+ * queue is full. Only one thread may push.
+ *
+ * @param publisher Publisher to queue into (as void* for use as a callback)
+ * @param result Result to queue
+ */
+void publisher_push(void *publisher, const ProbeResult *result);
+
+/**
+ * @brief Flush queued results, stop the thread and free the publisher
+ *
+ * Detach it from the monitor first so nothing pushes concurrently.
+ *
+ * @param publisher Publisher to free
+ */
+void publisher_free(Publisher *publisher);
+
+#endif /* PUBLISHER_H */
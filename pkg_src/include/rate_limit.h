@@ -0,0 +1,84 @@
+/**
+ * @file rate_limit.h
+ * @brief Token-bucket limits on the rate probes are sent at
+ *
+ * One bucket bounds all probes, and one bucket per subnet bounds the probes
+ * sent into it. A bucket is kept in the form of the generic cell rate
+ * algorithm: a single theoretical arrival time that advances by one token's
+ * refill time per probe, and may run ahead of the clock by the burst.
+ *
+ * A probe that does not fit a bucket is not refused but reserves the
+ * earliest time it will fit, so probes held back by a limit leave one by
+ * one at the configured rate instead of all retrying at the same moment.
+ * Subnet buckets live in an open-addressing table that grows with the
+ * number of subnets probed.
+ */
+
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+typedef struct {
+    uint64_t interval_ns;   // Refill time of one token, 0 for no limit
+    uint64_t tolerance_ns;  // How far the bucket may run ahead of the clock, burst - 1 tokens
+} RateLimit;
+
+typedef struct {
+    RateLimit global;       // Limit on all probes
+    uint64_t global_tat;    // Theoretical arrival time of the next probe
+    RateLimit subnet;       // Limit on the probes into one subnet
+    int prefix_v4;          // Prefix length of an IPv4 subnet
+    int prefix_v6;          // Prefix length of an IPv6 subnet
+    struct in6_addr *subnets; // Subnet address per table slot
+    uint64_t *subnet_tat;   // Theoretical arrival time per table slot, 0 for an empty slot
+    uint32_t capacity;      // Number of table slots, a power of two or 0
+    uint32_t count;         // Number of subnets in the table
+} RateLimiter;
+
+/**
+ * @brief Initialize a limiter from configured limits
+ *
+ * @param limiter Limiter to initialize
+ * @param limits Configured limits
+ */
+void rate_limiter_init(RateLimiter *limiter, const ProbeRateLimits *limits);
+
+/**
+ * @brief Apply new limits, keeping the state of unchanged subnets
+ *
+ * @param limiter Limiter to update
+ * @param limits Configured limits
+ */
+void rate_limiter_configure(RateLimiter *limiter, const ProbeRateLimits *limits);
+
+/**
+ * @brief Free resources allocated for the limiter
+ *
+ * @param limiter Limiter to free
+ */
+void rate_limiter_free(RateLimiter *limiter);
+
+/**
+ * @brief Reserve a token from the bucket of an address's subnet
+ *
+ * @param limiter Limiter to draw from
+ * @param addr Address to be probed, IPv4 as ::ffff:a.b.c.d
+ * @param now_ns Current monotonic time in nanoseconds
+ * @return uint64_t Time the token is reserved for, now_ns if the probe may leave at once
+ */
+uint64_t rate_limiter_reserve_subnet(RateLimiter *limiter, const struct in6_addr *addr, uint64_t now_ns);
+
+/**
+ * @brief Reserve a token from the global bucket
+ *
+ * @param limiter Limiter to draw from
+ * @param now_ns Current monotonic time in nanoseconds
+ * @return uint64_t Time the token is reserved for, now_ns if the probe may leave at once
+ */
+uint64_t rate_limiter_reserve_global(RateLimiter *limiter, uint64_t now_ns);
+
+#endif /* RATE_LIMIT_H */
@@ -0,0 +1,41 @@
+/**
+ * @file resolver.h
+ * @brief Periodic host name lookups off the probe path
+ *
+ * An IP configured by host name is resolved once when it is added. Its
+ * address may change afterwards, and a name that did not resolve then stays
+ * unprobed, so a resolver thread looks names up again: unresolved ones
+ * every RESOLVER_RETRY_MS, resolved ones every RESOLVER_REFRESH_MS. The
+ * lookups run on the resolver thread, which may block on them; only the
+ * addresses that changed are handed to the probe engine thread, which
+ * stores them and restarts probing of their targets.
+ */
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "monitor.h"
+
+#define RESOLVER_RETRY_MS 30000     // Interval between lookups of names that did not resolve
+#define RESOLVER_REFRESH_MS 300000  // Interval between lookups of names that did
+
+typedef struct Resolver Resolver;
+
+/**
+ * @brief Create a resolver for the host names of a monitor and start its thread
+ *
+ * @param monitor Monitor whose names are looked up, its engine applies the changes
+ * @return Resolver* Created resolver, NULL on error
+ */
+Resolver* resolver_create(Monitor *monitor);
+
+/**
+ * @brief Stop the resolver thread and free its resources
+ *
+ * Waits for a lookup in progress to return.
+ *
+ * @param resolver Resolver to free
+ */
+void resolver_free(Resolver *resolver);
+
+#endif /* RESOLVER_H */
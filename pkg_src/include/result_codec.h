@@ -0,0 +1,120 @@
+/**
+ * @file result_codec.h
+ * @brief Encoding of probe result batches for publication
+ *
+ * A batch is built in one growable buffer, one result at a time, in either
+ * of two encodings. Consumers tell them apart by the first bytes.
+ *
+ * JSON: {"encoding":"json","results":[{"ip":..,"status":..,"rtt_us":..,"time":..},..]}
+ * Results from a CIDR block or range carry the probed address as "ip" and
+ * the configured block or range as "target". Names are escaped as JSON
+ * strings.
+ *
+ * Binary, all integers little-endian, a 20-byte header followed by
+ * fixed-size records:
+ *
+ *   offset size  header field
+ *   0      4     magic "IPMR"
+ *   4      1     format version (RESULT_CODEC_VERSION)
+ *   5      1     flags, 0
+ *   6      2     size of one record in bytes; newer versions only append fields
+ *   8      4     number of records
+ *   12     8     base time, wall-clock milliseconds of the first record
+ *
+ *   offset size  record field
+ *   0      16    address probed, IPv4 as ::ffff:a.b.c.d, zero if unresolved
+ *   16     1     address family: 4, 6, or 0 if unresolved
+ *   17     1     status, an IPStatus value
+ *   18     2     reserved, 0
+ *   20     4     round-trip time in microseconds, -1 if none (signed)
+ *   24     4     time relative to the base time in milliseconds (signed)
+ */
+
+#ifndef RESULT_CODEC_H
+#define RESULT_CODEC_H
+
+#include "monitor.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define RESULT_CODEC_MAGIC "IPMR"
+#define RESULT_CODEC_VERSION 1
+#define RESULT_CODEC_HEADER_SIZE 20
+#define RESULT_CODEC_RECORD_SIZE 28
+
+typedef struct {
+    PublishEncoding encoding;   // Encoding of the batch
+    char *data;                 // Encoded batch
+    size_t length;              // Bytes used in data
+    size_t capacity;            // Bytes allocated for data
+    uint32_t count;             // Results in the batch
+    int64_t base_time_ms;       // Time of the first result
+} ResultBatch;
+
+typedef struct {
+    struct in6_addr addr;       // Binary address, IPv4 stored as ::ffff:a.b.c.d
+    uint8_t family;             // 4, 6, or 0 if unresolved
+    uint8_t status;             // IPStatus of the result
+    int32_t rtt_us;             // Round-trip time in microseconds, -1 if none
+    int64_t time_ms;            // Wall-clock time of the result in milliseconds
+} ResultRecord;
+
+/**
+ * @brief Prepare an empty batch
+ *
+ * @param batch Batch to initialize
+ * @param encoding Encoding of the batch
+ * @return int 0 on success, -1 on error
+ */
+int result_batch_init(ResultBatch *batch, PublishEncoding encoding);
+
+/**
+ * @brief Add a result to the batch
+ *
+ * Only the result's name is read from the store's string pool, where it
+ * never moves; everything else comes from the result itself.
+ *
+ * @param batch Batch to add to
+ * @param store Store the result's index and name refer to
+ * @param result Result to add
+ * @return int 0 on success, -1 on error
+ */
+int result_batch_append(ResultBatch *batch, const IPStore *store, const ProbeResult *result);
+
+/**
+ * @brief Complete the batch so it can be published
+ *
+ * @param batch Batch holding at least one result
+ * @param length Receives the payload size in bytes
+ * @return const char* Payload, valid until the batch is cleared
+ */
+const char* result_batch_finish(ResultBatch *batch, size_t *length);
+
+/**
+ * @brief Empty the batch, keeping its buffer
+ *
+ * @param batch Batch to empty
+ */
+void result_batch_clear(ResultBatch *batch);
+
+/**
+ * @brief Free the buffer of a batch
+ *
+ * @param batch Batch to free
+ */
+void result_batch_free(ResultBatch *batch);
+
+/**
+ * @brief Decode a binary batch
+ *
+ * @param payload Payload as published
+ * @param length Payload size in bytes
+ * @param fn Called with each record in order
+ * @param user_data Passed to fn
+ * @return int Number of records, -1 if the payload is not a valid binary batch
+ */
+int result_batch_decode(const void *payload, size_t length,
+                        void (*fn)(void *user_data, const ResultRecord *record), void *user_data);
+
+#endif /* RESULT_CODEC_H */
@@ -0,0 +1,81 @@
+/**
+ * @file rtt_stats.h
+ * @brief Constant-memory round-trip time statistics of one target
+ *
+ * Probes are counted in two halves of a sliding window: samples go to the
+ * current half, and once it has covered RTT_STATS_WINDOW_MS / 2 it becomes
+ * the previous half and the oldest one is cleared. A summary therefore
+ * covers between half a window and a full window of history.
+ *
+ * Each half keeps a log-bucketed histogram in the style of HdrHistogram:
+ * every power of two is split into RTT_STATS_SUB_BUCKETS linear buckets,
+ * so percentiles carry a relative error of at most 1 / (2 * sub-buckets)
+ * from 1 µs up to half a minute. Recording a sample is O(1) and never
+ * allocates; percentiles are computed by the reader.
+ */
+
+#ifndef RTT_STATS_H
+#define RTT_STATS_H
+
+#include <stdint.h>
+
+#define RTT_STATS_WINDOW_MS 60000   // Length of the sliding window
+#define RTT_STATS_SUB_BUCKETS 4     // Buckets per power of two
+#define RTT_STATS_BUCKETS 96        // Covers RTTs below 2^25 µs (33 s), longer ones share the last bucket
+
+typedef struct {
+    uint16_t counts[RTT_STATS_BUCKETS]; // Replies per RTT bucket
+    uint32_t probes;        // Probes recorded, answered or not
+    uint32_t replies;       // Probes answered
+    uint64_t sum_us;        // Sum of the RTTs of the replies
+    int32_t min_us;         // Smallest RTT, valid when replies > 0
+    int32_t max_us;         // Largest RTT, valid when replies > 0
+} RttWindow;
+
+typedef struct {
+    RttWindow halves[2];    // Current and previous half of the window
+    int64_t start_ms;       // Monotonic start of the current half, 0 before the first sample
+    int32_t last_us;        // RTT of the previous reply, -1 if none
+    int32_t jitter_x16;     // Smoothed RTT variation (RFC 3550) in 1/16 µs
+    uint8_t current;        // Index of the current half
+} RttStats;
+
+typedef struct {
+    uint32_t probes;        // Probes in the window
+    uint32_t replies;       // Probes answered in the window
+    double loss_percent;    // Share of unanswered probes, 0 without probes
+    int32_t min_us;         // Smallest RTT, -1 without replies
+    int32_t avg_us;         // Mean RTT, -1 without replies
+    int32_t max_us;         // Largest RTT, -1 without replies
+    int32_t jitter_us;      // Smoothed RTT variation over the last replies, -1 without replies
+    int32_t p50_us;         // Median RTT, -1 without replies
+    int32_t p95_us;         // 95th percentile RTT, -1 without replies
+    int32_t p99_us;         // 99th percentile RTT, -1 without replies
+} RttSummary;
+
+/**
+ * @brief Reset statistics to an empty window
+ *
+ * @param stats Statistics to reset
+ */
+void rtt_stats_init(RttStats *stats);
+
+/**
+ * @brief Record the outcome of one probe
+ *
+ * @param stats Statistics to update
+ * @param rtt_us Round-trip time in microseconds, -1 if the probe failed
+ * @param now_ms Current monotonic time in milliseconds
+ */
+void rtt_stats_record(RttStats *stats, long rtt_us, int64_t now_ms);
+
+/**
+ * @brief Summarize the probes of the sliding window
+ *
+ * @param stats Statistics to summarize, typically a copy taken by a reader
+ * @param now_ms Current monotonic time in milliseconds, halves that slid out are ignored
+ * @param summary Summary to fill
+ */
+void rtt_stats_summarize(const RttStats *stats, int64_t now_ms, RttSummary *summary);
+
+#endif /* RTT_STATS_H */
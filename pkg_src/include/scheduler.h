@@ -0,0 +1,86 @@
+/**
+ * @file scheduler.h
+ * @brief Deadline scheduler for probe targets
+ *
+ * An indexed binary min-heap keyed by absolute monotonic deadlines. Each
+ * target id appears at most once, so rescheduling a target updates its
+ * entry in place instead of queuing a duplicate.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t *heap;         // Target ids ordered by deadline
+    uint64_t *deadline;     // Deadline per target id, in nanoseconds
+    int32_t *position;      // Heap position per target id, -1 if not scheduled
+    int size;               // Number of scheduled targets
+    int capacity;           // Largest target id + 1 the scheduler can hold
+} Scheduler;
+
+/**
+ * @brief Initialize an empty scheduler
+ *
+ * @param scheduler Scheduler to initialize
+ * @param capacity Number of target ids to support
+ * @return int 0 on success, -1 on error
+ */
+int scheduler_init(Scheduler *scheduler, int capacity);
+
+/**
+ * @brief Grow the scheduler to support more target ids
+ *
+ * @param scheduler Scheduler to grow
+ * @param capacity New number of target ids, ignored if not larger
+ * @return int 0 on success, -1 on error
+ */
+int scheduler_reserve(Scheduler *scheduler, int capacity);
+
+/**
+ * @brief Free resources allocated for the scheduler
+ *
+ * @param scheduler Scheduler to free
+ */
+void scheduler_free(Scheduler *scheduler);
+
+/**
+ * @brief Schedule a target, or move it if it is already scheduled
+ *
+ * @param scheduler Scheduler to update
+ * @param id Target id, below the scheduler capacity
+ * @param deadline Absolute deadline in nanoseconds
+ */
+void scheduler_set(Scheduler *scheduler, uint32_t id, uint64_t deadline);
+
+/**
+ * @brief Remove a target from the schedule if present
+ *
+ * @param scheduler Scheduler to update
+ * @param id Target id
+ */
+void scheduler_remove(Scheduler *scheduler, uint32_t id);
+
+/**
+ * @brief Get the earliest scheduled target without removing it
+ *
+ * @param scheduler Scheduler to inspect
+ * @param id Earliest target id
+ * @param deadline Its deadline
+ * @return true if a target is scheduled, false if the scheduler is empty
+ */
+bool scheduler_peek(const Scheduler *scheduler, uint32_t *id, uint64_t *deadline);
+
+/**
+ * @brief Remove and return the earliest target if its deadline has passed
+ *
+ * @param scheduler Scheduler to update
+ * @param now Current time in nanoseconds
+ * @param id Expired target id
+ * @return true if a target was due, false otherwise
+ */
+bool scheduler_pop_due(Scheduler *scheduler, uint64_t now, uint32_t *id);
+
+#endif /* SCHEDULER_H */
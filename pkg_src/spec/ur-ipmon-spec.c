@@ -1,6 +1,7 @@
 #include "../include/config.h"
 #include "../include/logger.h"
 #include "../include/monitor.h"
+#include "../include/publisher.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,7 @@
 #include <getopt.h>
 #include <limits.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "ur-rpc-template.h"
 
@@ -25,11 +27,16 @@ volatile sig_atomic_t running = 1;
 
 static Monitor *g_monitor = NULL;
 static Config *g_config = NULL;
+static Publisher *g_publisher = NULL;
+static pthread_mutex_t g_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool g_starting = false;         // Monitoring thread created, g_monitor not yet set
+static char *g_pending = NULL;          // Latest request received while starting
 
 static void signal_handler(int signo);
 static void print_usage(const char *program_name);
 static void cleanup(void);
-char *create_config_file(const char *config);
+static void publish_results(void *user_data, const char *payload, size_t length);
+static void apply_action(Config *config);
 
 void* function_ipmon_single(void *args) {
     char *config_value = (char*)args;
@@ -52,69 +59,141 @@ void* function_ipmon_single(void *args) {
             break;
         }
     }
-    char *config_file = create_config_file(config_value);
     char *log_file = NULL;
     int display_interval = 1;  
     LogLevel log_level = LOG_ERROR;
     
-    log_message(LOG_INFO, "Starting IP Monitor. Loading configuration from %s", config_file);
-    Config *config = load_config(config_file);
+    // The request carries the configuration itself, parse it where it lies
+    log_message(LOG_INFO, "Starting IP Monitor. Loading configuration from %s", IPMON_ACTION_TOPIC);
+    Config *config = load_config_from_buffer(config_value, strlen(config_value));
     if (!config) {
         log_message(LOG_ERROR, "Failed to load configuration. Exiting.");
         exit(EXIT_FAILURE);
     }
     
-    g_monitor = init_monitor(config);
-    if (!g_monitor) {
+    Monitor *monitor = init_monitor(config);
+    if (!monitor) {
         log_message(LOG_ERROR, "Failed to initialize monitor. Exiting.");
         free_config(config);
         exit(EXIT_FAILURE);
     }
     
-    log_message(LOG_INFO, "Starting monitoring of %d IP addresses", g_monitor->ip_count);
-    if (start_monitoring(g_monitor) != 0) {
+    // Results leave on IPMON_RESULT_TOPIC from the publisher thread, never from the probe path
+    g_publisher = publisher_create(monitor, config->publish_batch, config->publish_interval_ms,
+                                   config->publish_encoding, publish_results, context);
+    if (g_publisher) {
+        monitor_set_result_callback(monitor, publisher_push, g_publisher);
+    } else {
+        log_message(LOG_WARNING, "Failed to create result publisher, results will not be published");
+    }
+    
+    log_message(LOG_INFO, "Starting monitoring of %d IP addresses", monitor->ip_count);
+    if (start_monitoring(monitor) != 0) {
         log_message(LOG_ERROR, "Failed to start monitoring. Exiting.");
-        free_monitor(g_monitor);
+        publisher_free(g_publisher);
+        g_publisher = NULL;
+        free_monitor(monitor);
         free_config(config);
         exit(EXIT_FAILURE);
     }
     
+    // Later requests are applied to this monitor by ipmon_handle_action(),
+    // the last one that arrived while starting is applied here
+    pthread_mutex_lock(&g_config_lock);
+    g_monitor = monitor;
     g_config = config;
+    g_starting = false;
+    if (g_pending) {
+        Config *pending = load_config_from_buffer(g_pending, strlen(g_pending));
+        if (pending) {
+            apply_action(pending);
+        } else {
+            log_message(LOG_ERROR, "Ignoring invalid configuration on %s", IPMON_ACTION_TOPIC);
+        }
+        free(g_pending);
+        g_pending = NULL;
+    }
+    pthread_mutex_unlock(&g_config_lock);
+    
     time_t last_config_check = time(NULL);
     const int config_check_interval = 5; 
     
+    // inotify reports config rewrites immediately, stat() polling is the fallback.
+    // Configurations received as messages have no file and are updated by message.
+    ConfigWatcher watcher;
+    bool from_file = g_config->filename != NULL;
+    bool watching = from_file && config_watch_init(&watcher, g_config->filename) == 0;
+    
     log_message(LOG_INFO, "Monitoring started. Displaying status every %d seconds", display_interval);
-    log_message(LOG_INFO, "Dynamic configuration enabled. Checking for changes every %d seconds", config_check_interval);
+    if (watching) {
+        log_message(LOG_INFO, "Dynamic configuration enabled. Watching %s for changes", g_config->filename);
+    } else if (from_file) {
+        log_message(LOG_INFO, "Dynamic configuration enabled. Checking for changes every %d seconds", config_check_interval);
+    } else {
+        log_message(LOG_INFO, "Dynamic configuration enabled. Listening for changes on %s", IPMON_ACTION_TOPIC);
+    }
     
     while (g_monitor->running) {
         display_status(g_monitor);
         thread_check_pause(&manager, thread_id);
-        time_t current_time = time(NULL);
-        if (current_time - last_config_check >= config_check_interval) {
-            if (reload_config_if_changed(&g_config)) {
+        
+        bool file_changed = false;
+        if (watching) {
+            int changed = config_watch_wait(&watcher, display_interval * 1000);
+            if (changed < 0) {
+                log_message(LOG_WARNING, "Lost config watch, falling back to polling");
+                config_watch_free(&watcher);
+                watching = false;
+            } else if (changed > 0) {
+                log_message(LOG_INFO, "Configuration file has been modified");
+                file_changed = true;
+            }
+        } else {
+            time_t current_time = time(NULL);
+            if (from_file && current_time - last_config_check >= config_check_interval) {
+                pthread_mutex_lock(&g_config_lock);
+                file_changed = config_has_changed(g_config);
+                pthread_mutex_unlock(&g_config_lock);
+                last_config_check = current_time;
+            }
+            sleep(display_interval);
+        }
+        
+        if (file_changed) {
+            pthread_mutex_lock(&g_config_lock);
+            if (reload_config(&g_config)) {
                 log_message(LOG_INFO, "Configuration has changed, updating monitor");
-                stop_monitoring(g_monitor);
-                free_monitor(g_monitor);
-                g_monitor = init_monitor(g_config);
-                if (!g_monitor) {
-                    log_message(LOG_ERROR, "Failed to reinitialize monitor after config change");
-                    exit(EXIT_FAILURE);
+                // Unchanged IPs keep probing, only the difference is applied
+                if (monitor_apply_config(g_monitor, g_config) != 0) {
+                    log_message(LOG_WARNING, "Some IPs could not be added after config change");
                 }
-                if (start_monitoring(g_monitor) != 0) {
-                    log_message(LOG_ERROR, "Failed to restart monitoring after config change");
-                    free_monitor(g_monitor);
-                    exit(EXIT_FAILURE);
-                }
-                log_message(LOG_INFO, "Monitoring restarted with new configuration");
             }
-            last_config_check = current_time;
+            pthread_mutex_unlock(&g_config_lock);
         }
-        sleep(display_interval);
+    }
+    if (watching) {
+        config_watch_free(&watcher);
     }
     exit(EXIT_FAILURE);
 }
 
+static void publish_results(void *user_data, const char *payload, size_t length) {
+    MqttThreadContext *mqtt = (MqttThreadContext *)user_data;
+    int rc = mosquitto_publish(mqtt->mosq, NULL, IPMON_RESULT_TOPIC, (int)length, payload, 0, false);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        log_message(LOG_WARNING, "Failed to publish results: %s", mosquitto_strerror(rc));
+    }
+}
+
 static void cleanup(void) {
+    // The publisher reads names from the monitor, so it goes first
+    if (g_publisher) {
+        if (g_monitor) {
+            monitor_set_result_callback(g_monitor, NULL, NULL);
+        }
+        publisher_free(g_publisher);
+        g_publisher = NULL;
+    }
     if (g_monitor) {
         free_monitor(g_monitor);
         g_monitor = NULL;
@@ -123,40 +202,60 @@ static void cleanup(void) {
         free_config(g_config);
         g_config = NULL;
     }
+    free(g_pending);
+    g_pending = NULL;
     close_logger();
 }
 
-char *create_config_file(const char *config) {
-    if (config == NULL) {
-        return NULL;
-    }
-    char path[255];
-    snprintf(path, sizeof(path), "/tmp/ipmon-config-XXXXXX");
-    int fd = mkstemp(path);
-    if (fd == -1) { return NULL;  }
-    size_t len = strlen(config);
-    const char *p = config;
-    while (len > 0) {
-        ssize_t n = write(fd, p, len);
-        if (n < 0) {
-            if (errno == EINTR) { continue; }
-            close(fd);unlink(path);
-            return NULL;
-        } else if (n == 0) {
-            close(fd);unlink(path);
-            return NULL;
+// Apply a configuration to the running monitor, called with g_config_lock held
+static void apply_action(Config *config) {
+    // Unchanged IPs keep probing, only the difference is applied
+    if (monitor_apply_config(g_monitor, config) != 0) {
+        log_message(LOG_WARNING, "Some IPs could not be added after config change");
+    }
+    free_config(g_config);
+    g_config = config;
+}
+
+void ipmon_handle_action(const char *payload, size_t length) {
+    pthread_mutex_lock(&g_config_lock);
+    
+    if (g_starting) {
+        // Only one monitoring thread may start, keep the latest request for it
+        char *pending = strndup(payload, length);
+        if (pending) {
+            free(g_pending);
+            g_pending = pending;
+        } else {
+            log_message(LOG_ERROR, "Dropping configuration received while monitoring starts");
         }
-        len -= n;
-        p += n;
+        pthread_mutex_unlock(&g_config_lock);
+        return;
     }
-    if (close(fd) == -1) {
-        unlink(path);return NULL;
+    
+    if (!g_monitor) {
+        // First request: the monitoring thread owns the copy for its lifetime
+        char *config_value = strndup(payload, length);
+        unsigned int new_id;
+        g_starting = config_value != NULL;
+        if (!config_value || thread_create(&manager, function_ipmon_single, config_value, &new_id) <= 0) {
+            log_message(LOG_ERROR, "Failed to start monitoring thread");
+            g_starting = false;
+            free(config_value);
+        }
+        pthread_mutex_unlock(&g_config_lock);
+        return;
     }
-    char *result = strdup(path);
-    if (!result) {
-        unlink(path);return NULL;
+    
+    Config *config = load_config_from_buffer(payload, length);
+    if (!config) {
+        log_message(LOG_ERROR, "Ignoring invalid configuration on %s", IPMON_ACTION_TOPIC);
+        pthread_mutex_unlock(&g_config_lock);
+        return;
     }
-    return result;
+    
+    apply_action(config);
+    pthread_mutex_unlock(&g_config_lock);
 }
 
 
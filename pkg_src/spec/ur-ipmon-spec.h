@@ -20,4 +20,15 @@
 #define IPMON_RESULT_TOPIC "ur-ipmon/results"
 
 void *function_ipmon_single(void *args);
+
+/**
+ * @brief Handle a configuration received on IPMON_ACTION_TOPIC
+ *
+ * The first configuration starts the monitoring thread; later ones are
+ * parsed from the payload in memory and applied to the running monitor.
+ *
+ * @param payload JSON configuration, need not be NUL-terminated
+ * @param length Length of the payload in bytes
+ */
+void ipmon_handle_action(const char *payload, size_t length);
 void *function_heartbeat(void *args);
\ No newline at end of file
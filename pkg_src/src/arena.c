@@ -0,0 +1,154 @@
+/**
+ * @file arena.c
+ * @brief Implementation of the bump allocator and its cJSON hooks
+ */
+
+#include "../include/arena.h"
+#include "../include/logger.h"
+#include "../include/cJSON.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <pthread.h>
+
+#define ARENA_DEFAULT_BLOCK 16384   // First block size when none is given
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct ArenaBlock {
+    ArenaBlock *next;       // Older block
+    size_t size;            // Usable bytes in data
+    size_t used;            // Bytes handed out from data
+    alignas(max_align_t) unsigned char data[];
+};
+
+static _Thread_local Arena *json_arena = NULL;
+static pthread_once_t json_hooks_once = PTHREAD_ONCE_INIT;
+
+void arena_init(Arena *arena, size_t block_size) {
+    arena->head = NULL;
+    arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK;
+    arena->used = 0;
+}
+
+static ArenaBlock* new_block(Arena *arena, size_t size) {
+    size_t block_size = arena->block_size ? arena->block_size : ARENA_DEFAULT_BLOCK;
+    while (block_size < size) {
+        block_size *= 2;
+    }
+
+    ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + block_size);
+    if (!block) {
+        log_message(LOG_ERROR, "Memory allocation failed for arena block of %zu bytes", block_size);
+        return NULL;
+    }
+    block->size = block_size;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+
+    // Grow geometrically so large documents need few blocks
+    arena->block_size = block_size * 2;
+    return block;
+}
+
+static void* alloc_aligned(Arena *arena, size_t size, size_t align) {
+    ArenaBlock *block = arena->head;
+    size_t offset = block ? (block->used + align - 1) & ~(align - 1) : 0;
+    if (!block || offset > block->size || block->size - offset < size) {
+        block = new_block(arena, size);
+        if (!block) {
+            return NULL;
+        }
+        offset = 0;
+    }
+
+    void *pointer = block->data + offset;
+    arena->used += offset + size - block->used;
+    block->used = offset + size;
+    return pointer;
+}
+
+void* arena_alloc(Arena *arena, size_t size) {
+    return alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+char* arena_strdup(Arena *arena, const char *string) {
+    // Strings need no alignment, packing them keeps short names from wasting space
+    size_t length = strlen(string) + 1;
+    char *copy = (char *)alloc_aligned(arena, length, 1);
+    if (copy) {
+        memcpy(copy, string, length);
+    }
+    return copy;
+}
+
+bool arena_owns(const Arena *arena, const void *pointer) {
+    const unsigned char *p = (const unsigned char *)pointer;
+    for (const ArenaBlock *block = arena->head; block; block = block->next) {
+        if (p >= block->data && p < block->data + block->size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void arena_reset(Arena *arena) {
+    if (!arena->head) {
+        return;
+    }
+
+    // The newest block is the largest, it alone is kept
+    ArenaBlock *block = arena->head->next;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head->next = NULL;
+    arena->head->used = 0;
+    arena->block_size = arena->head->size;
+    arena->used = 0;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->used = 0;
+}
+
+static void *json_malloc(size_t size) {
+    Arena *arena = json_arena;
+    return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+static void json_free(void *pointer) {
+    // Items from the arena go away with it, anything else came from malloc()
+    Arena *arena = json_arena;
+    if (arena && arena_owns(arena, pointer)) {
+        return;
+    }
+    free(pointer);
+}
+
+static void install_json_hooks(void) {
+    cJSON_Hooks hooks = { json_malloc, json_free };
+    cJSON_InitHooks(&hooks);
+}
+
+Arena* arena_json_begin(Arena *arena) {
+    pthread_once(&json_hooks_once, install_json_hooks);
+
+    Arena *previous = json_arena;
+    json_arena = arena;
+    return previous;
+}
+
+void arena_json_end(Arena *previous) {
+    json_arena = previous;
+}
@@ -208,10 +208,24 @@ CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks)
         return;
     }
 
-    global_hooks.allocate = hooks->malloc_fn;
-    global_hooks.deallocate = hooks->free_fn;
+    global_hooks.allocate = malloc;
+    if (hooks->malloc_fn != NULL)
+    {
+        global_hooks.allocate = hooks->malloc_fn;
+    }
+
+    global_hooks.deallocate = free;
+    if (hooks->free_fn != NULL)
+    {
+        global_hooks.deallocate = hooks->free_fn;
+    }
+
     /* use realloc only if both free and malloc are used */
-    global_hooks.reallocate = (hooks->malloc_fn && hooks->free_fn) ? hooks->malloc_fn : NULL;
+    global_hooks.reallocate = NULL;
+    if ((global_hooks.allocate == malloc) && (global_hooks.deallocate == free))
+    {
+        global_hooks.reallocate = realloc;
+    }
 }
 
 /* Internal constructor. */
@@ -6,202 +6,645 @@
 #include "../include/config.h"
 #include "../include/logger.h"
 #include "../include/cJSON.h"
+#include "../include/arena.h"
+#include "../include/config_snapshot.h"
+#include "../include/probe_type.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
 
 #define DEFAULT_INTERVAL 5  // Default interval: 5 seconds
 #define DEFAULT_TIMEOUT 1000 // Default timeout: 1000 milliseconds (1 second)
 #define CONFIG_CHECK_INTERVAL 5 // Check for config changes every 5 seconds
+#define MIN_INTERVAL_MS 1 // Shortest supported monitoring interval
+#define MIN_TIMEOUT_MS 1    // Shortest supported probe timeout
+#define MAX_TIMEOUT_MS (INT_MAX / 1000) // Longest probe timeout, still countable in microseconds
+#define DEFAULT_KEEPALIVE_MS 60000 // Keep-alive period of change-only publication
+#define DEFAULT_PUBLISH_BATCH 100 // Results per published message
+#define DEFAULT_PUBLISH_INTERVAL_MS 1000 // Longest delay before publishing a result
+#define DEFAULT_SUBNET_PREFIX_V4 24 // IPv4 subnet of the per-subnet rate limit
+#define DEFAULT_SUBNET_PREFIX_V6 64 // IPv6 subnet of the per-subnet rate limit
+#define DEFAULT_RISE 1      // Answered probes that mark an IP UP
+#define DEFAULT_FALL 3      // Failed probes that mark an IP DOWN
+#define DEFAULT_FLAP_PENALTY 1000 // Penalty of one UP/DOWN transition
+#define DEFAULT_FLAP_SUPPRESS 3000 // Penalty reported as FLAPPING
+#define DEFAULT_FLAP_REUSE 1000 // Penalty below which FLAPPING ends
+#define DEFAULT_FLAP_HALF_LIFE_MS 60000 // Half-life of the flap penalty
+#define MAX_THRESHOLD 255   // Most probes rise and fall may count
+#define CONFIG_TREE_FACTOR 4 // Parse tree bytes per document byte, roughly
 
-Config* load_config(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        log_message(LOG_ERROR, "Failed to open configuration file: %s", filename);
-        return NULL;
+// Saturating conversion matching cJSON's valueint
+static int field_int(const ConfigField *field) {
+    if (field->number >= (double)INT_MAX) {
+        return INT_MAX;
+    }
+    if (field->number <= (double)INT_MIN) {
+        return INT_MIN;
     }
+    return (int)field->number;
+}
 
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+// Member names the readers understand, settings and per-IP ones alike
+typedef enum {
+    KEY_IP,
+    KEY_INTERVAL,
+    KEY_INTERVAL_MS,
+    KEY_MIN_INTERVAL,
+    KEY_MIN_INTERVAL_MS,
+    KEY_MAX_INTERVAL,
+    KEY_MAX_INTERVAL_MS,
+    KEY_TIMEOUT,
+    KEY_TYPE,
+    KEY_PORT,
+    KEY_ACTIVE,
+    KEY_PUBLISH,
+    KEY_RTT_THRESHOLD_MS,
+    KEY_KEEPALIVE,
+    KEY_KEEPALIVE_MS,
+    KEY_RISE,
+    KEY_FALL,
+    KEY_FLAP_PENALTY,
+    KEY_FLAP_SUPPRESS,
+    KEY_FLAP_REUSE,
+    KEY_FLAP_HALF_LIFE,
+    KEY_FLAP_HALF_LIFE_MS,
+    KEY_DEFAULT_INTERVAL,
+    KEY_DEFAULT_INTERVAL_MS,
+    KEY_DEFAULT_MIN_INTERVAL,
+    KEY_DEFAULT_MIN_INTERVAL_MS,
+    KEY_DEFAULT_MAX_INTERVAL,
+    KEY_DEFAULT_MAX_INTERVAL_MS,
+    KEY_DEFAULT_TIMEOUT,
+    KEY_PUBLISH_BATCH,
+    KEY_PUBLISH_INTERVAL_MS,
+    KEY_PUBLISH_ENCODING,
+    KEY_PROBE_RATE,
+    KEY_PROBE_BURST,
+    KEY_SUBNET_PROBE_RATE,
+    KEY_SUBNET_PROBE_BURST,
+    KEY_SUBNET_PREFIX,
+    KEY_SUBNET_PREFIX_V6,
+    KEY_COUNT
+} ConfigKey;
 
-    // Read the file content
-    char *json_data = (char*)malloc(file_size + 1);
-    if (!json_data) {
-        log_message(LOG_ERROR, "Memory allocation failed for config file content");
-        fclose(file);
-        return NULL;
+typedef struct {
+    const ConfigField *field[KEY_COUNT]; // Member per known name, NULL if absent
+} FieldIndex;
+
+// Names are told apart by their first letter, then compared case-insensitively like cJSON does
+static int config_key(const char *key) {
+    switch (key[0] | 0x20) {
+        case 'a':
+            if (strcasecmp(key, "active") == 0) return KEY_ACTIVE;
+            break;
+        case 'd':
+            if (strcasecmp(key, "default_interval") == 0) return KEY_DEFAULT_INTERVAL;
+            if (strcasecmp(key, "default_interval_ms") == 0) return KEY_DEFAULT_INTERVAL_MS;
+            if (strcasecmp(key, "default_min_interval") == 0) return KEY_DEFAULT_MIN_INTERVAL;
+            if (strcasecmp(key, "default_min_interval_ms") == 0) return KEY_DEFAULT_MIN_INTERVAL_MS;
+            if (strcasecmp(key, "default_max_interval") == 0) return KEY_DEFAULT_MAX_INTERVAL;
+            if (strcasecmp(key, "default_max_interval_ms") == 0) return KEY_DEFAULT_MAX_INTERVAL_MS;
+            if (strcasecmp(key, "default_timeout") == 0) return KEY_DEFAULT_TIMEOUT;
+            break;
+        case 'f':
+            if (strcasecmp(key, "fall") == 0) return KEY_FALL;
+            if (strcasecmp(key, "flap_penalty") == 0) return KEY_FLAP_PENALTY;
+            if (strcasecmp(key, "flap_suppress") == 0) return KEY_FLAP_SUPPRESS;
+            if (strcasecmp(key, "flap_reuse") == 0) return KEY_FLAP_REUSE;
+            if (strcasecmp(key, "flap_half_life") == 0) return KEY_FLAP_HALF_LIFE;
+            if (strcasecmp(key, "flap_half_life_ms") == 0) return KEY_FLAP_HALF_LIFE_MS;
+            break;
+        case 'i':
+            if (strcasecmp(key, "ip") == 0) return KEY_IP;
+            if (strcasecmp(key, "interval") == 0) return KEY_INTERVAL;
+            if (strcasecmp(key, "interval_ms") == 0) return KEY_INTERVAL_MS;
+            break;
+        case 'k':
+            if (strcasecmp(key, "keepalive") == 0) return KEY_KEEPALIVE;
+            if (strcasecmp(key, "keepalive_ms") == 0) return KEY_KEEPALIVE_MS;
+            break;
+        case 'm':
+            if (strcasecmp(key, "min_interval") == 0) return KEY_MIN_INTERVAL;
+            if (strcasecmp(key, "min_interval_ms") == 0) return KEY_MIN_INTERVAL_MS;
+            if (strcasecmp(key, "max_interval") == 0) return KEY_MAX_INTERVAL;
+            if (strcasecmp(key, "max_interval_ms") == 0) return KEY_MAX_INTERVAL_MS;
+            break;
+        case 'p':
+            if (strcasecmp(key, "port") == 0) return KEY_PORT;
+            if (strcasecmp(key, "publish") == 0) return KEY_PUBLISH;
+            if (strcasecmp(key, "publish_batch") == 0) return KEY_PUBLISH_BATCH;
+            if (strcasecmp(key, "publish_interval_ms") == 0) return KEY_PUBLISH_INTERVAL_MS;
+            if (strcasecmp(key, "publish_encoding") == 0) return KEY_PUBLISH_ENCODING;
+            if (strcasecmp(key, "probe_rate") == 0) return KEY_PROBE_RATE;
+            if (strcasecmp(key, "probe_burst") == 0) return KEY_PROBE_BURST;
+            break;
+        case 'r':
+            if (strcasecmp(key, "rtt_threshold_ms") == 0) return KEY_RTT_THRESHOLD_MS;
+            if (strcasecmp(key, "rise") == 0) return KEY_RISE;
+            break;
+        case 's':
+            if (strcasecmp(key, "subnet_probe_rate") == 0) return KEY_SUBNET_PROBE_RATE;
+            if (strcasecmp(key, "subnet_probe_burst") == 0) return KEY_SUBNET_PROBE_BURST;
+            if (strcasecmp(key, "subnet_prefix") == 0) return KEY_SUBNET_PREFIX;
+            if (strcasecmp(key, "subnet_prefix_v6") == 0) return KEY_SUBNET_PREFIX_V6;
+            break;
+        case 't':
+            if (strcasecmp(key, "timeout") == 0) return KEY_TIMEOUT;
+            if (strcasecmp(key, "type") == 0) return KEY_TYPE;
+            break;
+        default:
+            break;
     }
+    return -1;
+}
 
-    size_t read_size = fread(json_data, 1, file_size, file);
-    fclose(file);
+// One pass over an object's members; the first of each name wins, as with cJSON_GetObjectItem()
+static void index_fields(FieldIndex *index, const ConfigField *fields, int count) {
+    memset(index, 0, sizeof(*index));
+    for (int i = 0; i < count; i++) {
+        int key = config_key(fields[i].key);
+        if (key >= 0 && !index->field[key]) {
+            index->field[key] = &fields[i];
+        }
+    }
+}
 
-    if (read_size != file_size) {
-        log_message(LOG_ERROR, "Failed to read the entire config file");
-        free(json_data);
-        return NULL;
+// A member of the wrong type counts as absent
+static const ConfigField* get_field(const FieldIndex *index, ConfigKey key, ConfigValueType type) {
+    const ConfigField *field = index->field[key];
+    return field && field->type == type ? field : NULL;
+}
+
+// Intervals may be given as (fractional) seconds or as whole milliseconds
+static int parse_interval_ms(const FieldIndex *index, ConfigKey seconds_key,
+                             ConfigKey ms_key, int fallback_ms) {
+    int interval_ms = fallback_ms;
+
+    const ConfigField *seconds = get_field(index, seconds_key, CONFIG_VALUE_NUMBER);
+    if (seconds) {
+        interval_ms = (int)(seconds->number * 1000.0 + 0.5);
     }
 
-    json_data[file_size] = '\0';
+    const ConfigField *ms = get_field(index, ms_key, CONFIG_VALUE_NUMBER);
+    if (ms) {
+        interval_ms = field_int(ms);
+    }
 
-    // Parse JSON
-    cJSON *root = cJSON_Parse(json_data);
-    free(json_data);
+    if ((seconds || ms) && interval_ms < MIN_INTERVAL_MS) {
+        return MIN_INTERVAL_MS;
+    }
+    return interval_ms;
+}
 
-    if (!root) {
-        const char *error_ptr = cJSON_GetErrorPtr();
-        if (error_ptr) {
-            log_message(LOG_ERROR, "JSON parsing error near: %s", error_ptr);
+// Timeouts are clamped to [MIN_TIMEOUT_MS, MAX_TIMEOUT_MS], the engine counts them in microseconds
+static int parse_timeout_ms(const FieldIndex *index, ConfigKey key, int fallback_ms) {
+    const ConfigField *field = get_field(index, key, CONFIG_VALUE_NUMBER);
+    if (!field) {
+        return fallback_ms;
+    }
+
+    int timeout_ms = field_int(field);
+    if (timeout_ms < MIN_TIMEOUT_MS || timeout_ms > MAX_TIMEOUT_MS) {
+        int clamped = timeout_ms < MIN_TIMEOUT_MS ? MIN_TIMEOUT_MS : MAX_TIMEOUT_MS;
+        log_message(LOG_WARNING, "Out-of-range value %g of '%s', using %d ms", field->number, field->key, clamped);
+        return clamped;
+    }
+    return timeout_ms;
+}
+
+// A number within [min, max], anything else leaves the value unchanged
+static void parse_bounded(const FieldIndex *index, ConfigKey key, int min, int max, int *value) {
+    const ConfigField *field = get_field(index, key, CONFIG_VALUE_NUMBER);
+    if (field && field->number >= min && field->number <= max) {
+        *value = field_int(field);
+    } else if (field) {
+        log_message(LOG_WARNING, "Ignoring out-of-range value %g of '%s'", field->number, field->key);
+    }
+}
+
+// Status thresholds and flap damping, read the same way for the defaults and for each IP
+static void parse_status_policy(const FieldIndex *index, StatusPolicy *policy) {
+    parse_bounded(index, KEY_RISE, 1, MAX_THRESHOLD, &policy->rise);
+    parse_bounded(index, KEY_FALL, 1, MAX_THRESHOLD, &policy->fall);
+    parse_bounded(index, KEY_FLAP_PENALTY, 0, INT_MAX / 4, &policy->flap_penalty);
+    parse_bounded(index, KEY_FLAP_SUPPRESS, 1, INT_MAX / 4, &policy->flap_suppress);
+    parse_bounded(index, KEY_FLAP_REUSE, 0, INT_MAX / 4, &policy->flap_reuse);
+    policy->flap_half_life_ms = parse_interval_ms(index, KEY_FLAP_HALF_LIFE, KEY_FLAP_HALF_LIFE_MS,
+                                                  policy->flap_half_life_ms);
+
+    // Without a gap between the two, every transition would enter and leave FLAPPING
+    if (policy->flap_reuse >= policy->flap_suppress) {
+        log_message(LOG_WARNING, "flap_reuse %d is not below flap_suppress %d, using %d",
+                    policy->flap_reuse, policy->flap_suppress, policy->flap_suppress / 2);
+        policy->flap_reuse = policy->flap_suppress / 2;
+    }
+}
+
+// Probe type and port, read the same way for the defaults and for each IP
+static void parse_probe(const FieldIndex *index, ProbeType *type, int *port) {
+    const ConfigField *name = get_field(index, KEY_TYPE, CONFIG_VALUE_STRING);
+    if (name) {
+        int parsed = probe_type_from_name(name->string);
+        if (parsed >= 0) {
+            *type = (ProbeType)parsed;
         } else {
-            log_message(LOG_ERROR, "JSON parsing error");
+            log_message(LOG_WARNING, "Unknown probe type '%s', expected 'icmp', 'tcp', 'udp' or 'http'",
+                        name->string);
+        }
+    }
+    parse_bounded(index, KEY_PORT, 0, 65535, port);
+}
+
+// Publication settings, read the same way for the defaults and for each IP
+static void parse_publish(const FieldIndex *index, PublishMode *mode,
+                          int *rtt_threshold_ms, int *keepalive_ms) {
+    const ConfigField *publish = get_field(index, KEY_PUBLISH, CONFIG_VALUE_STRING);
+    if (publish) {
+        if (strcmp(publish->string, "change") == 0) {
+            *mode = PUBLISH_CHANGE;
+        } else if (strcmp(publish->string, "all") == 0) {
+            *mode = PUBLISH_ALL;
+        } else {
+            log_message(LOG_WARNING, "Unknown publish mode '%s', expected 'all' or 'change'", publish->string);
         }
-        return NULL;
     }
 
-    // Allocate config structure
-    Config *config = (Config*)malloc(sizeof(Config));
+    const ConfigField *threshold = get_field(index, KEY_RTT_THRESHOLD_MS, CONFIG_VALUE_NUMBER);
+    if (threshold && field_int(threshold) >= 0) {
+        *rtt_threshold_ms = field_int(threshold);
+    }
+
+    // Keep-alive in (fractional) seconds or milliseconds, 0 disables it
+    const ConfigField *seconds = get_field(index, KEY_KEEPALIVE, CONFIG_VALUE_NUMBER);
+    if (seconds && seconds->number >= 0) {
+        *keepalive_ms = (int)(seconds->number * 1000.0 + 0.5);
+    }
+    const ConfigField *ms = get_field(index, KEY_KEEPALIVE_MS, CONFIG_VALUE_NUMBER);
+    if (ms && field_int(ms) >= 0) {
+        *keepalive_ms = field_int(ms);
+    }
+}
+
+Config* config_create(size_t string_hint) {
+    Config *config = (Config*)calloc(1, sizeof(Config));
     if (!config) {
         log_message(LOG_ERROR, "Memory allocation failed for config");
-        cJSON_Delete(root);
         return NULL;
     }
 
     // Set defaults
     config->default_interval = DEFAULT_INTERVAL;
+    config->default_interval_ms = DEFAULT_INTERVAL * 1000;
     config->default_timeout = DEFAULT_TIMEOUT;
+    config->default_probe_type = PROBE_ICMP;
+    config->default_port = 0;
+    config->default_publish_mode = PUBLISH_ALL;
+    config->default_rtt_threshold_ms = 0;
+    config->default_keepalive_ms = DEFAULT_KEEPALIVE_MS;
+    config->default_status_policy.rise = DEFAULT_RISE;
+    config->default_status_policy.fall = DEFAULT_FALL;
+    config->default_status_policy.flap_penalty = DEFAULT_FLAP_PENALTY;
+    config->default_status_policy.flap_suppress = DEFAULT_FLAP_SUPPRESS;
+    config->default_status_policy.flap_reuse = DEFAULT_FLAP_REUSE;
+    config->default_status_policy.flap_half_life_ms = DEFAULT_FLAP_HALF_LIFE_MS;
+    config->publish_batch = DEFAULT_PUBLISH_BATCH;
+    config->publish_interval_ms = DEFAULT_PUBLISH_INTERVAL_MS;
+    config->publish_encoding = PUBLISH_ENCODING_JSON;
+    config->rate_limits.subnet_prefix_v4 = DEFAULT_SUBNET_PREFIX_V4;
+    config->rate_limits.subnet_prefix_v6 = DEFAULT_SUBNET_PREFIX_V6;
     config->ips = NULL;
     config->ip_count = 0;
-    config->filename = strdup(filename);
+    config->filename = NULL;
+    arena_init(&config->strings, string_hint);
+
+    return config;
+}
+
+void config_apply_settings(Config *config, const ConfigField *fields, int count) {
+    FieldIndex index;
+    index_fields(&index, fields, count);
+
+    config->default_interval_ms = parse_interval_ms(&index, KEY_DEFAULT_INTERVAL,
+                                                    KEY_DEFAULT_INTERVAL_MS,
+                                                    config->default_interval_ms);
+    config->default_interval = config->default_interval_ms / 1000;
+    config->default_min_interval_ms = parse_interval_ms(&index, KEY_DEFAULT_MIN_INTERVAL,
+                                                        KEY_DEFAULT_MIN_INTERVAL_MS,
+                                                        config->default_min_interval_ms);
+    config->default_max_interval_ms = parse_interval_ms(&index, KEY_DEFAULT_MAX_INTERVAL,
+                                                        KEY_DEFAULT_MAX_INTERVAL_MS,
+                                                        config->default_max_interval_ms);
     
-    // Get the file's last modification time
-    struct stat file_stat;
-    if (stat(filename, &file_stat) == 0) {
-        config->last_modified = file_stat.st_mtime;
-    } else {
-        log_message(LOG_WARNING, "Could not get file modification time for %s", filename);
-        config->last_modified = time(NULL);
+    config->default_timeout = parse_timeout_ms(&index, KEY_DEFAULT_TIMEOUT, config->default_timeout);
+    
+    parse_probe(&index, &config->default_probe_type, &config->default_port);
+    
+    parse_publish(&index, &config->default_publish_mode, &config->default_rtt_threshold_ms,
+                  &config->default_keepalive_ms);
+    parse_status_policy(&index, &config->default_status_policy);
+    
+    // Result publishing: flush after this many results or this many milliseconds
+    const ConfigField *publish_batch = get_field(&index, KEY_PUBLISH_BATCH, CONFIG_VALUE_NUMBER);
+    if (publish_batch && field_int(publish_batch) > 0) {
+        config->publish_batch = field_int(publish_batch);
+    }
+    
+    const ConfigField *publish_interval = get_field(&index, KEY_PUBLISH_INTERVAL_MS, CONFIG_VALUE_NUMBER);
+    if (publish_interval && field_int(publish_interval) >= 0) {
+        config->publish_interval_ms = field_int(publish_interval);
+    }
+    
+    const ConfigField *publish_encoding = get_field(&index, KEY_PUBLISH_ENCODING, CONFIG_VALUE_STRING);
+    if (publish_encoding) {
+        if (strcmp(publish_encoding->string, "binary") == 0) {
+            config->publish_encoding = PUBLISH_ENCODING_BINARY;
+        } else if (strcmp(publish_encoding->string, "json") == 0) {
+            config->publish_encoding = PUBLISH_ENCODING_JSON;
+        } else {
+            log_message(LOG_WARNING, "Unknown publish encoding '%s', expected 'json' or 'binary'",
+                        publish_encoding->string);
+        }
+    }
+    
+    // Probe pacing: probes per second and back-to-back bursts, overall and into each subnet
+    ProbeRateLimits *limits = &config->rate_limits;
+    parse_bounded(&index, KEY_PROBE_RATE, 0, INT_MAX, &limits->probe_rate);
+    parse_bounded(&index, KEY_PROBE_BURST, 0, INT_MAX, &limits->probe_burst);
+    parse_bounded(&index, KEY_SUBNET_PROBE_RATE, 0, INT_MAX, &limits->subnet_rate);
+    parse_bounded(&index, KEY_SUBNET_PROBE_BURST, 0, INT_MAX, &limits->subnet_burst);
+    parse_bounded(&index, KEY_SUBNET_PREFIX, 0, 32, &limits->subnet_prefix_v4);
+    parse_bounded(&index, KEY_SUBNET_PREFIX_V6, 0, 128, &limits->subnet_prefix_v6);
+}
+
+int config_add_ip(Config *config, const ConfigField *fields, int count) {
+    FieldIndex index;
+    index_fields(&index, fields, count);
+
+    const ConfigField *address = get_field(&index, KEY_IP, CONFIG_VALUE_STRING);
+    if (!address) {
+        log_message(LOG_ERROR, "IP item must contain 'ip' field");
+        return -1;
     }
 
-    // Get global settings if present
-    cJSON *settings = cJSON_GetObjectItem(root, "settings");
-    if (settings) {
-        cJSON *interval = cJSON_GetObjectItem(settings, "default_interval");
-        if (interval && cJSON_IsNumber(interval)) {
-            config->default_interval = interval->valueint;
+    IPConfig *ip = &config->ips[config->ip_count];
+    ip->ip_address = arena_strdup(&config->strings, address->string);
+    if (!ip->ip_address) {
+        return -1;
+    }
+    
+    // Get custom interval if present
+    ip->interval_ms = parse_interval_ms(&index, KEY_INTERVAL, KEY_INTERVAL_MS,
+                                        config->default_interval_ms);
+    ip->interval = ip->interval_ms / 1000;
+    
+    // Adaptive bounds around the interval; without any the interval stays fixed
+    ip->min_interval_ms = parse_interval_ms(&index, KEY_MIN_INTERVAL, KEY_MIN_INTERVAL_MS,
+                                            config->default_min_interval_ms ? config->default_min_interval_ms
+                                                                            : ip->interval_ms);
+    ip->max_interval_ms = parse_interval_ms(&index, KEY_MAX_INTERVAL, KEY_MAX_INTERVAL_MS,
+                                            config->default_max_interval_ms ? config->default_max_interval_ms
+                                                                            : ip->interval_ms);
+    if (ip->min_interval_ms > ip->interval_ms) {
+        ip->min_interval_ms = ip->interval_ms;
+    }
+    if (ip->max_interval_ms < ip->interval_ms) {
+        ip->max_interval_ms = ip->interval_ms;
+    }
+    
+    // Get custom timeout if present
+    ip->timeout = parse_timeout_ms(&index, KEY_TIMEOUT, config->default_timeout);
+    
+    // Get probe type and port if present
+    ip->probe_type = config->default_probe_type;
+    ip->port = config->default_port;
+    parse_probe(&index, &ip->probe_type, &ip->port);
+    
+    // Get active state if present
+    const ConfigField *active = get_field(&index, KEY_ACTIVE, CONFIG_VALUE_BOOL);
+    ip->is_active = active ? active->boolean : true;
+    
+    // Get publication settings if present
+    ip->publish_mode = config->default_publish_mode;
+    ip->rtt_threshold_ms = config->default_rtt_threshold_ms;
+    ip->keepalive_ms = config->default_keepalive_ms;
+    parse_publish(&index, &ip->publish_mode, &ip->rtt_threshold_ms, &ip->keepalive_ms);
+    
+    // Get status thresholds and flap damping if present
+    ip->status_policy = config->default_status_policy;
+    parse_status_policy(&index, &ip->status_policy);
+
+    config->ip_count++;
+    return 0;
+}
+
+// Flattens the scalar members of a cJSON object into fields, nested values are kept as markers
+static int collect_fields(const cJSON *object, ConfigField *fields) {
+    int count = 0;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, object) {
+        if (count == CONFIG_MAX_FIELDS) {
+            log_message(LOG_WARNING, "Ignoring fields of a config object beyond the first %d", CONFIG_MAX_FIELDS);
+            break;
         }
-        
-        cJSON *timeout = cJSON_GetObjectItem(settings, "default_timeout");
-        if (timeout && cJSON_IsNumber(timeout)) {
-            config->default_timeout = timeout->valueint;
+        ConfigField *field = &fields[count++];
+        field->key = item->string ? item->string : "";
+        if (cJSON_IsString(item)) {
+            field->type = CONFIG_VALUE_STRING;
+            field->string = item->valuestring;
+        } else if (cJSON_IsNumber(item)) {
+            field->type = CONFIG_VALUE_NUMBER;
+            field->number = item->valuedouble;
+        } else if (cJSON_IsBool(item)) {
+            field->type = CONFIG_VALUE_BOOL;
+            field->boolean = cJSON_IsTrue(item);
+        } else {
+            field->type = CONFIG_VALUE_OTHER;
         }
     }
+    return count;
+}
+
+// Builds the configuration from a parsed document, the document is left to the caller
+static Config* config_from_json(const cJSON *root, size_t length) {
+    // All address strings share the config's arena, they never outgrow the document
+    Config *config = config_create(length + 64);
+    if (!config) {
+        return NULL;
+    }
+
+    ConfigField fields[CONFIG_MAX_FIELDS];
+
+    // Get global settings if present
+    cJSON *settings = cJSON_GetObjectItem(root, "settings");
+    if (settings && cJSON_IsObject(settings)) {
+        config_apply_settings(config, fields, collect_fields(settings, fields));
+    }
 
     // Get IP addresses
     cJSON *ips_array = cJSON_GetObjectItem(root, "ip_addresses");
     if (!ips_array || !cJSON_IsArray(ips_array)) {
         log_message(LOG_ERROR, "Configuration must contain 'ip_addresses' array");
-        free(config->filename);
-        free(config);
-        cJSON_Delete(root);
+        free_config(config);
         return NULL;
     }
 
-    config->ip_count = cJSON_GetArraySize(ips_array);
-    if (config->ip_count == 0) {
+    int ip_count = cJSON_GetArraySize(ips_array);
+    if (ip_count == 0) {
         log_message(LOG_WARNING, "No IP addresses found in configuration");
-        config->ips = NULL;
     } else {
-        config->ips = (IPConfig*)malloc(config->ip_count * sizeof(IPConfig));
+        config->ips = (IPConfig*)malloc(ip_count * sizeof(IPConfig));
         if (!config->ips) {
             log_message(LOG_ERROR, "Memory allocation failed for IP configurations");
-            free(config->filename);
-            free(config);
-            cJSON_Delete(root);
+            free_config(config);
+            return NULL;
+        }
+    }
+
+    const cJSON *ip_item;
+    cJSON_ArrayForEach(ip_item, ips_array) {
+        int field_count;
+        if (cJSON_IsString(ip_item)) {
+            // Simple format: just the IP address string
+            fields[0] = (ConfigField){ .key = "ip", .type = CONFIG_VALUE_STRING, .string = ip_item->valuestring };
+            field_count = 1;
+        } else if (cJSON_IsObject(ip_item)) {
+            // Complex format: object with IP and settings
+            field_count = collect_fields(ip_item, fields);
+        } else {
+            log_message(LOG_ERROR, "Invalid IP item format at index %d", config->ip_count);
+            free_config(config);
             return NULL;
         }
 
-        for (int i = 0; i < config->ip_count; i++) {
-            cJSON *ip_item = cJSON_GetArrayItem(ips_array, i);
-            
-            if (cJSON_IsString(ip_item)) {
-                // Simple format: just the IP address string
-                config->ips[i].ip_address = strdup(ip_item->valuestring);
-                config->ips[i].interval = config->default_interval;
-                config->ips[i].timeout = config->default_timeout;
-                config->ips[i].is_active = true;
-            } else if (cJSON_IsObject(ip_item)) {
-                // Complex format: object with IP and settings
-                cJSON *ip = cJSON_GetObjectItem(ip_item, "ip");
-                if (!ip || !cJSON_IsString(ip)) {
-                    log_message(LOG_ERROR, "IP item must contain 'ip' field");
-                    // Clean up previously allocated items
-                    for (int j = 0; j < i; j++) {
-                        free(config->ips[j].ip_address);
-                    }
-                    free(config->ips);
-                    free(config->filename);
-                    free(config);
-                    cJSON_Delete(root);
-                    return NULL;
-                }
-                
-                config->ips[i].ip_address = strdup(ip->valuestring);
-                
-                // Get custom interval if present
-                cJSON *interval = cJSON_GetObjectItem(ip_item, "interval");
-                if (interval && cJSON_IsNumber(interval)) {
-                    config->ips[i].interval = interval->valueint;
-                } else {
-                    config->ips[i].interval = config->default_interval;
-                }
-                
-                // Get custom timeout if present
-                cJSON *timeout = cJSON_GetObjectItem(ip_item, "timeout");
-                if (timeout && cJSON_IsNumber(timeout)) {
-                    config->ips[i].timeout = timeout->valueint;
-                } else {
-                    config->ips[i].timeout = config->default_timeout;
-                }
-                
-                // Get active state if present
-                cJSON *active = cJSON_GetObjectItem(ip_item, "active");
-                if (active && cJSON_IsBool(active)) {
-                    config->ips[i].is_active = cJSON_IsTrue(active);
-                } else {
-                    config->ips[i].is_active = true;
-                }
-            } else {
-                log_message(LOG_ERROR, "Invalid IP item format at index %d", i);
-                // Clean up previously allocated items
-                for (int j = 0; j < i; j++) {
-                    free(config->ips[j].ip_address);
-                }
-                free(config->ips);
-                free(config->filename);
-                free(config);
-                cJSON_Delete(root);
-                return NULL;
-            }
+        if (config_add_ip(config, fields, field_count) != 0) {
+            free_config(config);
+            return NULL;
         }
     }
 
-    cJSON_Delete(root);
     log_message(LOG_INFO, "Configuration loaded successfully with %d IP addresses", config->ip_count);
     return config;
 }
 
+Config* load_config(const char *filename) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_message(LOG_ERROR, "Failed to open configuration file: %s", filename);
+        return NULL;
+    }
+
+    // Stat the file we actually read, the path may already name a newer one
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        log_message(LOG_ERROR, "Failed to stat configuration file %s: %s", filename, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if (file_stat.st_size == 0) {
+        log_message(LOG_ERROR, "Configuration file %s is empty", filename);
+        close(fd);
+        return NULL;
+    }
+
+    // Parse the page cache in place instead of copying the file to the heap
+    size_t file_size = (size_t)file_stat.st_size;
+    void *json_data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (json_data == MAP_FAILED) {
+        log_message(LOG_ERROR, "Failed to map configuration file %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+    madvise(json_data, file_size, MADV_SEQUENTIAL);
+
+    // A snapshot built from identical JSON saves parsing it again
+    uint64_t json_hash = config_snapshot_hash(json_data, file_size);
+    size_t snapshot_path_size = strlen(filename) + sizeof(CONFIG_SNAPSHOT_SUFFIX);
+    char *snapshot_path = (char *)malloc(snapshot_path_size);
+    if (snapshot_path) {
+        snprintf(snapshot_path, snapshot_path_size, "%s%s", filename, CONFIG_SNAPSHOT_SUFFIX);
+    }
+
+    Config *config = snapshot_path ? config_snapshot_load(snapshot_path, json_hash, file_size) : NULL;
+    if (!config) {
+        config = load_config_stream((const char *)json_data, file_size);
+        if (config && snapshot_path) {
+            config_snapshot_write(config, snapshot_path, json_hash, file_size);
+        }
+    }
+    munmap(json_data, file_size);
+    free(snapshot_path);
+    if (!config) {
+        return NULL;
+    }
+
+    config->filename = strdup(filename);
+    
+    // Remember which file was loaded so replacements can be detected
+    config->last_modified = file_stat.st_mtime;
+    config->last_modified_nsec = file_stat.st_mtim.tv_nsec;
+    config->inode = (unsigned long)file_stat.st_ino;
+
+    return config;
+}
+
+Config* load_config_from_buffer(const char *data, size_t length) {
+    if (!data) {
+        log_message(LOG_ERROR, "No configuration data");
+        return NULL;
+    }
+
+    // The parse tree lives only until its values are copied out, so it is
+    // built in a scratch arena and released in one go instead of node by node
+    Arena scratch;
+    arena_init(&scratch, length * CONFIG_TREE_FACTOR + 4096);
+    Arena *previous = arena_json_begin(&scratch);
+
+    // Parse JSON straight from the caller's buffer, it need not be NUL-terminated
+    Config *config = NULL;
+    const char *parse_end = NULL;
+    cJSON *root = cJSON_ParseWithLengthOpts(data, length, &parse_end, false);
+    if (root) {
+        // cJSON stops after the first value, only whitespace may follow as with load_config_stream()
+        while (parse_end < data + length && (unsigned char)*parse_end <= ' ') {
+            parse_end++;
+        }
+        if (parse_end < data + length) {
+            log_message(LOG_ERROR, "JSON parsing error: unexpected data after the configuration object");
+        } else {
+            config = config_from_json(root, length);
+        }
+    } else {
+        const char *error_ptr = cJSON_GetErrorPtr();
+        if (error_ptr) {
+            log_message(LOG_ERROR, "JSON parsing error near: %.32s", error_ptr);
+        } else {
+            log_message(LOG_ERROR, "JSON parsing error");
+        }
+    }
+
+    arena_json_end(previous);
+    arena_free(&scratch);
+    return config;
+}
+
 void free_config(Config *config) {
     if (!config) {
         return;
     }
     
-    if (config->ips) {
-        for (int i = 0; i < config->ip_count; i++) {
-            free(config->ips[i].ip_address);
-        }
-        free(config->ips);
+    free(config->ips);
+    arena_free(&config->strings);
+    if (config->snapshot) {
+        munmap(config->snapshot, config->snapshot_size);
     }
     
     if (config->filename) {
@@ -222,8 +665,10 @@ bool config_has_changed(Config *config) {
         return false;
     }
     
-    // Check if the file has been modified since we last loaded it
-    if (file_stat.st_mtime > config->last_modified) {
+    // A rename replaces the inode and may carry an older timestamp, so any difference counts
+    if (file_stat.st_mtime != config->last_modified ||
+        file_stat.st_mtim.tv_nsec != config->last_modified_nsec ||
+        (unsigned long)file_stat.st_ino != config->inode) {
         log_message(LOG_INFO, "Configuration file has been modified");
         return true;
     }
@@ -231,15 +676,11 @@ bool config_has_changed(Config *config) {
     return false;
 }
 
-bool reload_config_if_changed(Config **config) {
+bool reload_config(Config **config) {
     if (!config || !*config || !(*config)->filename) {
         return false;
     }
     
-    if (!config_has_changed(*config)) {
-        return false;
-    }
-    
     // Load the new configuration
     Config *new_config = load_config((*config)->filename);
     if (!new_config) {
@@ -254,3 +695,135 @@ bool reload_config_if_changed(Config **config) {
     log_message(LOG_INFO, "Configuration reloaded successfully with %d IP addresses", (*config)->ip_count);
     return true;
 }
+
+bool reload_config_if_changed(Config **config) {
+    if (!config || !*config || !config_has_changed(*config)) {
+        return false;
+    }
+    
+    return reload_config(config);
+}
+
+int config_watch_init(ConfigWatcher *watcher, const char *filename) {
+    if (!watcher || !filename) {
+        return -1;
+    }
+    
+    memset(watcher, 0, sizeof(*watcher));
+    watcher->fd = -1;
+    
+    // Watch the directory: an atomic rename replaces the inode a file watch would follow
+    const char *slash = strrchr(filename, '/');
+    if (slash) {
+        watcher->directory = slash == filename ? strdup("/") : strndup(filename, slash - filename);
+        watcher->basename = strdup(slash + 1);
+    } else {
+        watcher->directory = strdup(".");
+        watcher->basename = strdup(filename);
+    }
+    if (!watcher->directory || !watcher->basename) {
+        log_message(LOG_ERROR, "Memory allocation failed for config watcher");
+        config_watch_free(watcher);
+        return -1;
+    }
+    
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->fd < 0) {
+        log_message(LOG_ERROR, "Failed to create inotify instance: %s", strerror(errno));
+        config_watch_free(watcher);
+        return -1;
+    }
+    
+    if (inotify_add_watch(watcher->fd, watcher->directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_message(LOG_ERROR, "Failed to watch %s: %s", watcher->directory, strerror(errno));
+        config_watch_free(watcher);
+        return -1;
+    }
+    
+    return 0;
+}
+
+static int config_watch_drain(ConfigWatcher *watcher) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    
+    for (;;) {
+        ssize_t len = read(watcher->fd, buffer, sizeof(buffer));
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return changed;
+            }
+            log_message(LOG_ERROR, "Failed to read inotify events: %s", strerror(errno));
+            return -1;
+        }
+        
+        for (char *ptr = buffer; ptr < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            if (event->mask & IN_IGNORED) {
+                // The directory itself went away
+                log_message(LOG_WARNING, "Config directory %s is no longer watched", watcher->directory);
+                return -1;
+            }
+            if (event->mask & IN_Q_OVERFLOW) {
+                changed = 1;
+            } else if (event->len && strcmp(event->name, watcher->basename) == 0) {
+                changed = 1;
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int config_watch_wait(ConfigWatcher *watcher, int timeout_ms) {
+    if (!watcher || watcher->fd < 0) {
+        return -1;
+    }
+    
+    long long deadline = monotonic_ms() + timeout_ms;
+    struct pollfd pfd = { .fd = watcher->fd, .events = POLLIN };
+    for (;;) {
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ready > 0) {
+            // One save usually raises several events, report them as a single change
+            int changed = config_watch_drain(watcher);
+            if (changed != 0) {
+                return changed;
+            }
+        }
+        
+        // Keep waiting out the timeout after events for other files in the directory
+        if (timeout_ms >= 0) {
+            long long remaining = deadline - monotonic_ms();
+            if (remaining <= 0) {
+                return 0;
+            }
+            timeout_ms = (int)remaining;
+        }
+    }
+}
+
+void config_watch_free(ConfigWatcher *watcher) {
+    if (!watcher) {
+        return;
+    }
+    
+    if (watcher->fd >= 0) {
+        close(watcher->fd);
+    }
+    free(watcher->directory);
+    free(watcher->basename);
+    memset(watcher, 0, sizeof(*watcher));
+    watcher->fd = -1;
+}
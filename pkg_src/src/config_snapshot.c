@@ -0,0 +1,427 @@
+/**
+ * @file config_snapshot.c
+ * @brief Implementation of binary configuration snapshots
+ */
+
+#include "../include/config_snapshot.h"
+#include "../include/logger.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "IPMS"
+#define SNAPSHOT_VERSION 6
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+    char magic[4];              // SNAPSHOT_MAGIC
+    uint32_t version;           // SNAPSHOT_VERSION, also rejects foreign byte order
+    uint64_t file_hash;         // Hash of everything after this field, catches damaged files
+    uint64_t json_hash;         // Hash of the JSON the snapshot was built from
+    uint64_t json_size;         // Size of that JSON
+    int32_t default_interval_ms;
+    int32_t default_min_interval_ms;
+    int32_t default_max_interval_ms;
+    int32_t default_timeout;
+    int32_t default_probe_type;
+    int32_t default_port;
+    int32_t default_publish_mode;
+    int32_t default_rtt_threshold_ms;
+    int32_t default_keepalive_ms;
+    int32_t default_rise;
+    int32_t default_fall;
+    int32_t default_flap_penalty;
+    int32_t default_flap_suppress;
+    int32_t default_flap_reuse;
+    int32_t default_flap_half_life_ms;
+    int32_t publish_batch;
+    int32_t publish_interval_ms;
+    int32_t publish_encoding;
+    int32_t probe_rate;
+    int32_t probe_burst;
+    int32_t subnet_rate;
+    int32_t subnet_burst;
+    int32_t subnet_prefix_v4;
+    int32_t subnet_prefix_v6;
+    uint32_t ip_count;          // Records following the header
+    uint32_t strings_size;      // Bytes of address strings following the records
+} SnapshotHeader;
+
+// file_hash covers the settings in the header as well as the records and strings
+#define SNAPSHOT_HASHED_FROM offsetof(SnapshotHeader, json_hash)
+
+typedef struct {
+    uint32_t name;              // Offset of the address string in the string blob
+    int32_t interval_ms;
+    int32_t min_interval_ms;
+    int32_t max_interval_ms;
+    int32_t timeout;
+    int32_t rtt_threshold_ms;
+    int32_t keepalive_ms;
+    int32_t flap_penalty;
+    int32_t flap_suppress;
+    int32_t flap_reuse;
+    int32_t flap_half_life_ms;
+    uint8_t active;
+    uint8_t publish_mode;
+    uint8_t rise;
+    uint8_t fall;
+    uint16_t port;
+    uint8_t probe_type;
+    uint8_t reserved;
+} SnapshotEntry;
+
+static inline uint64_t rotl64(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t value) {
+    acc ^= hash_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t config_snapshot_hash(const void *data, size_t length) {
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + length;
+    uint64_t hash;
+
+    // Four independent lanes keep the multiplier busy, several GB/s on one core
+    if (length >= 32) {
+        uint64_t v1 = PRIME64_1 + PRIME64_2;
+        uint64_t v2 = PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - PRIME64_1;
+        do {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = hash_merge(hash, v1);
+        hash = hash_merge(hash, v2);
+        hash = hash_merge(hash, v3);
+        hash = hash_merge(hash, v4);
+    } else {
+        hash = PRIME64_5;
+    }
+    hash += (uint64_t)length;
+
+    while (end - p >= 8) {
+        hash ^= hash_round(0, read64(p));
+        hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        hash ^= (uint64_t)read32(p) * PRIME64_1;
+        hash = rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= (*p++) * PRIME64_5;
+        hash = rotl64(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Checks everything that could make reading the mapped snapshot go out of bounds
+static bool snapshot_valid(const unsigned char *data, size_t size, uint64_t json_hash, size_t json_size) {
+    if (size < sizeof(SnapshotHeader)) {
+        return false;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *)data;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0 || header->version != SNAPSHOT_VERSION ||
+        header->json_hash != json_hash || header->json_size != json_size) {
+        return false;
+    }
+
+    uint64_t expected = sizeof(SnapshotHeader) + (uint64_t)header->ip_count * sizeof(SnapshotEntry) +
+                        header->strings_size;
+    if (expected != size || header->strings_size == 0 ||
+        config_snapshot_hash(data + SNAPSHOT_HASHED_FROM, size - SNAPSHOT_HASHED_FROM) != header->file_hash) {
+        return false;
+    }
+
+    // Every string ends before the blob does if the blob ends with a NUL
+    const char *strings = (const char *)data + size - header->strings_size;
+    if (strings[header->strings_size - 1] != '\0') {
+        return false;
+    }
+
+    // Enums are cast straight from the file, so an unknown value means the file is damaged
+    if ((uint32_t)header->default_probe_type > PROBE_HTTP ||
+        (uint32_t)header->default_publish_mode > PUBLISH_CHANGE ||
+        (uint32_t)header->publish_encoding > PUBLISH_ENCODING_BINARY) {
+        return false;
+    }
+
+    const SnapshotEntry *entries = (const SnapshotEntry *)(header + 1);
+    for (uint32_t i = 0; i < header->ip_count; i++) {
+        if (entries[i].name >= header->strings_size || entries[i].probe_type > PROBE_HTTP ||
+            entries[i].publish_mode > PUBLISH_CHANGE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Config* config_snapshot_load(const char *path, uint64_t json_hash, size_t json_size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat snapshot_stat;
+    if (fstat(fd, &snapshot_stat) != 0 || (size_t)snapshot_stat.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)snapshot_stat.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (!snapshot_valid((const unsigned char *)data, size, json_hash, json_size)) {
+        log_message(LOG_INFO, "Configuration snapshot %s is stale or invalid, parsing the JSON", path);
+        munmap(data, size);
+        return NULL;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *)data;
+    const SnapshotEntry *entries = (const SnapshotEntry *)(header + 1);
+    const char *strings = (const char *)data + size - header->strings_size;
+
+    Config *config = config_create(0);
+    if (!config) {
+        munmap(data, size);
+        return NULL;
+    }
+    // The address strings are used in place, the mapping lives as long as the config
+    config->snapshot = data;
+    config->snapshot_size = size;
+
+    config->default_interval_ms = header->default_interval_ms;
+    config->default_interval = header->default_interval_ms / 1000;
+    config->default_min_interval_ms = header->default_min_interval_ms;
+    config->default_max_interval_ms = header->default_max_interval_ms;
+    config->default_timeout = header->default_timeout;
+    config->default_probe_type = (ProbeType)header->default_probe_type;
+    config->default_port = header->default_port;
+    config->default_publish_mode = (PublishMode)header->default_publish_mode;
+    config->default_rtt_threshold_ms = header->default_rtt_threshold_ms;
+    config->default_keepalive_ms = header->default_keepalive_ms;
+    config->default_status_policy.rise = header->default_rise;
+    config->default_status_policy.fall = header->default_fall;
+    config->default_status_policy.flap_penalty = header->default_flap_penalty;
+    config->default_status_policy.flap_suppress = header->default_flap_suppress;
+    config->default_status_policy.flap_reuse = header->default_flap_reuse;
+    config->default_status_policy.flap_half_life_ms = header->default_flap_half_life_ms;
+    config->publish_batch = header->publish_batch;
+    config->publish_interval_ms = header->publish_interval_ms;
+    config->publish_encoding = (PublishEncoding)header->publish_encoding;
+    config->rate_limits.probe_rate = header->probe_rate;
+    config->rate_limits.probe_burst = header->probe_burst;
+    config->rate_limits.subnet_rate = header->subnet_rate;
+    config->rate_limits.subnet_burst = header->subnet_burst;
+    config->rate_limits.subnet_prefix_v4 = header->subnet_prefix_v4;
+    config->rate_limits.subnet_prefix_v6 = header->subnet_prefix_v6;
+
+    if (header->ip_count > 0) {
+        config->ips = (IPConfig*)malloc(header->ip_count * sizeof(IPConfig));
+        if (!config->ips) {
+            log_message(LOG_ERROR, "Memory allocation failed for IP configurations");
+            free_config(config);
+            return NULL;
+        }
+    }
+
+    for (uint32_t i = 0; i < header->ip_count; i++) {
+        const SnapshotEntry *entry = &entries[i];
+        IPConfig *ip = &config->ips[i];
+        ip->ip_address = (char *)strings + entry->name;
+        ip->interval_ms = entry->interval_ms;
+        ip->interval = entry->interval_ms / 1000;
+        ip->min_interval_ms = entry->min_interval_ms;
+        ip->max_interval_ms = entry->max_interval_ms;
+        ip->timeout = entry->timeout;
+        ip->probe_type = (ProbeType)entry->probe_type;
+        ip->port = entry->port;
+        ip->is_active = entry->active != 0;
+        ip->publish_mode = (PublishMode)entry->publish_mode;
+        ip->rtt_threshold_ms = entry->rtt_threshold_ms;
+        ip->keepalive_ms = entry->keepalive_ms;
+        ip->status_policy.rise = entry->rise;
+        ip->status_policy.fall = entry->fall;
+        ip->status_policy.flap_penalty = entry->flap_penalty;
+        ip->status_policy.flap_suppress = entry->flap_suppress;
+        ip->status_policy.flap_reuse = entry->flap_reuse;
+        ip->status_policy.flap_half_life_ms = entry->flap_half_life_ms;
+    }
+    config->ip_count = (int)header->ip_count;
+
+    log_message(LOG_INFO, "Configuration loaded from snapshot %s with %d IP addresses", path, config->ip_count);
+    return config;
+}
+
+int config_snapshot_write(const Config *config, const char *path, uint64_t json_hash, size_t json_size) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.json_hash = json_hash;
+    header.json_size = json_size;
+    header.default_interval_ms = config->default_interval_ms;
+    header.default_min_interval_ms = config->default_min_interval_ms;
+    header.default_max_interval_ms = config->default_max_interval_ms;
+    header.default_timeout = config->default_timeout;
+    header.default_probe_type = config->default_probe_type;
+    header.default_port = config->default_port;
+    header.default_publish_mode = config->default_publish_mode;
+    header.default_rtt_threshold_ms = config->default_rtt_threshold_ms;
+    header.default_keepalive_ms = config->default_keepalive_ms;
+    header.default_rise = config->default_status_policy.rise;
+    header.default_fall = config->default_status_policy.fall;
+    header.default_flap_penalty = config->default_status_policy.flap_penalty;
+    header.default_flap_suppress = config->default_status_policy.flap_suppress;
+    header.default_flap_reuse = config->default_status_policy.flap_reuse;
+    header.default_flap_half_life_ms = config->default_status_policy.flap_half_life_ms;
+    header.publish_batch = config->publish_batch;
+    header.publish_interval_ms = config->publish_interval_ms;
+    header.publish_encoding = config->publish_encoding;
+    header.probe_rate = config->rate_limits.probe_rate;
+    header.probe_burst = config->rate_limits.probe_burst;
+    header.subnet_rate = config->rate_limits.subnet_rate;
+    header.subnet_burst = config->rate_limits.subnet_burst;
+    header.subnet_prefix_v4 = config->rate_limits.subnet_prefix_v4;
+    header.subnet_prefix_v6 = config->rate_limits.subnet_prefix_v6;
+    header.ip_count = (uint32_t)config->ip_count;
+
+    // Lay out the strings first so the records can point into them
+    uint64_t strings_size = 1;
+    for (int i = 0; i < config->ip_count; i++) {
+        strings_size += strlen(config->ips[i].ip_address) + 1;
+    }
+    if (strings_size > UINT32_MAX) {
+        log_message(LOG_WARNING, "Configuration too large for a snapshot");
+        return -1;
+    }
+    header.strings_size = (uint32_t)strings_size;
+
+    // Build the whole file in memory, its hash goes into the header
+    size_t entries_size = (size_t)config->ip_count * sizeof(SnapshotEntry);
+    size_t file_size = sizeof(SnapshotHeader) + entries_size + strings_size;
+    unsigned char *file_data = (unsigned char *)malloc(file_size);
+    if (!file_data) {
+        log_message(LOG_ERROR, "Memory allocation failed for configuration snapshot");
+        return -1;
+    }
+
+    SnapshotEntry *entries = (SnapshotEntry *)(file_data + sizeof(SnapshotHeader));
+    char *strings = (char *)entries + entries_size;
+    uint32_t name = 1;
+    strings[0] = '\0';     // Offset 0 holds an empty string so the blob is never empty
+    for (int i = 0; i < config->ip_count; i++) {
+        const IPConfig *ip = &config->ips[i];
+        size_t length = strlen(ip->ip_address) + 1;
+        entries[i] = (SnapshotEntry){
+            .name = name,
+            .interval_ms = ip->interval_ms,
+            .min_interval_ms = ip->min_interval_ms,
+            .max_interval_ms = ip->max_interval_ms,
+            .timeout = ip->timeout,
+            .rtt_threshold_ms = ip->rtt_threshold_ms,
+            .keepalive_ms = ip->keepalive_ms,
+            .flap_penalty = ip->status_policy.flap_penalty,
+            .flap_suppress = ip->status_policy.flap_suppress,
+            .flap_reuse = ip->status_policy.flap_reuse,
+            .flap_half_life_ms = ip->status_policy.flap_half_life_ms,
+            .active = ip->is_active ? 1 : 0,
+            .publish_mode = (uint8_t)ip->publish_mode,
+            .rise = (uint8_t)ip->status_policy.rise,
+            .fall = (uint8_t)ip->status_policy.fall,
+            .port = (uint16_t)ip->port,
+            .probe_type = (uint8_t)ip->probe_type,
+            .reserved = 0
+        };
+        memcpy(strings + name, ip->ip_address, length);
+        name += (uint32_t)length;
+    }
+    memcpy(file_data, &header, sizeof(header));
+    ((SnapshotHeader *)file_data)->file_hash = config_snapshot_hash(file_data + SNAPSHOT_HASHED_FROM,
+                                                                    file_size - SNAPSHOT_HASHED_FROM);
+
+    // Write a temporary file and rename it, readers never see a partial snapshot
+    size_t path_length = strlen(path);
+    char *temp_path = (char *)malloc(path_length + 32);
+    if (!temp_path) {
+        log_message(LOG_ERROR, "Memory allocation failed for snapshot path");
+        free(file_data);
+        return -1;
+    }
+    snprintf(temp_path, path_length + 32, "%s.%ld.tmp", path, (long)getpid());
+
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) {
+        log_message(LOG_WARNING, "Cannot write configuration snapshot %s: %s", temp_path, strerror(errno));
+        free(temp_path);
+        free(file_data);
+        return -1;
+    }
+
+    bool ok = fwrite(file_data, file_size, 1, file) == 1;
+    free(file_data);
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(temp_path, path) != 0) {
+        log_message(LOG_WARNING, "Failed to write configuration snapshot %s: %s", path, strerror(errno));
+        unlink(temp_path);
+        free(temp_path);
+        return -1;
+    }
+
+    free(temp_path);
+    log_message(LOG_DEBUG, "Wrote configuration snapshot %s", path);
+    return 0;
+}
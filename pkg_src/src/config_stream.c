@@ -0,0 +1,509 @@
+/**
+ * @file config_stream.c
+ * @brief Streaming parser for configuration files with many IPs
+ *
+ * No document tree is built. A first pass over the text only locates the
+ * "settings" object and the "ip_addresses" array, counting the entries on
+ * the way, so the IPConfig array is allocated once at its final size. The
+ * second pass reads the settings and then one entry at a time, handing its
+ * fields to the same readers the cJSON path uses and writing the result
+ * straight into the array. Decoded keys and strings live in a scratch
+ * arena that is rewound after every entry, so memory use beyond the
+ * configuration itself does not grow with the number of IPs.
+ */
+
+#include "../include/config.h"
+#include "../include/logger.h"
+#include "../include/arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define STREAM_NESTING_LIMIT 1000   // Deepest nesting accepted, as in cJSON
+#define STREAM_NUMBER_SIZE 64       // Longest number literal accepted
+
+typedef struct {
+    const char *start;      // Beginning of the document
+    const char *pos;        // Next byte to read
+    const char *end;        // End of the document
+    Arena scratch;          // Decoded strings of the entry being read
+} Scanner;
+
+static int fail(const Scanner *scanner, const char *what) {
+    log_message(LOG_ERROR, "JSON parsing error at byte %zu: %s",
+                (size_t)(scanner->pos - scanner->start), what);
+    return -1;
+}
+
+static void skip_space(Scanner *scanner) {
+    while (scanner->pos < scanner->end && (unsigned char)*scanner->pos <= ' ') {
+        scanner->pos++;
+    }
+}
+
+// Consumes the given character after optional whitespace
+static bool expect(Scanner *scanner, char c) {
+    skip_space(scanner);
+    if (scanner->pos < scanner->end && *scanner->pos == c) {
+        scanner->pos++;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_hex4(const char *in, const char *end, unsigned *value) {
+    if (end - in < 4) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = in[i];
+        unsigned digit;
+        if (c >= '0' && c <= '9') {
+            digit = (unsigned)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (unsigned)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (unsigned)(c - 'A' + 10);
+        } else {
+            return false;
+        }
+        *value = (*value << 4) | digit;
+    }
+    return true;
+}
+
+static char *put_utf8(char *out, unsigned code) {
+    if (code < 0x80) {
+        *out++ = (char)code;
+    } else if (code < 0x800) {
+        *out++ = (char)(0xC0 | (code >> 6));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        *out++ = (char)(0xE0 | (code >> 12));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (code >> 18));
+        *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    }
+    return out;
+}
+
+// Reads the escape after a backslash at *in into the code point it stands for
+static int read_escape(Scanner *scanner, const char **in, const char *end, unsigned *code) {
+    const char *p = *in;
+    switch (*p++) {
+        case '"': *code = '"'; break;
+        case '\\': *code = '\\'; break;
+        case '/': *code = '/'; break;
+        case 'b': *code = '\b'; break;
+        case 'f': *code = '\f'; break;
+        case 'n': *code = '\n'; break;
+        case 'r': *code = '\r'; break;
+        case 't': *code = '\t'; break;
+        case 'u':
+            if (!parse_hex4(p, end, code)) {
+                return fail(scanner, "invalid \\u escape");
+            }
+            p += 4;
+            // Characters outside the BMP come as a surrogate pair
+            if (*code >= 0xD800 && *code <= 0xDBFF) {
+                unsigned low;
+                if (end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+                    !parse_hex4(p + 2, end, &low) || low < 0xDC00 || low > 0xDFFF) {
+                    return fail(scanner, "invalid surrogate pair");
+                }
+                p += 6;
+                *code = 0x10000 + ((*code - 0xD800) << 10) + (low - 0xDC00);
+            } else if (*code >= 0xDC00 && *code <= 0xDFFF) {
+                return fail(scanner, "invalid surrogate pair");
+            }
+            break;
+        default:
+            return fail(scanner, "invalid escape");
+    }
+    *in = p;
+    return 0;
+}
+
+// Decodes the escapes of a string body into out, which has room for the raw text
+static int decode_string(Scanner *scanner, const char *in, const char *end, char *out) {
+    while (in < end) {
+        if (*in != '\\') {
+            *out++ = *in++;
+            continue;
+        }
+
+        unsigned code;
+        in++;
+        if (read_escape(scanner, &in, end, &code) != 0) {
+            return -1;
+        }
+        out = put_utf8(out, code);
+    }
+    *out = '\0';
+    return 0;
+}
+
+// Checks the escapes of a string body that is skipped rather than decoded
+static int check_escapes(Scanner *scanner, const char *in, const char *end) {
+    while (in < end) {
+        if (*in++ != '\\') {
+            continue;
+        }
+        unsigned code;
+        if (read_escape(scanner, &in, end, &code) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Reads the string at the current position, its decoded copy goes to scratch unless out is NULL
+static int scan_string(Scanner *scanner, const char **out) {
+    if (scanner->pos >= scanner->end || *scanner->pos != '"') {
+        return fail(scanner, "expected a string");
+    }
+
+    // Find the closing quote first, the decoded text is never longer than the raw one
+    const char *begin = scanner->pos + 1;
+    const char *p = begin;
+    bool escaped = false;
+    while (p < scanner->end && *p != '"') {
+        if (*p == '\\') {
+            escaped = true;
+            p++;
+        }
+        p++;
+    }
+    if (p >= scanner->end) {
+        return fail(scanner, "unterminated string");
+    }
+
+    if (out) {
+        size_t length = (size_t)(p - begin);
+        char *copy = (char *)arena_alloc(&scanner->scratch, length + 1);
+        if (!copy) {
+            return -1;
+        }
+        if (!escaped) {
+            memcpy(copy, begin, length);
+            copy[length] = '\0';
+        } else if (decode_string(scanner, begin, p, copy) != 0) {
+            return -1;
+        }
+        *out = copy;
+    } else if (escaped && check_escapes(scanner, begin, p) != 0) {
+        return -1;
+    }
+
+    scanner->pos = p + 1;
+    return 0;
+}
+
+static bool is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.' || c == 'e' || c == 'E';
+}
+
+static int scan_number(Scanner *scanner, double *number) {
+    // The text is not NUL-terminated, copy the literal for strtod()
+    char buffer[STREAM_NUMBER_SIZE];
+    size_t length = 0;
+    while (scanner->pos + length < scanner->end && length < sizeof(buffer) - 1 &&
+           is_number_char(scanner->pos[length])) {
+        buffer[length] = scanner->pos[length];
+        length++;
+    }
+    buffer[length] = '\0';
+
+    char *parsed_end;
+    *number = strtod(buffer, &parsed_end);
+    if (parsed_end == buffer) {
+        return fail(scanner, "invalid value");
+    }
+    scanner->pos += parsed_end - buffer;
+    return 0;
+}
+
+static bool scan_literal(Scanner *scanner, const char *literal) {
+    size_t length = strlen(literal);
+    if ((size_t)(scanner->end - scanner->pos) >= length && memcmp(scanner->pos, literal, length) == 0) {
+        scanner->pos += length;
+        return true;
+    }
+    return false;
+}
+
+// Skips any value, checking its syntax; for an array or object, counts its elements if requested
+static int skip_nested(Scanner *scanner, int depth, int *elements) {
+    skip_space(scanner);
+    if (scanner->pos >= scanner->end) {
+        return fail(scanner, "unexpected end of input");
+    }
+    if (*scanner->pos == '"') {
+        return scan_string(scanner, NULL);
+    }
+    if (*scanner->pos != '{' && *scanner->pos != '[') {
+        double number;
+        if (scan_literal(scanner, "true") || scan_literal(scanner, "false") || scan_literal(scanner, "null")) {
+            return 0;
+        }
+        return scan_number(scanner, &number);
+    }
+    if (depth >= STREAM_NESTING_LIMIT) {
+        return fail(scanner, "nested too deeply");
+    }
+
+    // Each level closes with its own bracket, so {"x":[1,2}} is refused like cJSON does
+    bool object = *scanner->pos == '{';
+    char close = object ? '}' : ']';
+    int count = 0;
+    scanner->pos++;
+    if (!expect(scanner, close)) {
+        do {
+            if (object) {
+                skip_space(scanner);
+                if (scan_string(scanner, NULL) != 0) {
+                    return -1;
+                }
+                if (!expect(scanner, ':')) {
+                    return fail(scanner, "expected ':'");
+                }
+            }
+            if (skip_nested(scanner, depth + 1, NULL) != 0) {
+                return -1;
+            }
+            count++;
+        } while (expect(scanner, ','));
+
+        if (!expect(scanner, close)) {
+            return fail(scanner, object ? "expected ',' or '}'" : "expected ',' or ']'");
+        }
+    }
+    if (elements) {
+        *elements = count;
+    }
+    return 0;
+}
+
+static int skip_value(Scanner *scanner, int *elements) {
+    return skip_nested(scanner, 0, elements);
+}
+
+static int scan_value(Scanner *scanner, ConfigField *field) {
+    skip_space(scanner);
+    if (scanner->pos >= scanner->end) {
+        return fail(scanner, "unexpected end of input");
+    }
+
+    switch (*scanner->pos) {
+        case '"':
+            field->type = CONFIG_VALUE_STRING;
+            return scan_string(scanner, &field->string);
+        case '{':
+        case '[':
+            field->type = CONFIG_VALUE_OTHER;
+            return skip_value(scanner, NULL);
+        default:
+            break;
+    }
+
+    if (scan_literal(scanner, "true")) {
+        field->type = CONFIG_VALUE_BOOL;
+        field->boolean = true;
+        return 0;
+    }
+    if (scan_literal(scanner, "false")) {
+        field->type = CONFIG_VALUE_BOOL;
+        field->boolean = false;
+        return 0;
+    }
+    if (scan_literal(scanner, "null")) {
+        field->type = CONFIG_VALUE_OTHER;
+        return 0;
+    }
+    field->type = CONFIG_VALUE_NUMBER;
+    return scan_number(scanner, &field->number);
+}
+
+// Reads an object's members into fields, members beyond CONFIG_MAX_FIELDS are skipped
+static int scan_object(Scanner *scanner, ConfigField *fields, int *count) {
+    *count = 0;
+    if (!expect(scanner, '{')) {
+        return fail(scanner, "expected an object");
+    }
+    if (expect(scanner, '}')) {
+        return 0;
+    }
+
+    bool truncated = false;
+    do {
+        ConfigField field = { 0 };
+        skip_space(scanner);
+        if (scan_string(scanner, &field.key) != 0) {
+            return -1;
+        }
+        if (!expect(scanner, ':')) {
+            return fail(scanner, "expected ':'");
+        }
+        if (scan_value(scanner, &field) != 0) {
+            return -1;
+        }
+        if (*count < CONFIG_MAX_FIELDS) {
+            fields[(*count)++] = field;
+        } else if (!truncated) {
+            log_message(LOG_WARNING, "Ignoring fields of a config object beyond the first %d", CONFIG_MAX_FIELDS);
+            truncated = true;
+        }
+    } while (expect(scanner, ','));
+
+    if (!expect(scanner, '}')) {
+        return fail(scanner, "expected ',' or '}'");
+    }
+    return 0;
+}
+
+static Config* scan_config(Scanner *scanner) {
+    // First pass: find the members that matter, the first of each name wins as with cJSON
+    const char *settings = NULL;
+    const char *ips = NULL;
+    int ip_count = 0;
+
+    if (!expect(scanner, '{')) {
+        fail(scanner, "expected an object");
+        return NULL;
+    }
+    if (!expect(scanner, '}')) {
+        do {
+            const char *key;
+            skip_space(scanner);
+            if (scan_string(scanner, &key) != 0) {
+                return NULL;
+            }
+            if (!expect(scanner, ':')) {
+                fail(scanner, "expected ':'");
+                return NULL;
+            }
+            skip_space(scanner);
+
+            int *elements = NULL;
+            if (!settings && strcasecmp(key, "settings") == 0) {
+                settings = scanner->pos;
+            } else if (!ips && strcasecmp(key, "ip_addresses") == 0) {
+                ips = scanner->pos;
+                elements = &ip_count;
+            }
+            if (skip_value(scanner, elements) != 0) {
+                return NULL;
+            }
+        } while (expect(scanner, ','));
+
+        if (!expect(scanner, '}')) {
+            fail(scanner, "expected ',' or '}'");
+            return NULL;
+        }
+    }
+    skip_space(scanner);
+    if (scanner->pos < scanner->end) {
+        fail(scanner, "unexpected data after the configuration object");
+        return NULL;
+    }
+    arena_reset(&scanner->scratch);
+
+    Config *config = config_create(0);
+    if (!config) {
+        return NULL;
+    }
+
+    // Second pass: settings first, they provide the defaults of the entries
+    ConfigField fields[CONFIG_MAX_FIELDS];
+    int count;
+    if (settings && *settings == '{') {
+        scanner->pos = settings;
+        if (scan_object(scanner, fields, &count) != 0) {
+            free_config(config);
+            return NULL;
+        }
+        config_apply_settings(config, fields, count);
+        arena_reset(&scanner->scratch);
+    }
+
+    if (!ips || *ips != '[') {
+        log_message(LOG_ERROR, "Configuration must contain 'ip_addresses' array");
+        free_config(config);
+        return NULL;
+    }
+
+    if (ip_count == 0) {
+        log_message(LOG_WARNING, "No IP addresses found in configuration");
+    } else {
+        config->ips = (IPConfig*)malloc(ip_count * sizeof(IPConfig));
+        if (!config->ips) {
+            log_message(LOG_ERROR, "Memory allocation failed for IP configurations");
+            free_config(config);
+            return NULL;
+        }
+    }
+
+    // The entries must match the first pass's count, the array has no room for more
+    scanner->pos = ips + 1;
+    for (int i = 0; !expect(scanner, ']'); i++) {
+        if (i >= ip_count) {
+            fail(scanner, "more IP entries than counted");
+            free_config(config);
+            return NULL;
+        }
+        if (i > 0 && !expect(scanner, ',')) {
+            fail(scanner, "expected ',' or ']'");
+            free_config(config);
+            return NULL;
+        }
+
+        skip_space(scanner);
+        int status;
+        if (scanner->pos < scanner->end && *scanner->pos == '"') {
+            // Simple format: just the IP address string
+            fields[0] = (ConfigField){ .key = "ip", .type = CONFIG_VALUE_STRING };
+            count = 1;
+            status = scan_string(scanner, &fields[0].string);
+        } else if (scanner->pos < scanner->end && *scanner->pos == '{') {
+            // Complex format: object with IP and settings
+            status = scan_object(scanner, fields, &count);
+        } else {
+            log_message(LOG_ERROR, "Invalid IP item format at index %d", i);
+            status = -1;
+        }
+
+        if (status != 0 || config_add_ip(config, fields, count) != 0) {
+            free_config(config);
+            return NULL;
+        }
+        arena_reset(&scanner->scratch);
+    }
+    if (config->ip_count != ip_count) {
+        log_message(LOG_ERROR, "Found %d of the %d IP entries counted in configuration",
+                    config->ip_count, ip_count);
+        free_config(config);
+        return NULL;
+    }
+
+    log_message(LOG_INFO, "Configuration loaded successfully with %d IP addresses", config->ip_count);
+    return config;
+}
+
+Config* load_config_stream(const char *data, size_t length) {
+    if (!data) {
+        log_message(LOG_ERROR, "No configuration data");
+        return NULL;
+    }
+
+    Scanner scanner = { .start = data, .pos = data, .end = data + length };
+    arena_init(&scanner.scratch, 0);
+    Config *config = scan_config(&scanner);
+    arena_free(&scanner.scratch);
+    return config;
+}
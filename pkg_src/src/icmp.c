@@ -0,0 +1,374 @@
+/**
+ * @file icmp.c
+ * @brief Implementation of native ICMP and ICMPv6 echo request/reply handling
+ */
+
+#include "../include/icmp.h"
+#include "../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#define ICMP_PAYLOAD_MAGIC 0x49504d4eu // "IPMN"
+#define ICMP_CONTROL_SIZE 128
+#define ICMP_NSEC_PER_SEC 1000000000LL
+#define ICMP_RX_TIMESTAMPING (SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE)
+#define ICMP_TX_TIMESTAMPING (ICMP_RX_TIMESTAMPING | SOF_TIMESTAMPING_TX_SOFTWARE)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cookie;
+    uint32_t tag;
+    uint32_t reserved;
+    int64_t sent_sec;           // CLOCK_MONOTONIC when the request was built
+    int64_t sent_nsec;
+} IcmpPayload;
+
+// Utility function to calculate checksum for ICMP packet
+static unsigned short calculate_checksum(unsigned short *addr, int len) {
+    int nleft = len;
+    int sum = 0;
+    unsigned short *w = addr;
+    unsigned short answer = 0;
+
+    while (nleft > 1) {
+        sum += *w++;
+        nleft -= 2;
+    }
+
+    if (nleft == 1) {
+        *(unsigned char *)(&answer) = *(unsigned char *)w;
+        sum += answer;
+    }
+
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+    answer = ~sum;
+    return answer;
+}
+
+int icmp_open(IcmpSocket *sock, int family) {
+    if (!sock || (family != AF_INET && family != AF_INET6)) {
+        return -1;
+    }
+
+    // Unprivileged ping sockets need net.ipv4.ping_group_range (both families), raw ones CAP_NET_RAW
+    int protocol = family == AF_INET6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+    sock->family = family;
+    sock->type = SOCK_DGRAM;
+    sock->fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    if (sock->fd < 0) {
+        sock->type = SOCK_RAW;
+        sock->fd = socket(family, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    }
+    if (sock->fd < 0) {
+        log_message(LOG_ERROR, "Failed to open %s socket: %s",
+                    family == AF_INET6 ? "ICMPv6" : "ICMP", strerror(errno));
+        return -1;
+    }
+
+    sock->ident = (uint16_t)(getpid() & 0xFFFF);
+
+    // A raw ICMPv6 socket sees all ICMPv6 traffic, neighbor discovery included
+    if (family == AF_INET6 && sock->type == SOCK_RAW) {
+        struct icmp6_filter filter;
+        ICMP6_FILTER_SETBLOCKALL(&filter);
+        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+        setsockopt(sock->fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+    }
+
+    int flags = ICMP_RX_TIMESTAMPING;
+    int on = 1;
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0 &&
+        setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0) {
+        log_message(LOG_WARNING, "Kernel timestamps unavailable, using user-space receive times");
+    }
+
+    return 0;
+}
+
+int icmp_enable_tx_timestamps(const IcmpSocket *sock) {
+    int flags = ICMP_TX_TIMESTAMPING;
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+        log_message(LOG_DEBUG, "Transmit timestamps unavailable: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void icmp_close(IcmpSocket *sock) {
+    if (sock && sock->fd >= 0) {
+        close(sock->fd);
+        sock->fd = -1;
+    }
+}
+
+static void map_ipv4(const struct in_addr *v4, struct in6_addr *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->s6_addr[10] = 0xff;
+    addr->s6_addr[11] = 0xff;
+    memcpy(&addr->s6_addr[12], v4, sizeof(*v4));
+}
+
+int icmp_resolve(const char *host, struct in6_addr *addr) {
+    if (!host || !addr) {
+        return -1;
+    }
+
+    struct in_addr v4;
+    if (inet_pton(AF_INET, host, &v4) == 1) {
+        map_ipv4(&v4, addr);
+        return AF_INET;
+    }
+    if (inet_pton(AF_INET6, host, addr) == 1) {
+        return IN6_IS_ADDR_V4MAPPED(addr) ? AF_INET : AF_INET6;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_RAW;
+
+    int rc = getaddrinfo(host, NULL, &hints, &result);
+    if (rc != 0 || !result) {
+        log_message(LOG_ERROR, "Failed to resolve %s: %s", host, gai_strerror(rc));
+        return -1;
+    }
+
+    int family = result->ai_family;
+    if (family == AF_INET6) {
+        *addr = ((const struct sockaddr_in6 *)result->ai_addr)->sin6_addr;
+    } else {
+        map_ipv4(&((const struct sockaddr_in *)result->ai_addr)->sin_addr, addr);
+        family = AF_INET;
+    }
+    freeaddrinfo(result);
+    return family;
+}
+
+socklen_t icmp_sockaddr(const struct in6_addr *addr, struct sockaddr_storage *out) {
+    memset(out, 0, sizeof(*out));
+    if (IN6_IS_ADDR_V4MAPPED(addr)) {
+        struct sockaddr_in *v4 = (struct sockaddr_in *)out;
+        v4->sin_family = AF_INET;
+        memcpy(&v4->sin_addr, &addr->s6_addr[12], sizeof(v4->sin_addr));
+        return sizeof(*v4);
+    }
+
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)out;
+    v6->sin6_family = AF_INET6;
+    v6->sin6_addr = *addr;
+    return sizeof(*v6);
+}
+
+// Move a kernel timestamp from CLOCK_REALTIME onto CLOCK_MONOTONIC as of now
+static void kernel_to_monotonic(const struct timespec *kernel, struct timespec *out) {
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    int64_t ns = ((int64_t)kernel->tv_sec - real.tv_sec + mono.tv_sec) * ICMP_NSEC_PER_SEC +
+                 kernel->tv_nsec - real.tv_nsec + mono.tv_nsec;
+    out->tv_sec = (time_t)(ns / ICMP_NSEC_PER_SEC);
+    out->tv_nsec = (long)(ns % ICMP_NSEC_PER_SEC);
+}
+
+size_t icmp_build_echo(const IcmpSocket *sock, uint8_t *buf, uint16_t sequence, uint32_t cookie,
+                       uint32_t tag) {
+    struct icmphdr *hdr = (struct icmphdr *)buf;
+    IcmpPayload payload;
+    struct timespec now;
+
+    // Both echo headers are 8 bytes with the identifier and sequence at the same offsets
+    memset(buf, 0, PACKET_SIZE);
+    hdr->type = sock->family == AF_INET6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+    hdr->code = 0;
+    hdr->un.echo.id = htons(sock->ident);
+    hdr->un.echo.sequence = htons(sequence);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    payload.magic = ICMP_PAYLOAD_MAGIC;
+    payload.cookie = cookie;
+    payload.tag = tag;
+    payload.reserved = 0;
+    payload.sent_sec = now.tv_sec;
+    payload.sent_nsec = now.tv_nsec;
+    memcpy(buf + sizeof(*hdr), &payload, sizeof(payload));
+
+    // The ICMPv6 checksum covers a pseudo-header with the source address, the kernel fills it in
+    if (sock->family != AF_INET6) {
+        hdr->checksum = calculate_checksum((unsigned short *)buf, PACKET_SIZE);
+    }
+    return PACKET_SIZE;
+}
+
+int icmp_send_echo(const IcmpSocket *sock, const struct sockaddr *addr, socklen_t addr_len,
+                   uint16_t sequence, uint32_t cookie) {
+    uint8_t packet[PACKET_SIZE];
+    size_t len = icmp_build_echo(sock, packet, sequence, cookie, 0);
+
+    ssize_t sent = sendto(sock->fd, packet, len, 0, addr, addr_len);
+    if (sent < 0) {
+        log_message(LOG_DEBUG, "Failed to send echo request: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int icmp_parse_reply(const IcmpSocket *sock, const struct msghdr *msg, size_t len, IcmpReply *reply) {
+    const uint8_t *buf = (const uint8_t *)msg->msg_iov[0].iov_base;
+
+    // Raw IPv4 sockets deliver the IP header, ping and ICMPv6 sockets strip it
+    if (sock->type == SOCK_RAW && sock->family == AF_INET) {
+        if (len < sizeof(struct iphdr)) {
+            return 0;
+        }
+        size_t ip_len = ((const struct iphdr *)buf)->ihl * 4;
+        if (len < ip_len) {
+            return 0;
+        }
+        buf += ip_len;
+        len -= ip_len;
+    }
+
+    if (len < sizeof(struct icmphdr) + sizeof(IcmpPayload)) {
+        return 0;
+    }
+
+    const struct icmphdr *hdr = (const struct icmphdr *)buf;
+    if (hdr->type != (sock->family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY)) {
+        return 0;
+    }
+    if (sock->type == SOCK_RAW && ntohs(hdr->un.echo.id) != sock->ident) {
+        return 0;
+    }
+
+    IcmpPayload payload;
+    memcpy(&payload, buf + sizeof(*hdr), sizeof(payload));
+    if (payload.magic != ICMP_PAYLOAD_MAGIC) {
+        return 0;
+    }
+
+    memset(reply, 0, sizeof(*reply));
+    if (msg->msg_name && sock->family == AF_INET6 && msg->msg_namelen >= sizeof(struct sockaddr_in6)) {
+        reply->from = ((const struct sockaddr_in6 *)msg->msg_name)->sin6_addr;
+    } else if (msg->msg_name && msg->msg_namelen >= sizeof(struct sockaddr_in)) {
+        map_ipv4(&((const struct sockaddr_in *)msg->msg_name)->sin_addr, &reply->from);
+    }
+    reply->sequence = ntohs(hdr->un.echo.sequence);
+    reply->cookie = payload.cookie;
+    reply->tag = payload.tag;
+    reply->sent.tv_sec = (time_t)payload.sent_sec;
+    reply->sent.tv_nsec = (long)payload.sent_nsec;
+
+    bool have_timestamp = false;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR((struct msghdr *)msg); cmsg;
+         cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        // SO_TIMESTAMPING reports the software timestamp first, hardware ones are not requested
+        struct timespec stamp = { 0, 0 };
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING || cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+        }
+        if (stamp.tv_sec || stamp.tv_nsec) {
+            kernel_to_monotonic(&stamp, &reply->received);
+            have_timestamp = true;
+        }
+    }
+    if (!have_timestamp) {
+        clock_gettime(CLOCK_MONOTONIC, &reply->received);
+    }
+
+    return 1;
+}
+
+int icmp_parse_tx_timestamp(const IcmpSocket *sock, const struct msghdr *msg, size_t len,
+                            uint32_t *tag, struct timespec *sent) {
+    struct timespec stamp = { 0, 0 };
+    bool transmitted = false;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR((struct msghdr *)msg); cmsg;
+         cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+        } else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                   (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            transmitted = err.ee_errno == ENOMSG && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING;
+        }
+    }
+    if (!transmitted || (!stamp.tv_sec && !stamp.tv_nsec)) {
+        return 0;
+    }
+
+    // The request comes back with the headers the driver saw, link layer included, so find its payload
+    const uint8_t *buf = (const uint8_t *)msg->msg_iov[0].iov_base;
+    uint8_t request = sock->family == AF_INET6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+    uint32_t magic = ICMP_PAYLOAD_MAGIC;
+    for (size_t at = sizeof(struct icmphdr); at + sizeof(IcmpPayload) <= len; at++) {
+        if (memcmp(buf + at, &magic, sizeof(magic)) != 0 || buf[at - sizeof(struct icmphdr)] != request) {
+            continue;
+        }
+        IcmpPayload payload;
+        memcpy(&payload, buf + at, sizeof(payload));
+        *tag = payload.tag;
+        kernel_to_monotonic(&stamp, sent);
+        return 1;
+    }
+    return 0;
+}
+
+int icmp_recv_reply(const IcmpSocket *sock, IcmpReply *reply) {
+    uint8_t buf[ICMP_RECV_BUFFER_SIZE];
+    uint8_t control[ICMP_CONTROL_SIZE];
+    struct sockaddr_storage from;
+    struct iovec iov = { buf, sizeof(buf) };
+    struct msghdr msg;
+
+    // Skip datagrams that are not our echo replies until the queue is empty
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t len = recvmsg(sock->fd, &msg, MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            log_message(LOG_ERROR, "Failed to receive ICMP reply: %s", strerror(errno));
+            return -1;
+        }
+
+        if (icmp_parse_reply(sock, &msg, (size_t)len, reply)) {
+            return 1;
+        }
+    }
+}
+
+long icmp_rtt_us(const IcmpReply *reply) {
+    long rtt = (long)(reply->received.tv_sec - reply->sent.tv_sec) * 1000000L +
+               (reply->received.tv_nsec - reply->sent.tv_nsec) / 1000L;
+    return rtt < 0 ? 0 : rtt;
+}
@@ -0,0 +1,542 @@
+/**
+ * @file ip_store.c
+ * @brief Implementation of the structure-of-arrays IP store
+ */
+
+#include "../include/ip_store.h"
+#include "../include/icmp.h"
+#include "../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define STRING_POOL_INITIAL_SLOTS 64
+#define STRING_POOL_GROWTH (64 * 1024) // Bytes of the reservation made usable at a time
+#define IP_STORE_INITIAL_LOOKUP 64
+
+// Every per-IP array of the store, so allocation and growth stay in one place
+#define IP_STORE_FIELDS(X) \
+    X(name) X(family) X(addr) X(range_size) X(host_name) X(active) X(interval_ms) X(min_interval_ms) \
+    X(max_interval_ms) X(timeout_ms) X(probe_type) X(port) X(publish_mode) X(rtt_threshold_us) \
+    X(keepalive_ms) X(published_rtt_us) X(published_ms) X(status_policy) \
+    X(status) X(settled) X(rtt_us) X(failures) X(successes) X(flap_penalty) X(flap_ms) \
+    X(alive_count) X(rtt_stats) X(last_checked) X(seq)
+
+static uint32_t hash_string(const char *string) {
+    uint32_t hash = 2166136261u;
+    while (*string) {
+        hash ^= (unsigned char)*string++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int string_pool_rehash(StringPool *pool, size_t slot_count) {
+    uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+    if (!slots) {
+        log_message(LOG_ERROR, "Memory allocation failed for string pool index");
+        return -1;
+    }
+
+    for (size_t i = 0; i < pool->slot_count; i++) {
+        if (!pool->slots[i]) {
+            continue;
+        }
+        size_t pos = hash_string(pool->data + pool->slots[i] - 1) & (slot_count - 1);
+        while (slots[pos]) {
+            pos = (pos + 1) & (slot_count - 1);
+        }
+        slots[pos] = pool->slots[i];
+    }
+
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slot_count = slot_count;
+    return 0;
+}
+
+uint32_t string_pool_find(const StringPool *pool, const char *string) {
+    if (!pool->slot_count || !string) {
+        return STRING_POOL_NONE;
+    }
+
+    size_t pos = hash_string(string) & (pool->slot_count - 1);
+    while (pool->slots[pos]) {
+        uint32_t offset = pool->slots[pos] - 1;
+        if (strcmp(pool->data + offset, string) == 0) {
+            return offset;
+        }
+        pos = (pos + 1) & (pool->slot_count - 1);
+    }
+    return STRING_POOL_NONE;
+}
+
+uint32_t string_pool_intern(StringPool *pool, const char *string) {
+    if (!string) {
+        return STRING_POOL_NONE;
+    }
+
+    uint32_t existing = string_pool_find(pool, string);
+    if (existing != STRING_POOL_NONE) {
+        return existing;
+    }
+
+    // Keep the index at most half full
+    if ((pool->entries + 1) * 2 > pool->slot_count) {
+        size_t slot_count = pool->slot_count ? pool->slot_count * 2 : STRING_POOL_INITIAL_SLOTS;
+        if (string_pool_rehash(pool, slot_count) != 0) {
+            return STRING_POOL_NONE;
+        }
+    }
+
+    size_t length = strlen(string) + 1;
+    if (pool->length + length > pool->capacity) {
+        if (pool->length + length > STRING_POOL_RESERVE) {
+            log_message(LOG_ERROR, "String pool is full");
+            return STRING_POOL_NONE;
+        }
+        // Grow in place within one reservation, so strings handed out earlier never move
+        if (!pool->data) {
+            void *data = mmap(NULL, STRING_POOL_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (data == MAP_FAILED) {
+                log_message(LOG_ERROR, "Failed to reserve string pool: %s", strerror(errno));
+                return STRING_POOL_NONE;
+            }
+            pool->data = (char *)data;
+        }
+        size_t capacity = (pool->length + length + STRING_POOL_GROWTH - 1) / STRING_POOL_GROWTH * STRING_POOL_GROWTH;
+        if (capacity > STRING_POOL_RESERVE) {
+            capacity = STRING_POOL_RESERVE;
+        }
+        if (mprotect(pool->data, capacity, PROT_READ | PROT_WRITE) != 0) {
+            log_message(LOG_ERROR, "Memory allocation failed for string pool: %s", strerror(errno));
+            return STRING_POOL_NONE;
+        }
+        pool->capacity = capacity;
+    }
+
+    uint32_t offset = (uint32_t)pool->length;
+    memcpy(pool->data + offset, string, length);
+    pool->length += length;
+
+    size_t pos = hash_string(string) & (pool->slot_count - 1);
+    while (pool->slots[pos]) {
+        pos = (pos + 1) & (pool->slot_count - 1);
+    }
+    pool->slots[pos] = offset + 1;
+    pool->entries++;
+    return offset;
+}
+
+void string_pool_free(StringPool *pool) {
+    if (!pool) {
+        return;
+    }
+
+    if (pool->data) {
+        munmap(pool->data, STRING_POOL_RESERVE);
+    }
+    free(pool->slots);
+    memset(pool, 0, sizeof(*pool));
+}
+
+static size_t hash_offset(uint32_t offset, size_t size) {
+    return (size_t)((offset * 2654435769u) >> 7) & (size - 1);
+}
+
+static void lookup_insert(int32_t *lookup, size_t size, const IPStore *store, int index) {
+    size_t pos = hash_offset(store->name[index], size);
+    while (lookup[pos]) {
+        pos = (pos + 1) & (size - 1);
+    }
+    lookup[pos] = index + 1;
+}
+
+static int lookup_position(const IPStore *store, uint32_t name) {
+    if (!store->lookup_size) {
+        return -1;
+    }
+
+    size_t pos = hash_offset(name, store->lookup_size);
+    while (store->lookup[pos]) {
+        if (store->name[store->lookup[pos] - 1] == name) {
+            return (int)pos;
+        }
+        pos = (pos + 1) & (store->lookup_size - 1);
+    }
+    return -1;
+}
+
+static int lookup_grow(IPStore *store) {
+    if ((size_t)(store->live_count + 1) * 2 <= store->lookup_size) {
+        return 0;
+    }
+
+    size_t size = store->lookup_size ? store->lookup_size * 2 : IP_STORE_INITIAL_LOOKUP;
+    int32_t *lookup = (int32_t *)calloc(size, sizeof(int32_t));
+    if (!lookup) {
+        log_message(LOG_ERROR, "Memory allocation failed for IP store index");
+        return -1;
+    }
+
+    for (size_t i = 0; i < store->lookup_size; i++) {
+        if (store->lookup[i]) {
+            lookup_insert(lookup, size, store, store->lookup[i] - 1);
+        }
+    }
+    free(store->lookup);
+    store->lookup = lookup;
+    store->lookup_size = size;
+    return 0;
+}
+
+static void lookup_delete(IPStore *store, int pos) {
+    size_t size = store->lookup_size;
+    size_t hole = (size_t)pos;
+    size_t next = (hole + 1) & (size - 1);
+
+    // Backward-shift deletion keeps linear probe chains intact without tombstones
+    while (store->lookup[next]) {
+        size_t home = hash_offset(store->name[store->lookup[next] - 1], size);
+        if (((next - home) & (size - 1)) >= ((next - hole) & (size - 1))) {
+            store->lookup[hole] = store->lookup[next];
+            hole = next;
+        }
+        next = (next + 1) & (size - 1);
+    }
+    store->lookup[hole] = 0;
+}
+
+static bool parse_ipv4(const char *text, size_t length, uint32_t *addr) {
+    char buffer[INET_ADDRSTRLEN];
+    struct in_addr parsed;
+
+    if (length >= sizeof(buffer)) {
+        return false;
+    }
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+    if (inet_pton(AF_INET, buffer, &parsed) != 1) {
+        return false;
+    }
+    *addr = ntohl(parsed.s_addr);
+    return true;
+}
+
+int ip_store_parse_range(const char *spec, uint32_t *first, uint32_t *count) {
+    const char *slash = strchr(spec, '/');
+    const char *dash = strchr(spec, '-');
+    uint64_t size;
+
+    if (slash) {
+        uint32_t base;
+        char *end;
+        long prefix = strtol(slash + 1, &end, 10);
+        if (!parse_ipv4(spec, (size_t)(slash - spec), &base) || end == slash + 1 || *end ||
+            prefix < 0 || prefix > 32) {
+            log_message(LOG_ERROR, "Invalid CIDR block: %s", spec);
+            return -1;
+        }
+
+        size = 1ULL << (32 - prefix);
+        *first = base & ~(uint32_t)(size - 1);
+        if (prefix <= 30) {
+            // Network and broadcast addresses are not hosts
+            (*first)++;
+            size -= 2;
+        }
+    } else if (dash) {
+        uint32_t start;
+        uint32_t last;
+        if (!parse_ipv4(spec, (size_t)(dash - spec), &start)) {
+            return 0;   // A host name with a dash in it
+        }
+        if (!parse_ipv4(dash + 1, strlen(dash + 1), &last) || last < start) {
+            log_message(LOG_ERROR, "Invalid address range: %s", spec);
+            return -1;
+        }
+
+        *first = start;
+        size = (uint64_t)last - start + 1;
+    } else {
+        return 0;
+    }
+
+    if (size > IP_STORE_MAX_RANGE) {
+        log_message(LOG_ERROR, "Address range %s is larger than %u addresses", spec, IP_STORE_MAX_RANGE);
+        return -1;
+    }
+    *count = (uint32_t)size;
+    return 1;
+}
+
+static int ip_store_resize(IPStore *store, int capacity) {
+#define X(field) { \
+        void *grown = realloc(store->field, (size_t)capacity * sizeof(*store->field)); \
+        if (!grown) { \
+            log_message(LOG_ERROR, "Memory allocation failed for IP store"); \
+            return -1; \
+        } \
+        store->field = grown; \
+    }
+    IP_STORE_FIELDS(X)
+#undef X
+
+    store->capacity = capacity;
+    return 0;
+}
+
+int ip_store_init(IPStore *store, int capacity) {
+    if (!store) {
+        return -1;
+    }
+
+    memset(store, 0, sizeof(*store));
+    pthread_rwlock_init(&store->layout_lock, NULL);
+    if (capacity > 0 && (ip_store_resize(store, capacity) != 0 ||
+                         (store->free_slots = (int *)malloc(capacity * sizeof(int))) == NULL)) {
+        ip_store_free(store);
+        return -1;
+    }
+    return 0;
+}
+
+void ip_store_free(IPStore *store) {
+    if (!store) {
+        return;
+    }
+
+#define X(field) free(store->field);
+    IP_STORE_FIELDS(X)
+#undef X
+
+    string_pool_free(&store->names);
+    free(store->lookup);
+    free(store->free_slots);
+    pthread_rwlock_destroy(&store->layout_lock);
+    memset(store, 0, sizeof(*store));
+}
+
+static int ip_store_grow(IPStore *store) {
+    int capacity = store->capacity ? store->capacity * 2 : 16;
+    int *free_slots = (int *)realloc(store->free_slots, capacity * sizeof(int));
+    if (!free_slots) {
+        log_message(LOG_ERROR, "Memory allocation failed for IP store");
+        return -1;
+    }
+    store->free_slots = free_slots;
+    return ip_store_resize(store, capacity);
+}
+
+void ip_store_interval_bounds(const IPConfig *config, int32_t *min_ms, int32_t *max_ms) {
+    int interval = config->interval_ms;
+    *min_ms = config->min_interval_ms > 0 && config->min_interval_ms < interval ? config->min_interval_ms : interval;
+    *max_ms = config->max_interval_ms > interval ? config->max_interval_ms : interval;
+}
+
+int ip_store_resolve(const char *spec, IPStoreAddress *address) {
+    uint32_t range_first = 0;
+    uint32_t range_size = 0;
+
+    int range = ip_store_parse_range(spec, &range_first, &range_size);
+    if (range < 0) {
+        return -1;
+    }
+
+    struct in6_addr literal;
+    memset(address, 0, sizeof(*address));
+    address->range_size = range_size;
+    address->host_name = !range && inet_pton(AF_INET, spec, &literal) != 1 &&
+                         inet_pton(AF_INET6, spec, &literal) != 1;
+    if (range) {
+        uint32_t first = htonl(range_first);
+        address->addr.s6_addr[10] = 0xff;
+        address->addr.s6_addr[11] = 0xff;
+        memcpy(&address->addr.s6_addr[12], &first, sizeof(first));
+        address->family = AF_INET;
+        return 0;
+    }
+
+    int family = icmp_resolve(spec, &address->addr);
+    if (family < 0) {
+        memset(&address->addr, 0, sizeof(address->addr));
+        address->family = AF_UNSPEC;
+    } else {
+        address->family = (uint8_t)family;
+    }
+    return 0;
+}
+
+int ip_store_add(IPStore *store, const IPConfig *config) {
+    IPStoreAddress address;
+    if (ip_store_resolve(config->ip_address, &address) != 0) {
+        return -1;
+    }
+    return ip_store_add_resolved(store, config, &address);
+}
+
+int ip_store_add_resolved(IPStore *store, const IPConfig *config, const IPStoreAddress *address) {
+    uint32_t range_size = address->range_size;
+    int index = -1;
+
+    pthread_rwlock_wrlock(&store->layout_lock);
+
+    if (!store->free_count && store->count == store->capacity && ip_store_grow(store) != 0) {
+        goto out;
+    }
+    if (lookup_grow(store) != 0) {
+        goto out;
+    }
+
+    uint32_t name = string_pool_intern(&store->names, config->ip_address);
+    if (name == STRING_POOL_NONE) {
+        goto out;
+    }
+
+    if (store->free_count) {
+        index = store->free_slots[--store->free_count];
+    } else {
+        index = store->count++;
+        atomic_init(&store->seq[index], 0);
+    }
+    store->name[index] = name;
+    store->family[index] = address->family;
+    store->addr[index] = address->addr;
+    store->range_size[index] = range_size;
+    store->host_name[index] = address->host_name;
+
+    store->active[index] = config->is_active;
+    store->interval_ms[index] = config->interval_ms;
+    ip_store_interval_bounds(config, &store->min_interval_ms[index], &store->max_interval_ms[index]);
+    store->timeout_ms[index] = config->timeout;
+    store->probe_type[index] = (uint8_t)config->probe_type;
+    store->port[index] = (uint16_t)config->port;
+    if (range_size && config->probe_type != PROBE_ICMP) {
+        // Sweeps track their addresses through echo replies
+        log_message(LOG_WARNING, "Range %s is probed with ICMP echo, other probe types take single addresses",
+                    config->ip_address);
+        store->probe_type[index] = PROBE_ICMP;
+    }
+    store->publish_mode[index] = (uint8_t)config->publish_mode;
+    store->rtt_threshold_us[index] = config->rtt_threshold_ms * 1000;
+    store->keepalive_ms[index] = config->keepalive_ms;
+    store->status_policy[index] = config->status_policy;
+    store->published_rtt_us[index] = -1;
+    store->published_ms[index] = 0;
+
+    // A reused index keeps counting its seqlock so readers never see a stale match
+    ip_store_write_begin(store, index);
+    store->status[index] = 0;   // STATUS_UNKNOWN
+    store->settled[index] = 0;
+    store->rtt_us[index] = -1;
+    store->failures[index] = 0;
+    store->successes[index] = 0;
+    store->flap_penalty[index] = 0;
+    store->flap_ms[index] = 0;
+    store->alive_count[index] = 0;
+    rtt_stats_init(&store->rtt_stats[index]);
+    store->last_checked[index] = 0;
+    ip_store_write_end(store, index);
+
+    lookup_insert(store->lookup, store->lookup_size, store, index);
+    store->live_count++;
+
+out:
+    pthread_rwlock_unlock(&store->layout_lock);
+    return index;
+}
+
+bool ip_store_set_address(IPStore *store, int index, const IPStoreAddress *address) {
+    if (store->family[index] == address->family &&
+        memcmp(&store->addr[index], &address->addr, sizeof(address->addr)) == 0) {
+        return false;
+    }
+
+    ip_store_write_begin(store, index);
+    store->family[index] = address->family;
+    store->addr[index] = address->addr;
+    ip_store_write_end(store, index);
+    return true;
+}
+
+void ip_store_remove(IPStore *store, int index) {
+    if (index < 0 || index >= store->count || store->status[index] == IP_STORE_REMOVED) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&store->layout_lock);
+
+    int pos = lookup_position(store, store->name[index]);
+    if (pos >= 0) {
+        lookup_delete(store, pos);
+    }
+
+    ip_store_write_begin(store, index);
+    store->status[index] = IP_STORE_REMOVED;
+    store->rtt_us[index] = -1;
+    store->failures[index] = 0;
+    store->successes[index] = 0;
+    store->alive_count[index] = 0;
+    ip_store_write_end(store, index);
+    store->active[index] = 0;
+
+    store->free_slots[store->free_count++] = index;
+    store->live_count--;
+
+    pthread_rwlock_unlock(&store->layout_lock);
+}
+
+int ip_store_find(const IPStore *store, const char *name) {
+    uint32_t offset = string_pool_find(&store->names, name);
+    if (offset == STRING_POOL_NONE) {
+        return -1;
+    }
+
+    int pos = lookup_position(store, offset);
+    return pos < 0 ? -1 : store->lookup[pos] - 1;
+}
+
+const char* ip_store_name(const IPStore *store, int index) {
+    return store->names.data + store->name[index];
+}
+
+int ip_store_find_status(const IPStore *store, uint8_t status, int *indices, int max) {
+    int found = 0;
+
+    pthread_rwlock_rdlock((pthread_rwlock_t *)&store->layout_lock);
+    const uint8_t *statuses = store->status;
+    for (int i = 0; i < store->count; i++) {
+        if (statuses[i] == status) {
+            if (indices && found < max) {
+                indices[found] = i;
+            }
+            found++;
+        }
+    }
+    pthread_rwlock_unlock((pthread_rwlock_t *)&store->layout_lock);
+    return found;
+}
+
+void ip_store_address(const IPStore *store, int index, uint32_t offset, struct in6_addr *addr) {
+    *addr = store->addr[index];
+    if (offset) {
+        uint32_t v4;
+        memcpy(&v4, &addr->s6_addr[12], sizeof(v4));
+        v4 = htonl(ntohl(v4) + offset);
+        memcpy(&addr->s6_addr[12], &v4, sizeof(v4));
+    }
+}
+
+socklen_t ip_store_sockaddr(const IPStore *store, int index, uint32_t offset, struct sockaddr_storage *addr) {
+    if (store->family[index] == AF_UNSPEC) {
+        return 0;
+    }
+
+    struct in6_addr target;
+    ip_store_address(store, index, offset, &target);
+    return icmp_sockaddr(&target, addr);
+}
@@ -1,6 +1,14 @@
 /**
  * @file logger.c
  * @brief Implementation of logging functionality
+ *
+ * Callers format their message into a slot of a bounded lock-free ring and
+ * return; a background thread adds timestamps and writes whole batches of
+ * lines with a single fwrite() and fflush(). Each slot carries a sequence
+ * number telling whose turn it is: producers claim slots by advancing the
+ * enqueue position with a CAS, and the writer hands a slot back to them by
+ * moving its sequence one lap ahead. When the ring is full new messages are
+ * dropped and counted instead of blocking the caller.
  */
 
 #include "../include/logger.h"
@@ -8,35 +16,210 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#define LOG_RING_SIZE 1024      // Records the ring holds, a power of two
+#define LOG_MESSAGE_SIZE 256    // Longest message kept, longer ones are truncated
+#define LOG_BATCH_SIZE 65536    // Bytes of formatted lines written at once
+
+typedef struct {
+    atomic_size_t sequence;     // Position + 1 when filled, position + LOG_RING_SIZE when free
+    time_t time;                // When the message was logged
+    LogLevel level;             // Level of the message
+    char message[LOG_MESSAGE_SIZE]; // Formatted message without timestamp or level
+} LogRecord;
 
 static FILE *log_file = NULL;
 static LogLevel current_log_level = LOG_INFO;
 static int is_stdout = 0;
 
+// The queue and its writer thread only exist in builds that log
+#ifdef _DEBUG
+static LogRecord log_ring[LOG_RING_SIZE];
+static atomic_size_t enqueue_pos;       // Next position producers claim
+static size_t dequeue_pos;              // Next position the writer reads, writer only
+static atomic_ulong dropped;            // Messages lost because the ring was full
+static atomic_bool writer_waiting;      // Writer is (about to be) blocked on wake_fd
+static atomic_bool writer_running;      // Writer thread is started
+static atomic_bool writer_stop;         // Writer should exit once the ring is drained
+static int wake_fd = -1;
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool ring_ready = false;
+static bool exit_hook_set = false;
+
+static const char* level_name(LogLevel level) {
+    switch (level) {
+        case LOG_DEBUG:
+            return "DEBUG";
+        case LOG_INFO:
+            return "INFO";
+        case LOG_WARNING:
+            return "WARNING";
+        case LOG_ERROR:
+            return "ERROR";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+static void write_batch(char *batch, size_t *used) {
+    if (*used == 0) {
+        return;
+    }
+
+    FILE *out = log_file ? log_file : stdout;
+    fwrite(batch, 1, *used, out);
+    fflush(out);
+    *used = 0;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    static char batch[LOG_BATCH_SIZE];
+    size_t used = 0;
+    char time_str[20] = "";
+    time_t cached_time = (time_t)-1;
+
+    for (;;) {
+        LogRecord *record = &log_ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+        if (atomic_load_explicit(&record->sequence, memory_order_acquire) == dequeue_pos + 1) {
+            // Records arrive in time order, so one strftime() serves a whole second
+            if (record->time != cached_time) {
+                struct tm time_info;
+                localtime_r(&record->time, &time_info);
+                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &time_info);
+                cached_time = record->time;
+            }
+            if (LOG_BATCH_SIZE - used < LOG_MESSAGE_SIZE + 64) {
+                write_batch(batch, &used);
+            }
+            used += snprintf(batch + used, LOG_BATCH_SIZE - used, "[%s] [%s] %s\n",
+                             time_str, level_name(record->level), record->message);
+
+            atomic_store_explicit(&record->sequence, dequeue_pos + LOG_RING_SIZE, memory_order_release);
+            dequeue_pos++;
+            continue;
+        }
+
+        unsigned long lost = atomic_exchange(&dropped, 0);
+        if (lost) {
+            used += snprintf(batch + used, LOG_BATCH_SIZE - used,
+                             "[%s] [WARNING] %lu log messages dropped, log buffer full\n", time_str, lost);
+        }
+        write_batch(batch, &used);
+
+        if (atomic_load(&writer_stop)) {
+            break;
+        }
+
+        // Announce the wait, then look again so a message published meanwhile is not missed
+        atomic_store(&writer_waiting, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&record->sequence, memory_order_acquire) == dequeue_pos + 1 ||
+            atomic_load(&writer_stop)) {
+            atomic_store(&writer_waiting, false);
+            continue;
+        }
+
+        uint64_t value;
+        if (read(wake_fd, &value, sizeof(value)) < 0) {
+            // Interrupted, the loop re-checks the ring either way
+        }
+    }
+
+    return NULL;
+}
+
+static void wake_writer(void) {
+    uint64_t value = 1;
+    if (write(wake_fd, &value, sizeof(value)) < 0) {
+        // The counter is only a doorbell, a full one still wakes the writer
+    }
+}
+
+static void stop_writer(void) {
+    pthread_mutex_lock(&writer_lock);
+    if (atomic_load(&writer_running)) {
+        atomic_store(&writer_stop, true);
+        wake_writer();
+        pthread_join(writer_thread, NULL);
+        atomic_store(&writer_stop, false);
+        atomic_store(&writer_waiting, false);
+        atomic_store(&writer_running, false);
+    }
+    pthread_mutex_unlock(&writer_lock);
+}
+
+static void start_writer(void) {
+    pthread_mutex_lock(&writer_lock);
+    if (atomic_load(&writer_running)) {
+        pthread_mutex_unlock(&writer_lock);
+        return;
+    }
+
+    if (!ring_ready) {
+        for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+            atomic_init(&log_ring[i].sequence, i);
+        }
+        wake_fd = eventfd(0, EFD_CLOEXEC);
+        ring_ready = true;
+    }
+    if (!log_file) {
+        log_file = stdout;
+        is_stdout = 1;
+    }
+
+    if (wake_fd >= 0 && pthread_create(&writer_thread, NULL, writer_main, NULL) == 0) {
+        atomic_store(&writer_running, true);
+        // Write out whatever is still queued when the process exits
+        if (!exit_hook_set) {
+            atexit(stop_writer);
+            exit_hook_set = true;
+        }
+    } else {
+        fprintf(stderr, "Failed to start log writer thread\n");
+    }
+    pthread_mutex_unlock(&writer_lock);
+}
+#endif
+
 int init_logger(const char *filename) {
+    // Queued messages belong to the previous destination
+    close_logger();
+
     // If NULL, use stdout
     if (!filename) {
         log_file = stdout;
         is_stdout = 1;
         return 0;
     }
-    
+
     log_file = fopen(filename, "a");
     if (!log_file) {
         fprintf(stderr, "Failed to open log file: %s\n", filename);
         return -1;
     }
-    
+
     is_stdout = 0;
     return 0;
 }
 
 void close_logger(void) {
+    #ifdef _DEBUG
+    stop_writer();
+    #endif
+
     if (log_file && !is_stdout) {
         fclose(log_file);
-        log_file = NULL;
     }
+    log_file = NULL;
 }
 
 void set_log_level(LogLevel level) {
@@ -49,48 +232,51 @@ void log_message(LogLevel level, const char *format, ...) {
     if (level < current_log_level) {
         return;
     }
-    
-    // If logger is not initialized, initialize with stdout
-    if (!log_file) {
-        init_logger(NULL);
-    }
-    
-    // Get current time
-    time_t now = time(NULL);
-    struct tm *time_info = localtime(&now);
-    char time_str[20];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", time_info);
-    
-    // Level as string
-    const char *level_str;
-    switch (level) {
-        case LOG_DEBUG:
-            level_str = "DEBUG";
-            break;
-        case LOG_INFO:
-            level_str = "INFO";
-            break;
-        case LOG_WARNING:
-            level_str = "WARNING";
-            break;
-        case LOG_ERROR:
-            level_str = "ERROR";
-            break;
-        default:
-            level_str = "UNKNOWN";
+
+    // The writer thread (and with it the default stdout destination) starts on first use
+    if (!atomic_load_explicit(&writer_running, memory_order_acquire)) {
+        start_writer();
+        if (!atomic_load(&writer_running)) {
+            return;
+        }
+    }
+
+    // Claim a free slot; a slot still holding an unwritten record means the ring is full
+    LogRecord *record;
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        record = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
     }
-    
-    // Print timestamp and level
-    fprintf(log_file, "[%s] [%s] ", time_str, level_str);
-    
-    // Print formatted message
+
+    record->time = time(NULL);
+    record->level = level;
     va_list args;
     va_start(args, format);
-    vfprintf(log_file, format, args);
+    vsnprintf(record->message, sizeof(record->message), format, args);
     va_end(args);
-    
-    // Add newline and flush
-    fprintf(log_file, "\n");
-    fflush(log_file);
+    atomic_store_explicit(&record->sequence, pos + 1, memory_order_release);
+
+    // Only ring the doorbell if the writer went to sleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&writer_waiting, memory_order_relaxed) &&
+        atomic_exchange(&writer_waiting, false)) {
+        wake_writer();
+    }
+    #else
+    (void)level;
+    (void)format;
     #endif
 }
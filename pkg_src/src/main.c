@@ -35,8 +35,8 @@ void on_message(struct mosquitto* mosq, void* userdata, const struct mosquitto_m
             #ifdef _DEBUG_MODE
             printf("Received message on custom topic %s: %.*s\n",message->topic, message->payloadlen, (char*)message->payload);
             #endif
-            if (strcmp(message->topic,)){
-
+            if (strcmp(message->topic, IPMON_ACTION_TOPIC) == 0) {
+                ipmon_handle_action((const char *)message->payload, (size_t)message->payloadlen);
             }
             break;
         }
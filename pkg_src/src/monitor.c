@@ -5,151 +5,385 @@
 
 #include "../include/monitor.h"
 #include "../include/logger.h"
+#include "../include/icmp.h"
+#include "../include/probe_engine.h"
+#include "../include/resolver.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <netinet/ip_icmp.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 #include <errno.h>
-#include <sys/time.h>
-#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
 #include <signal.h>
-#include <pthread.h>
+#include <stdatomic.h>
 
-#define PACKET_SIZE 64
 #define MAX_WAIT_TIME 5 /* seconds */
-#define FAILED_THRESHOLD 3
 
-typedef struct {
-    MonitoredIP *ip;
-    Monitor *monitor;
-} ThreadArgs;
+static atomic_uint probe_sequence;
+
+static int64_t monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
 
-// Utility function to calculate checksum for ICMP packet
-static unsigned short calculate_checksum(unsigned short *addr, int len) {
-    int nleft = len;
-    int sum = 0;
-    unsigned short *w = addr;
-    unsigned short answer = 0;
+int check_ip(const char *ip_address, int timeout) {
+    struct in6_addr target;
+    struct sockaddr_storage addr;
+    IcmpSocket sock;
+    struct timespec start;
 
-    while (nleft > 1) {
-        sum += *w++;
-        nleft -= 2;
+    if (timeout <= 0) {
+        timeout = MAX_WAIT_TIME * 1000;
     }
 
-    if (nleft == 1) {
-        *(unsigned char *)(&answer) = *(unsigned char *)w;
-        sum += answer;
+    int family = icmp_resolve(ip_address, &target);
+    if (family < 0) {
+        return -1;
     }
+    socklen_t addr_len = icmp_sockaddr(&target, &addr);
 
-    sum = (sum >> 16) + (sum & 0xFFFF);
-    sum += (sum >> 16);
-    answer = ~sum;
-    return answer;
-}
+    if (icmp_open(&sock, family) != 0) {
+        return -1;
+    }
 
-int check_ip(const char *ip_address, int timeout) {
-    FILE *fp;
-    char command[256];
-    char output[1024];
-    struct timeval start, end;
-    long rtt_ms = -1;
-    
-    // Create ping command with timeout
-    snprintf(command, sizeof(command), "ping -c 1 -W %d %s 2>&1", 
-             (timeout + 999) / 1000,  // Convert milliseconds to seconds, rounding up
-             ip_address);
-    
-    // Record start time
-    gettimeofday(&start, NULL);
-    
-    // Execute ping command
-    fp = popen(command, "r");
-    if (fp == NULL) {
-        log_message(LOG_ERROR, "Failed to execute ping command: %s", strerror(errno));
+    unsigned int next = atomic_fetch_add(&probe_sequence, 1);
+    uint16_t sequence = (uint16_t)next;
+    uint32_t cookie = (uint32_t)rand() ^ next;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (icmp_send_echo(&sock, (const struct sockaddr *)&addr, addr_len, sequence, cookie) != 0) {
+        icmp_close(&sock);
+        log_message(LOG_DEBUG, "Ping to %s failed", ip_address);
         return -1;
     }
-    
-    // Read output
-    size_t output_len = 0;
-    while (fgets(output + output_len, sizeof(output) - output_len, fp) != NULL) {
-        output_len = strlen(output);
-        if (output_len >= sizeof(output) - 1)
+
+    // Wait for the matching reply, ignoring replies meant for other probes
+    long rtt_us = -1;
+    long remaining;
+    while (rtt_us < 0 && (remaining = timeout - elapsed_ms(&start)) > 0) {
+        struct pollfd pfd = { sock.fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, (int)remaining);
+        if (ready < 0 && errno != EINTR) {
+            log_message(LOG_ERROR, "Failed to wait for ICMP reply: %s", strerror(errno));
+            break;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        IcmpReply reply;
+        int rc;
+        while ((rc = icmp_recv_reply(&sock, &reply)) > 0) {
+            if (reply.sequence == sequence && reply.cookie == cookie &&
+                IN6_ARE_ADDR_EQUAL(&reply.from, &target)) {
+                rtt_us = icmp_rtt_us(&reply);
+                break;
+            }
+        }
+        if (rc < 0) {
             break;
+        }
+    }
+    icmp_close(&sock);
+
+    if (rtt_us < 0) {
+        log_message(LOG_DEBUG, "Ping to %s failed", ip_address);
+        return -1;
+    }
+
+    log_message(LOG_DEBUG, "Ping to %s successful, time: %.3f ms", ip_address, rtt_us / 1000.0);
+    return (int)rtt_us;
+}
+
+// In change mode only edges, RTT shifts beyond the threshold and keep-alives go out
+static bool should_publish(const IPStore *store, int index, IPStatus previous, const ProbeResult *result) {
+    if (store->publish_mode[index] != PUBLISH_CHANGE || result->status != previous) {
+        return true;
     }
     
-    // Record end time
-    gettimeofday(&end, NULL);
+    int32_t threshold = store->rtt_threshold_us[index];
+    int32_t published = store->published_rtt_us[index];
+    if (threshold > 0 && result->rtt_us >= 0 && published >= 0 &&
+        abs(result->rtt_us - published) >= threshold) {
+        return true;
+    }
     
-    // Close command pipe
-    int status = pclose(fp);
+    int32_t keepalive = store->keepalive_ms[index];
+    return keepalive > 0 && result->time_ms - store->published_ms[index] >= keepalive;
+}
+
+// Flap penalty decayed to now, halving every half-life since it was last updated
+static int32_t decayed_penalty(const IPStore *store, int index, int64_t now_ms) {
+    int32_t penalty = store->flap_penalty[index];
+    int64_t age = now_ms - store->flap_ms[index];
+    int half_life = store->status_policy[index].flap_half_life_ms;
+
+    if (penalty <= 0 || age <= 0 || half_life <= 0) {
+        return penalty;
+    }
+    return (int32_t)(penalty * exp2(-(double)age / half_life));
+}
+
+// The rise and fall thresholds settle the status, flap damping decides whether it is reported
+static IPStatus next_status(IPStore *store, int index, bool answered, int64_t now_ms) {
+    const StatusPolicy *policy = &store->status_policy[index];
+    IPStatus settled = (IPStatus)store->settled[index];
+
+    if (answered) {
+        store->failures[index] = 0;
+        if (store->successes[index] < INT32_MAX) {
+            store->successes[index]++;
+        }
+        if (store->successes[index] >= policy->rise) {
+            settled = STATUS_UP;
+        }
+    } else {
+        store->successes[index] = 0;
+        if (store->failures[index] < INT32_MAX) {
+            store->failures[index]++;
+        }
+        if (store->failures[index] >= policy->fall) {
+            settled = STATUS_DOWN;
+        }
+    }
+
+    // Only a change between UP and DOWN is a flap, the first status is not
+    int32_t penalty = decayed_penalty(store, index, now_ms);
+    if (settled != store->settled[index] && store->settled[index] != STATUS_UNKNOWN) {
+        // Capped so a long spell of flapping is forgotten a few half-lives after it ends
+        int64_t ceiling = 2 * (int64_t)policy->flap_suppress;
+        int64_t raised = (int64_t)penalty + policy->flap_penalty;
+        penalty = (int32_t)(raised < ceiling ? raised : ceiling);
+    }
+    store->settled[index] = (uint8_t)settled;
+    store->flap_penalty[index] = penalty;
+    store->flap_ms[index] = now_ms;
+
+    if (policy->flap_penalty > 0 &&
+        (penalty >= policy->flap_suppress ||
+         (store->status[index] == STATUS_FLAPPING && penalty >= policy->flap_reuse))) {
+        return STATUS_FLAPPING;
+    }
+    return settled;
+}
+
+void monitor_record_result(Monitor *monitor, int index, long rtt_us) {
+    IPStore *store = &monitor->store;
+    int32_t response_time = rtt_us < 0 ? -1 : (int32_t)rtt_us;
+    time_t now = time(NULL);
+
+    // Update status; readers see either the old or the new record, never a mix
+    ip_store_write_begin(store, index);
+    store->last_checked[index] = now;
+    store->rtt_us[index] = response_time;
+    int64_t now_ms = monotonic_ms();
+    rtt_stats_record(&store->rtt_stats[index], rtt_us, now_ms);
     
-    // Check if ping was successful
-    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-        // Parse time from output if possible
-        char *time_pos = strstr(output, "time=");
-        if (time_pos) {
-            float ping_time;
-            if (sscanf(time_pos, "time=%f", &ping_time) == 1) {
-                rtt_ms = (long)(ping_time);
-            } else {
-                // If we can't parse the time, calculate it from our timestamps
-                rtt_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
-            }
+    IPStatus previous = (IPStatus)store->status[index];
+    store->status[index] = (uint8_t)next_status(store, index, response_time >= 0, now_ms);
+    ip_store_write_end(store, index);
+    
+    if (monitor->on_result) {
+        struct timespec wall;
+        clock_gettime(CLOCK_REALTIME, &wall);
+        // Everything the publisher encodes is captured here, the index may be reused by then
+        ProbeResult result = {
+            .index = (uint32_t)index,
+            .name = store->name[index],
+            .rtt_us = response_time,
+            .family = store->family[index],
+            .status = store->status[index],
+            .time_ms = (int64_t)wall.tv_sec * 1000 + wall.tv_nsec / 1000000,
+        };
+        ip_store_address(store, index, 0, &result.addr);
+        if (should_publish(store, index, previous, &result)) {
+            store->published_rtt_us[index] = result.rtt_us;
+            store->published_ms[index] = result.time_ms;
+            monitor->on_result(monitor->on_result_data, &result);
+        }
+    }
+    
+    // Log outside the write section to keep it short
+    if (store->status[index] != previous) {
+        if (store->status[index] == STATUS_UP) {
+            log_message(LOG_INFO, "IP %s is UP (response time: %.3f ms)", 
+                        ip_store_name(store, index), response_time / 1000.0);
+        } else if (store->status[index] == STATUS_DOWN) {
+            log_message(LOG_WARNING, "IP %s is DOWN (failed %d times)", 
+                        ip_store_name(store, index), store->failures[index]);
         } else {
-            // Calculate time from our timestamps
-            rtt_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+            log_message(LOG_WARNING, "IP %s is FLAPPING (flap penalty %d, last %s)",
+                        ip_store_name(store, index), store->flap_penalty[index],
+                        get_status_string((IPStatus)store->settled[index]));
         }
-        
-        log_message(LOG_DEBUG, "Ping to %s successful, time: %ld ms", ip_address, rtt_ms);
-        return (int)rtt_ms;
+    }
+}
+
+void monitor_record_sweep(Monitor *monitor, int index, uint32_t offset, long rtt_us, bool was_alive) {
+    IPStore *store = &monitor->store;
+    bool alive = rtt_us >= 0;
+    
+    // No RTT statistics: the addresses of a range are unrelated targets, one
+    // histogram and jitter over all of them would describe none
+    ip_store_write_begin(store, index);
+    store->last_checked[index] = time(NULL);
+    
+    IPStatus previous = (IPStatus)store->status[index];
+    if (alive) {
+        store->rtt_us[index] = (int32_t)rtt_us;
+        store->failures[index] = 0;
     } else {
-        log_message(LOG_DEBUG, "Ping to %s failed", ip_address);
+        store->failures[index]++;
+    }
+    if (alive != was_alive) {
+        store->alive_count[index] += alive ? 1 : -1;
+    }
+    
+    // Until one whole sweep went unanswered, silence may just mean not probed yet
+    if (store->alive_count[index] > 0) {
+        store->status[index] = STATUS_UP;
+    } else if (previous != STATUS_UNKNOWN || (uint32_t)store->failures[index] >= store->range_size[index]) {
+        store->status[index] = STATUS_DOWN;
+    }
+    ip_store_write_end(store, index);
+    
+    // Per-address RTT and keep-alive state would cost as much as the addresses themselves
+    if (monitor->on_result && (alive != was_alive || store->publish_mode[index] != PUBLISH_CHANGE)) {
+        struct timespec wall;
+        clock_gettime(CLOCK_REALTIME, &wall);
+        ProbeResult result = {
+            .index = (uint32_t)index,
+            .name = store->name[index],
+            .rtt_us = alive ? (int32_t)rtt_us : -1,
+            .family = store->family[index],
+            .range = true,
+            .status = alive ? STATUS_UP : STATUS_DOWN,
+            .time_ms = (int64_t)wall.tv_sec * 1000 + wall.tv_nsec / 1000000,
+        };
+        ip_store_address(store, index, offset, &result.addr);
+        monitor->on_result(monitor->on_result_data, &result);
+    }
+    
+    if (store->status[index] != previous) {
+        if (store->status[index] == STATUS_UP) {
+            log_message(LOG_INFO, "Range %s is UP (%u of %u addresses answering)",
+                        ip_store_name(store, index), store->alive_count[index], store->range_size[index]);
+        } else {
+            log_message(LOG_WARNING, "Range %s is DOWN (no address answering)", ip_store_name(store, index));
+        }
+    }
+}
+
+typedef struct {
+    Monitor *monitor;
+    MonitorResultCallback callback;
+    void *user_data;
+} ResultCallbackChange;
+
+static void swap_result_callback(void *arg) {
+    ResultCallbackChange *change = (ResultCallbackChange *)arg;
+    change->monitor->on_result = change->callback;
+    change->monitor->on_result_data = change->user_data;
+}
+
+void monitor_set_result_callback(Monitor *monitor, MonitorResultCallback callback, void *user_data) {
+    if (!monitor) {
+        return;
+    }
+    
+    // Swap on the engine thread so a result is never paired with the wrong user data
+    ResultCallbackChange change = { monitor, callback, user_data };
+    if (monitor->engine) {
+        probe_engine_call(monitor->engine, swap_result_callback, &change);
+    } else {
+        swap_result_callback(&change);
+    }
+}
+
+int monitor_get_ip(const Monitor *monitor, int index, MonitoredIP *ip) {
+    if (!monitor || !ip || index < 0) {
         return -1;
     }
+    
+    const IPStore *store = &monitor->store;
+    pthread_rwlock_t *layout_lock = (pthread_rwlock_t *)&store->layout_lock;
+    pthread_rwlock_rdlock(layout_lock);
+    if (index >= store->count || store->status[index] == IP_STORE_REMOVED) {
+        pthread_rwlock_unlock(layout_lock);
+        return -1;
+    }
+    
+    unsigned int seq;
+    do {
+        seq = ip_store_read_begin(store, index);
+        ip->status = (IPStatus)store->status[index];
+        ip->last_checked = store->last_checked[index];
+        ip->response_time_us = store->rtt_us[index];
+        ip->failures = store->failures[index];
+        ip->successes = store->successes[index];
+        ip->flap_penalty = store->flap_penalty[index];
+        ip->alive_count = store->alive_count[index];
+    } while (ip_store_read_retry(store, index, seq));
+    
+    ip->ip_address = ip_store_name(store, index);
+    ip->is_active = store->active[index];
+    ip->interval = store->interval_ms[index] / 1000;
+    ip->interval_ms = store->interval_ms[index];
+    ip->min_interval_ms = store->min_interval_ms[index];
+    ip->max_interval_ms = store->max_interval_ms[index];
+    ip->timeout = store->timeout_ms[index];
+    ip->probe_type = (ProbeType)store->probe_type[index];
+    ip->port = store->port[index];
+    ip->range_size = store->range_size[index];
+    pthread_rwlock_unlock(layout_lock);
+    return 0;
 }
 
-static void *monitor_ip_thread(void *arg) {
-    ThreadArgs *args = (ThreadArgs *)arg;
-    MonitoredIP *ip = args->ip;
-    Monitor *monitor = args->monitor;
-    free(args);
+int monitor_get_rtt_stats(const Monitor *monitor, int index, RttSummary *summary) {
+    if (!monitor || !summary || index < 0) {
+        return -1;
+    }
+    
+    const IPStore *store = &monitor->store;
+    pthread_rwlock_t *layout_lock = (pthread_rwlock_t *)&store->layout_lock;
+    pthread_rwlock_rdlock(layout_lock);
+    if (index >= store->count || store->status[index] == IP_STORE_REMOVED) {
+        pthread_rwlock_unlock(layout_lock);
+        return -1;
+    }
+    
+    // Ranges record no samples (see monitor_record_sweep()) and summarize as empty.
+    // Copy under the seqlock, the percentiles are worked out without holding anything
+    RttStats stats;
+    unsigned int seq;
+    do {
+        seq = ip_store_read_begin(store, index);
+        memcpy(&stats, &store->rtt_stats[index], sizeof(stats));
+    } while (ip_store_read_retry(store, index, seq));
+    pthread_rwlock_unlock(layout_lock);
+    
+    rtt_stats_summarize(&stats, monotonic_ms(), summary);
+    return 0;
+}
 
-    while (monitor->running && ip->is_active) {
-        // Check the IP address
-        int response_time = check_ip(ip->ip_address, ip->timeout);
-        
-        // Update status
-        ip->last_checked = time(NULL);
-        ip->response_time_ms = response_time;
-        
-        if (response_time >= 0) {
-            if (ip->status != STATUS_UP) {
-                log_message(LOG_INFO, "IP %s is UP (response time: %d ms)", 
-                            ip->ip_address, response_time);
-            }
-            ip->status = STATUS_UP;
-            ip->failures = 0;
-        } else {
-            ip->failures++;
-            if (ip->failures >= FAILED_THRESHOLD) {
-                if (ip->status != STATUS_DOWN) {
-                    log_message(LOG_WARNING, "IP %s is DOWN (failed %d times)", 
-                                ip->ip_address, ip->failures);
-                }
-                ip->status = STATUS_DOWN;
-            }
-        }
-        
-        // Sleep for the configured interval
-        sleep(ip->interval);
+int monitor_find_by_status(const Monitor *monitor, IPStatus status, int *indices, int max) {
+    if (!monitor) {
+        return 0;
     }
     
-    return NULL;
+    return ip_store_find_status(&monitor->store, (uint8_t)status, indices, max);
 }
 
 Monitor* init_monitor(Config *config) {
@@ -164,9 +398,7 @@ Monitor* init_monitor(Config *config) {
         return NULL;
     }
     
-    monitor->ip_count = config->ip_count;
-    monitor->ips = (MonitoredIP *)malloc(config->ip_count * sizeof(MonitoredIP));
-    if (!monitor->ips) {
+    if (ip_store_init(&monitor->store, config->ip_count) != 0) {
         log_message(LOG_ERROR, "Memory allocation failed for monitored IPs");
         free(monitor);
         return NULL;
@@ -174,17 +406,21 @@ Monitor* init_monitor(Config *config) {
     
     // Initialize each monitored IP
     for (int i = 0; i < config->ip_count; i++) {
-        monitor->ips[i].ip_address = strdup(config->ips[i].ip_address);
-        monitor->ips[i].status = STATUS_UNKNOWN;
-        monitor->ips[i].last_checked = 0;
-        monitor->ips[i].response_time_ms = -1;
-        monitor->ips[i].failures = 0;
-        monitor->ips[i].is_active = config->ips[i].is_active;
-        monitor->ips[i].interval = config->ips[i].interval;
-        monitor->ips[i].timeout = config->ips[i].timeout;
+        if (ip_store_add(&monitor->store, &config->ips[i]) < 0) {
+            log_message(LOG_ERROR, "Failed to add IP %s to the monitor", config->ips[i].ip_address);
+            ip_store_free(&monitor->store);
+            free(monitor);
+            return NULL;
+        }
     }
     
+    monitor->ip_count = monitor->store.count;
     monitor->running = false;
+    monitor->engine = NULL;
+    monitor->resolver = NULL;
+    monitor->on_result = NULL;
+    monitor->on_result_data = NULL;
+    monitor->rate_limits = config->rate_limits;
     
     return monitor;
 }
@@ -194,61 +430,214 @@ void free_monitor(Monitor *monitor) {
         return;
     }
     
-    if (monitor->ips) {
-        for (int i = 0; i < monitor->ip_count; i++) {
-            free(monitor->ips[i].ip_address);
-        }
-        free(monitor->ips);
-    }
-    
+    stop_monitoring(monitor);
+    ip_store_free(&monitor->store);
     free(monitor);
 }
 
 int start_monitoring(Monitor *monitor) {
-    if (!monitor || !monitor->ips) {
+    if (!monitor || monitor->ip_count <= 0) {
         log_message(LOG_ERROR, "Invalid monitor for starting");
         return -1;
     }
     
+    for (int i = 0; i < monitor->ip_count; i++) {
+        if (!monitor->store.active[i] && monitor->store.status[i] != IP_STORE_REMOVED) {
+            log_message(LOG_INFO, "Skipping inactive IP: %s", ip_store_name(&monitor->store, i));
+        }
+    }
+    
+    // All IPs share one event-loop thread and one ICMP socket
+    monitor->engine = probe_engine_create(monitor);
+    if (!monitor->engine) {
+        log_message(LOG_ERROR, "Failed to create probe engine");
+        return -1;
+    }
+    
     monitor->running = true;
-    pthread_t *threads = (pthread_t *)malloc(monitor->ip_count * sizeof(pthread_t));
-    if (!threads) {
-        log_message(LOG_ERROR, "Memory allocation failed for threads");
+    if (probe_engine_start(monitor->engine) != 0) {
+        monitor->running = false;
+        probe_engine_free(monitor->engine);
+        monitor->engine = NULL;
         return -1;
     }
     
-    // Create a thread for each IP
-    for (int i = 0; i < monitor->ip_count; i++) {
-        if (!monitor->ips[i].is_active) {
-            log_message(LOG_INFO, "Skipping inactive IP: %s", monitor->ips[i].ip_address);
+    // Host names keep being looked up, off the engine thread
+    monitor->resolver = resolver_create(monitor);
+    if (!monitor->resolver) {
+        log_message(LOG_WARNING, "Failed to start resolver, host names will not be looked up again");
+    }
+    
+    return 0;
+}
+
+typedef struct {
+    Monitor *monitor;       // Monitor to update
+    const Config *config;   // Configuration to converge to
+    const IPStoreAddress *addresses; // Address of each config entry that was not in the store
+    const uint8_t *resolved; // Whether addresses holds the entry's address
+    int added;              // Number of IPs added
+    int updated;            // Number of IPs whose settings changed
+    int removed;            // Number of IPs removed
+    int result;             // 0 on success, -1 if some IP could not be added
+} ConfigChange;
+
+static void refresh_target(Monitor *monitor, int index, bool reset) {
+    if (monitor->engine) {
+        probe_engine_refresh(monitor->engine, index, reset);
+    }
+}
+
+static void apply_config_change(void *arg) {
+    ConfigChange *change = (ConfigChange *)arg;
+    Monitor *monitor = change->monitor;
+    const Config *config = change->config;
+    IPStore *store = &monitor->store;
+    int previous_count = store->count;
+    
+    monitor->rate_limits = config->rate_limits;
+    if (monitor->engine) {
+        probe_engine_set_rate_limits(monitor->engine, &monitor->rate_limits);
+    }
+    
+    uint8_t *seen = (uint8_t *)calloc(previous_count > 0 ? previous_count : 1, sizeof(uint8_t));
+    if (!seen) {
+        log_message(LOG_ERROR, "Memory allocation failed for configuration update");
+        change->result = -1;
+        return;
+    }
+    
+    for (int i = 0; i < config->ip_count; i++) {
+        const IPConfig *ip = &config->ips[i];
+        int index = ip_store_find(store, ip->ip_address);
+        
+        if (index < 0) {
+            // Names are resolved by monitor_apply_config(), a lookup here would stall every probe
+            if (!change->resolved[i]) {
+                change->result = -1;
+                continue;
+            }
+            index = ip_store_add_resolved(store, ip, &change->addresses[i]);
+            if (index < 0) {
+                log_message(LOG_ERROR, "Failed to add IP %s to the monitor", ip->ip_address);
+                change->result = -1;
+                continue;
+            }
+            if (index < previous_count) {
+                seen[index] = 1;
+            }
+            refresh_target(monitor, index, true);
+            change->added++;
             continue;
         }
         
-        ThreadArgs *args = (ThreadArgs *)malloc(sizeof(ThreadArgs));
-        if (!args) {
-            log_message(LOG_ERROR, "Memory allocation failed for thread arguments");
-            free(threads);
-            return -1;
+        if (index < previous_count) {
+            seen[index] = 1;
         }
-        
-        args->ip = &monitor->ips[i];
-        args->monitor = monitor;
-        
-        int result = pthread_create(&threads[i], NULL, monitor_ip_thread, args);
-        if (result != 0) {
-            log_message(LOG_ERROR, "Failed to create thread for IP %s: %s", 
-                      monitor->ips[i].ip_address, strerror(result));
-            free(args);
-            free(threads);
-            return -1;
+        // A host name that did not resolve before was looked up again
+        bool readdressed = change->resolved[i] && ip_store_set_address(store, index, &change->addresses[i]);
+        int32_t min_interval_ms, max_interval_ms;
+        ip_store_interval_bounds(ip, &min_interval_ms, &max_interval_ms);
+        // Ranges are always swept with ICMP, whatever their configured type
+        bool reprobe = readdressed || (!store->range_size[index] &&
+                       (store->probe_type[index] != ip->probe_type || store->port[index] != ip->port));
+        if (!reprobe &&
+            store->active[index] == ip->is_active &&
+            store->interval_ms[index] == ip->interval_ms &&
+            store->min_interval_ms[index] == min_interval_ms &&
+            store->max_interval_ms[index] == max_interval_ms &&
+            store->timeout_ms[index] == ip->timeout &&
+            store->publish_mode[index] == ip->publish_mode &&
+            store->rtt_threshold_us[index] == ip->rtt_threshold_ms * 1000 &&
+            store->keepalive_ms[index] == ip->keepalive_ms &&
+            memcmp(&store->status_policy[index], &ip->status_policy, sizeof(StatusPolicy)) == 0) {
+            continue;
         }
         
-        // Detach the thread so we don't need to join it
-        pthread_detach(threads[i]);
+        // Status history is kept, only the probe settings change
+        store->active[index] = ip->is_active;
+        store->interval_ms[index] = ip->interval_ms;
+        store->min_interval_ms[index] = min_interval_ms;
+        store->max_interval_ms[index] = max_interval_ms;
+        store->timeout_ms[index] = ip->timeout;
+        store->publish_mode[index] = (uint8_t)ip->publish_mode;
+        store->rtt_threshold_us[index] = ip->rtt_threshold_ms * 1000;
+        store->keepalive_ms[index] = ip->keepalive_ms;
+        store->status_policy[index] = ip->status_policy;
+        if (reprobe) {
+            // A probe in flight of the old type must not be taken for one of the new
+            store->probe_type[index] = (uint8_t)ip->probe_type;
+            store->port[index] = (uint16_t)ip->port;
+        }
+        refresh_target(monitor, index, reprobe);
+        change->updated++;
     }
     
-    free(threads);
-    return 0;
+    for (int i = 0; i < previous_count; i++) {
+        if (!seen[i] && store->status[i] != IP_STORE_REMOVED) {
+            ip_store_remove(store, i);
+            refresh_target(monitor, i, false);
+            change->removed++;
+        }
+    }
+    
+    monitor->ip_count = store->count;
+    free(seen);
+}
+
+int monitor_apply_config(Monitor *monitor, const Config *config) {
+    if (!monitor || !config || (config->ip_count > 0 && !config->ips)) {
+        log_message(LOG_ERROR, "Invalid configuration for monitor update");
+        return -1;
+    }
+    
+    int count = config->ip_count > 0 ? config->ip_count : 1;
+    IPStoreAddress *addresses = (IPStoreAddress *)malloc(count * sizeof(IPStoreAddress));
+    uint8_t *resolved = (uint8_t *)calloc(count, sizeof(uint8_t));
+    if (!addresses || !resolved) {
+        log_message(LOG_ERROR, "Memory allocation failed for configuration update");
+        free(addresses);
+        free(resolved);
+        return -1;
+    }
+    
+    // Resolve new IPs here, on the caller's thread, before the engine thread takes over.
+    // Host names that did not resolve before get another try.
+    IPStore *store = &monitor->store;
+    for (int i = 0; i < config->ip_count; i++) {
+        bool known = false;
+        pthread_rwlock_rdlock(&store->layout_lock);
+        int index = ip_store_find(store, config->ips[i].ip_address);
+        if (index >= 0) {
+            unsigned int seq;
+            do {
+                seq = ip_store_read_begin(store, index);
+                known = !store->host_name[index] || store->family[index] != AF_UNSPEC;
+            } while (ip_store_read_retry(store, index, seq));
+        }
+        pthread_rwlock_unlock(&store->layout_lock);
+        if (known) {
+            continue;
+        }
+        if (ip_store_resolve(config->ips[i].ip_address, &addresses[i]) == 0) {
+            resolved[i] = 1;
+        } else {
+            log_message(LOG_ERROR, "Failed to add IP %s to the monitor", config->ips[i].ip_address);
+        }
+    }
+    
+    ConfigChange change = { .monitor = monitor, .config = config, .addresses = addresses, .resolved = resolved };
+    if (monitor->engine) {
+        probe_engine_call(monitor->engine, apply_config_change, &change);
+    } else {
+        apply_config_change(&change);
+    }
+    free(addresses);
+    free(resolved);
+    
+    log_message(LOG_INFO, "Configuration applied: %d added, %d updated, %d removed",
+                change.added, change.updated, change.removed);
+    return change.result;
 }
 
 void stop_monitoring(Monitor *monitor) {
@@ -256,11 +645,16 @@ void stop_monitoring(Monitor *monitor) {
         return;
     }
     
-    // Set the running flag to false to stop all threads
-    monitor->running = false;
+    // The resolver hands its changes to the engine thread, so it goes first
+    resolver_free(monitor->resolver);
+    monitor->resolver = NULL;
     
-    // Give threads time to clean up
-    sleep(1);
+    // Clear the running flag, then wake the engine and wait for it to exit
+    monitor->running = false;
+    if (monitor->engine) {
+        probe_engine_free(monitor->engine);
+        monitor->engine = NULL;
+    }
 }
 
 const char* get_status_string(IPStatus status) {
@@ -271,23 +665,30 @@ const char* get_status_string(IPStatus status) {
             return "UP";
         case STATUS_DOWN:
             return "DOWN";
+        case STATUS_FLAPPING:
+            return "FLAPPING";
         default:
             return "INVALID";
     }
 }
 
 void display_status(Monitor *monitor) {
-    if (!monitor || !monitor->ips) {
+    if (!monitor || monitor->ip_count <= 0) {
         printf("No IPs being monitored\n");
         return;
     }
     
     printf("\n=== IP Monitoring Status ===\n");
-    printf("%-20s %-10s %-15s %-20s\n", "IP Address", "Status", "Response Time", "Last Checked");
-    printf("----------------------------------------------------------------\n");
+    printf("%-20s %-10s %-15s %-12s %-7s %-20s\n",
+           "IP Address", "Status", "Response Time", "p95", "Loss", "Last Checked");
+    printf("--------------------------------------------------------------------------------------------\n");
     
     for (int i = 0; i < monitor->ip_count; i++) {
-        MonitoredIP *ip = &monitor->ips[i];
+        MonitoredIP snapshot;
+        MonitoredIP *ip = &snapshot;
+        if (monitor_get_ip(monitor, i, ip) != 0) {
+            continue;
+        }
         
         char time_str[30] = "Never";
         if (ip->last_checked > 0) {
@@ -295,20 +696,34 @@ void display_status(Monitor *monitor) {
             strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", time_info);
         }
         
-        char response_str[20];
-        if (ip->status == STATUS_UP) {
-            snprintf(response_str, sizeof(response_str), "%d ms", ip->response_time_ms);
+        char response_str[32];
+        if (ip->range_size) {
+            snprintf(response_str, sizeof(response_str), "%u/%u alive", ip->alive_count, ip->range_size);
+        } else if (ip->status == STATUS_UP) {
+            snprintf(response_str, sizeof(response_str), "%.3f ms", ip->response_time_us / 1000.0);
         } else {
             strcpy(response_str, "N/A");
         }
         
-        printf("%-20s %-10s %-15s %-20s%s\n", 
+        char p95_str[20] = "N/A";
+        char loss_str[12] = "N/A";
+        RttSummary rtt;
+        if (monitor_get_rtt_stats(monitor, i, &rtt) == 0 && rtt.probes) {
+            if (rtt.replies) {
+                snprintf(p95_str, sizeof(p95_str), "%.3f ms", rtt.p95_us / 1000.0);
+            }
+            snprintf(loss_str, sizeof(loss_str), "%.0f%%", rtt.loss_percent);
+        }
+        
+        printf("%-20s %-10s %-15s %-12s %-7s %-20s%s\n", 
                ip->ip_address, 
                get_status_string(ip->status), 
                response_str,
+               p95_str,
+               loss_str,
                time_str,
                ip->is_active ? "" : " (inactive)");
     }
     
-    printf("----------------------------------------------------------------\n");
+    printf("--------------------------------------------------------------------------------------------\n");
 }
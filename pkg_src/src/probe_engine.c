@@ -0,0 +1,1181 @@
+/**
+ * @file probe_engine.c
+ * @brief Implementation of the event-loop probe engine
+ *
+ * A single thread owns one ICMP and one ICMPv6 socket and an epoll instance.
+ * Every target is a small slot holding its deadlines, while addresses and
+ * status live in the monitor's IPStore. Replies are matched back to their
+ * slot through the cookie (slot index) and sequence number carried in the
+ * echo request. Deadlines live in a min-heap and a timerfd armed on the
+ * earliest one wakes the loop exactly when it is due.
+ * All probes due in one wakeup leave in sendmmsg() batches and replies are
+ * drained with recvmmsg(), so syscalls are paid per batch, not per probe.
+ *
+ * A CIDR block or address range is one slot that walks its addresses with
+ * a cursor, a few at a time, so that each is probed once per interval. Two
+ * bitmaps stand in for per-address state: "seen" marks addresses that
+ * answered since their last probe and "alive" those that answered the one
+ * before. An address still unseen when the cursor comes back to it missed
+ * its reply, so ranges need no per-probe timeouts. The echo sequence is the
+ * sweep number, which tells late replies from a previous sweep apart.
+ *
+ * A single address whose configuration gives interval bounds adapts its
+ * interval: every ENGINE_ADAPT_STREAK replies in a row double it up to the
+ * longest interval, and a failure drops it to the shortest one until the
+ * target answers again or its fall threshold of failures confirms it DOWN,
+ * after which it is probed at its configured interval. Replies short of the
+ * rise threshold likewise come at the shortest interval to confirm the
+ * target UP. Ranges keep their pace.
+ *
+ * Probes also pass the configured rate limits (see rate_limit.h) as they
+ * fall due, the subnet bucket first and the global one second. A probe that
+ * does not fit reserves its tokens for a later time and its slot sleeps
+ * until then, so a backlog drains at the limited rate, one wakeup per
+ * reserved time rather than one per probe and token.
+ *
+ * A request may wait in its batch for a while before sendmmsg() gets to it,
+ * longer than a LAN round trip. Where the kernel supports it, every request
+ * is therefore timestamped as it leaves: the timestamp comes back on the
+ * socket's error queue with the request, whose tag indexes a ring of recent
+ * transmit times. Replies are timed from that entry, and from the time the
+ * request was built when the entry is missing or was overwritten.
+ *
+ * Targets probed another way than ICMP echo (see probe_type.h) each open a
+ * non-blocking socket per probe, registered in the same epoll set with the
+ * slot index and probe sequence as its event data. Their sockets are served
+ * by the same loop as the ICMP ones and closed when the probe completes or
+ * times out, so such a target holds a descriptor only while a probe is out.
+ */
+
+#define _GNU_SOURCE
+
+#include "../include/probe_engine.h"
+#include "../include/icmp.h"
+#include "../include/scheduler.h"
+#include "../include/rate_limit.h"
+#include "../include/probe_type.h"
+#include "../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#define ENGINE_MAX_EVENTS 16
+#define ENGINE_BATCH 256            // Probes per sendmmsg()/recvmmsg() call
+#define ENGINE_RX_SIZE 256          // Echo replies are small, larger datagrams are truncated
+#define ENGINE_CONTROL_SIZE 128     // Room for a timestamp and an extended error
+#define ENGINE_TX_STAMPS 65536      // Transmit times kept for timing replies, a power of two
+#define ENGINE_SOCKET_BUFFER (4 * 1024 * 1024)
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+#define ENGINE_SWEEP_TICK_NS NSEC_PER_MSEC  // Shortest gap between two bursts of a range
+#define ENGINE_ADAPT_STREAK 8           // Replies in a row that double an adaptive interval
+#define ENGINE_SESSION_EVENT (1ULL << 63)  // Marks the epoll data of a probe socket, sequence << 32 | index
+
+typedef struct {
+    uint64_t *seen;             // Addresses that answered since their last probe
+    uint64_t *alive;            // Addresses that answered the probe before
+    uint32_t first;             // First address in host byte order
+    uint32_t count;             // Number of addresses
+    uint32_t cursor;            // Offset of the next address to probe
+    uint32_t burst;             // Addresses probed per wakeup
+    uint64_t step_ns;           // Time between two bursts
+    bool warm;                  // Whether every address has been probed once
+} RangeSweep;
+
+typedef enum {
+    PACE_NONE,                  // No tokens reserved
+    PACE_SUBNET,                // Subnet token reserved, the global one still to be
+    PACE_READY                  // All tokens reserved, the probe leaves at paced_ns
+} PaceStage;
+
+typedef struct {
+    uint64_t next_send_ns;      // Deadline of the next probe
+    uint64_t timeout_ns;        // Deadline of the outstanding probe, 0 if none
+    uint64_t period_ns;         // Current interval of a single address, within its bounds
+    uint64_t paced_ns;          // Time the rate limits hold the due probe back to, 0 if not held
+    uint16_t sequence;          // Sequence number of the last probe sent, sweep number of a range
+    uint16_t streak;            // Replies in a row since the interval last grew
+    uint8_t pace;               // PaceStage of the due probe
+    RangeSweep *sweep;          // Enumeration state of a range, NULL for a single address
+    ProbeSession *session;      // Probe of a type other than ICMP, NULL until the first one
+} ProbeSlot;
+
+typedef struct {
+    struct mmsghdr msgs[ENGINE_BATCH];
+    struct iovec iov[ENGINE_BATCH];
+    uint32_t ids[ENGINE_BATCH];
+    struct sockaddr_storage dest[ENGINE_BATCH];
+    uint8_t packets[ENGINE_BATCH][PACKET_SIZE];
+    int count;
+} TxBatch;
+
+typedef struct {
+    struct mmsghdr msgs[ENGINE_BATCH];
+    struct iovec iov[ENGINE_BATCH];
+    struct sockaddr_storage from[ENGINE_BATCH];
+    uint8_t buffers[ENGINE_BATCH][ENGINE_RX_SIZE];
+    uint8_t control[ENGINE_BATCH][ENGINE_CONTROL_SIZE];
+} RxBatch;
+
+typedef struct {
+    uint32_t tag;               // Tag of the request
+    uint64_t sent_ns;           // Monotonic time the request left, 0 if the entry is unused
+} TxStamp;
+
+typedef struct {
+    IcmpSocket sock;            // Socket of one address family, fd -1 if unavailable
+    TxBatch tx;                 // Echo requests waiting for the next sendmmsg()
+} ProbeChannel;
+
+struct ProbeEngine {
+    Monitor *monitor;           // Monitor receiving the results
+    ProbeSlot *slots;           // One slot per monitored IP
+    int slot_count;             // Number of slots in use
+    int slot_capacity;          // Number of slots allocated
+    Scheduler schedule;         // Next deadline of every active slot
+    int epoll_fd;               // Event loop descriptor
+    int wake_fd;                // Eventfd used to interrupt the loop
+    int timer_fd;               // Timerfd armed on the earliest deadline
+    uint64_t timer_deadline;    // Deadline the timer is armed for, 0 if disarmed
+    uint64_t rng_state;         // Xorshift state for start-time jitter
+    pthread_t thread;           // Event-loop thread
+    bool started;               // Whether the thread is running
+    pthread_mutex_t call_lock;  // Protects the cross-thread call below
+    pthread_cond_t call_done;   // Signalled when a call completes
+    void (*call_fn)(void *);    // Function waiting to run on the engine thread
+    void *call_arg;             // Its argument
+    bool call_pending;          // Whether call_fn is waiting to run
+    bool exited;                // Whether the engine thread has left its loop
+    ProbeEngineStats stats;     // Counters, owned by the engine thread
+    ProbeChannel channels[2];   // IPv4 and IPv6 sockets, shared by all targets of the family
+    RxBatch rx;                 // Receive buffers for recvmmsg()
+    TxStamp *tx_stamps;         // Transmit times indexed by tag, NULL without kernel timestamps
+    uint32_t next_tag;          // Tag of the next request
+    RateLimiter limiter;        // Global and per-subnet probe rate limits
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t next_random(ProbeEngine *engine) {
+    uint64_t x = engine->rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    engine->rng_state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t interval_ns(const IPStore *store, uint32_t index) {
+    return (uint64_t)store->interval_ms[index] * NSEC_PER_MSEC;
+}
+
+// Time between two wakeups of a slot, which a range divides among its addresses
+static uint64_t slot_period(const ProbeSlot *slot) {
+    return slot->sweep ? slot->sweep->step_ns : slot->period_ns;
+}
+
+static uint64_t slot_send_time(const ProbeSlot *slot) {
+    return slot->paced_ns ? slot->paced_ns : slot->next_send_ns;
+}
+
+static uint64_t slot_deadline(const ProbeSlot *slot) {
+    uint64_t send = slot_send_time(slot);
+    if (slot->timeout_ns && slot->timeout_ns < send) {
+        return slot->timeout_ns;
+    }
+    return send;
+}
+
+// Whether a due probe may leave now, otherwise it holds tokens for the later time in paced_ns
+static bool pace_probe(ProbeEngine *engine, uint32_t index, uint32_t offset, uint64_t now) {
+    ProbeSlot *slot = &engine->slots[index];
+
+    if (slot->paced_ns > now) {
+        return false;
+    }
+    if (slot->pace == PACE_NONE && engine->limiter.subnet.interval_ns) {
+        struct in6_addr addr;
+        ip_store_address(&engine->monitor->store, (int)index, offset, &addr);
+        slot->paced_ns = rate_limiter_reserve_subnet(&engine->limiter, &addr, now);
+        slot->pace = PACE_SUBNET;
+        if (slot->paced_ns > now) {
+            engine->stats.paced++;
+            return false;
+        }
+    }
+    if (slot->pace != PACE_READY && engine->limiter.global.interval_ns) {
+        slot->paced_ns = rate_limiter_reserve_global(&engine->limiter, now);
+        slot->pace = PACE_READY;
+        if (slot->paced_ns > now) {
+            engine->stats.paced++;
+            return false;
+        }
+    }
+
+    slot->paced_ns = 0;
+    slot->pace = PACE_NONE;
+    return true;
+}
+
+// Only the engine thread writes the status fields, so the counts are read without the seqlock
+static void adapt_period(ProbeEngine *engine, uint32_t index, bool answered, uint64_t now) {
+    const IPStore *store = &engine->monitor->store;
+    ProbeSlot *slot = &engine->slots[index];
+    uint64_t base = interval_ns(store, index);
+    uint64_t shortest = (uint64_t)store->min_interval_ms[index] * NSEC_PER_MSEC;
+    uint64_t longest = (uint64_t)store->max_interval_ms[index] * NSEC_PER_MSEC;
+
+    if (shortest == longest) {
+        return;     // Fixed interval
+    }
+
+    // A fast probe still waits out the timeout of the one before, which would otherwise be cut short
+    uint64_t timeout = (uint64_t)store->timeout_ms[index] * NSEC_PER_MSEC;
+    if (shortest < timeout) {
+        shortest = timeout < base ? timeout : base;
+    }
+
+    const StatusPolicy *policy = &store->status_policy[index];
+    uint64_t period = slot->period_ns;
+    if (!answered) {
+        slot->streak = 0;
+        period = store->failures[index] < policy->fall ? shortest : base;
+    } else if (store->successes[index] < policy->rise) {
+        slot->streak = 0;
+        period = shortest;
+    } else if (period < base) {
+        slot->streak = 0;
+        period = base;
+    } else if (++slot->streak >= ENGINE_ADAPT_STREAK) {
+        slot->streak = 0;
+        period = period * 2 < longest ? period * 2 : longest;
+    }
+    slot->period_ns = period;
+
+    // A shorter interval takes effect now rather than after the probe scheduled under the longer one
+    if (slot->next_send_ns > now + period) {
+        slot->next_send_ns = now + period;
+    }
+}
+
+// Close the socket of a probe in flight, which also takes it out of the epoll set
+static void end_session(ProbeSlot *slot) {
+    ProbeSession *session = slot->session;
+    if (session && session->fd >= 0) {
+        session->ops->complete(session);
+        session->armed = 0;
+    }
+}
+
+static void free_session(ProbeSlot *slot) {
+    end_session(slot);
+    free(slot->session);
+    slot->session = NULL;
+}
+
+static void record_timeout(ProbeEngine *engine, uint32_t index, uint64_t now) {
+    end_session(&engine->slots[index]);
+    engine->stats.timeouts++;
+    monitor_record_result(engine->monitor, (int)index, -1);
+    adapt_period(engine, index, false, now);
+}
+
+static void fail_probe(ProbeEngine *engine, uint32_t index) {
+    ProbeSlot *slot = &engine->slots[index];
+
+    // The address of a range stays unseen and fails when the sweep comes back to it
+    if (slot->sweep) {
+        engine->stats.timeouts++;
+        return;
+    }
+
+    slot->timeout_ns = 0;
+    record_timeout(engine, index, monotonic_ns());
+    scheduler_set(&engine->schedule, index, slot_deadline(slot));
+}
+
+static void flush_channel(ProbeEngine *engine, ProbeChannel *channel) {
+    TxBatch *tx = &channel->tx;
+    int done = 0;
+
+    while (done < tx->count) {
+        int sent = sendmmsg(channel->sock.fd, tx->msgs + done, tx->count - done, 0);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // sendmmsg() reports the error of the first message it could not send
+            log_message(LOG_DEBUG, "Failed to send echo request: %s", strerror(errno));
+            fail_probe(engine, tx->ids[done]);
+            done++;
+            continue;
+        }
+        done += sent;
+        engine->stats.sent += sent;
+    }
+
+    tx->count = 0;
+}
+
+static void flush_probes(ProbeEngine *engine) {
+    flush_channel(engine, &engine->channels[0]);
+    flush_channel(engine, &engine->channels[1]);
+}
+
+static void record_lateness(ProbeEngineStats *stats, uint64_t lateness_ns) {
+    uint64_t lateness_us = lateness_ns / 1000;
+    int bucket = 0;
+
+    while (bucket < PROBE_ENGINE_LATENESS_BUCKETS - 1 && lateness_us >= (1ULL << bucket)) {
+        bucket++;
+    }
+    stats->lateness[bucket]++;
+    stats->lateness_sum_ns += lateness_ns;
+    if (lateness_ns > stats->lateness_max_ns) {
+        stats->lateness_max_ns = lateness_ns;
+    }
+}
+
+// Queue an echo request on the channel of the target's family, false if it cannot be sent
+static bool add_probe(ProbeEngine *engine, uint32_t index, uint32_t offset, uint16_t sequence) {
+    const IPStore *store = &engine->monitor->store;
+    ProbeChannel *channel = &engine->channels[store->family[index] == AF_INET6];
+    TxBatch *tx = &channel->tx;
+    int k = tx->count;
+
+    if (channel->sock.fd < 0 || store->family[index] == AF_UNSPEC) {
+        return false;
+    }
+
+    socklen_t dest_len = ip_store_sockaddr(store, (int)index, offset, &tx->dest[k]);
+    size_t len = icmp_build_echo(&channel->sock, tx->packets[k], sequence, index, engine->next_tag++);
+
+    tx->count++;
+    tx->ids[k] = index;
+    tx->iov[k].iov_base = tx->packets[k];
+    tx->iov[k].iov_len = len;
+    memset(&tx->msgs[k], 0, sizeof(tx->msgs[k]));
+    tx->msgs[k].msg_hdr.msg_name = &tx->dest[k];
+    tx->msgs[k].msg_hdr.msg_namelen = dest_len;
+    tx->msgs[k].msg_hdr.msg_iov = &tx->iov[k];
+    tx->msgs[k].msg_hdr.msg_iovlen = 1;
+
+    if (tx->count == ENGINE_BATCH) {
+        flush_channel(engine, channel);
+    }
+    return true;
+}
+
+static void set_port(struct sockaddr_storage *addr, uint16_t port) {
+    if (addr->ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+    } else {
+        ((struct sockaddr_in *)addr)->sin_port = htons(port);
+    }
+}
+
+// Start a probe of a type other than ICMP on a socket of its own, false if it cannot be sent
+static bool start_session(ProbeEngine *engine, uint32_t index, uint16_t sequence) {
+    const IPStore *store = &engine->monitor->store;
+    ProbeSlot *slot = &engine->slots[index];
+    const ProbeOps *ops = probe_type_ops((ProbeType)store->probe_type[index]);
+    struct sockaddr_storage addr;
+
+    if (!ops || !ops->start) {
+        log_message(LOG_ERROR, "Unknown probe type %d for %s", store->probe_type[index],
+                    ip_store_name(store, (int)index));
+        return false;
+    }
+    socklen_t addr_len = ip_store_sockaddr(store, (int)index, 0, &addr);
+    if (!addr_len) {
+        return false;
+    }
+    if (!slot->session) {
+        slot->session = (ProbeSession *)calloc(1, sizeof(ProbeSession));
+        if (!slot->session) {
+            log_message(LOG_ERROR, "Memory allocation failed for probe session");
+            return false;
+        }
+        slot->session->fd = -1;
+    }
+
+    ProbeSession *session = slot->session;
+    session->ops = ops;
+    session->host = ip_store_name(store, (int)index);
+    session->port = store->port[index] ? store->port[index] : ops->default_port;
+    set_port(&addr, session->port);
+    session->started_ns = monotonic_ns();
+    if (ops->start(session, (const struct sockaddr *)&addr, addr_len) != 0) {
+        return false;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = session->events;
+    ev.data.u64 = ENGINE_SESSION_EVENT | (uint64_t)sequence << 32 | index;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, session->fd, &ev) != 0) {
+        log_message(LOG_ERROR, "Failed to add probe socket to probe engine: %s", strerror(errno));
+        ops->complete(session);
+        return false;
+    }
+    session->armed = session->events;
+    engine->stats.sent++;
+    return true;
+}
+
+static void queue_probe(ProbeEngine *engine, uint32_t index, uint64_t now) {
+    ProbeSlot *slot = &engine->slots[index];
+    const IPStore *store = &engine->monitor->store;
+
+    // A probe still outstanding when the next one is due has timed out
+    if (slot->timeout_ns) {
+        slot->timeout_ns = 0;
+        record_timeout(engine, index, now);
+    }
+
+    record_lateness(&engine->stats, now - slot->next_send_ns);
+
+    uint16_t sequence = ++slot->sequence;
+    bool sent = store->probe_type[index] == PROBE_ICMP ? add_probe(engine, index, 0, sequence)
+                                                        : start_session(engine, index, sequence);
+    if (!sent) {
+        record_timeout(engine, index, now);
+    } else {
+        slot->timeout_ns = now + (uint64_t)store->timeout_ms[index] * NSEC_PER_MSEC;
+    }
+
+    // Keep the cadence anchored to the schedule rather than to the send time
+    uint64_t interval = slot->period_ns;
+    slot->next_send_ns += interval;
+    if (slot->next_send_ns <= now) {
+        slot->next_send_ns = now + interval;
+    }
+}
+
+static void queue_sweep(ProbeEngine *engine, uint32_t index, uint64_t now) {
+    ProbeSlot *slot = &engine->slots[index];
+    RangeSweep *sweep = slot->sweep;
+    bool due = now >= slot->next_send_ns;
+
+    // A wakeup for tokens reserved earlier catches up on the burst the rate limits cut short
+    if (due) {
+        record_lateness(&engine->stats, now - slot->next_send_ns);
+    }
+
+    for (uint32_t i = 0; i < sweep->burst; i++) {
+        if (!pace_probe(engine, index, sweep->cursor, now)) {
+            break;
+        }
+        uint32_t offset = sweep->cursor;
+        uint64_t bit = 1ULL << (offset & 63);
+        uint64_t *seen = &sweep->seen[offset >> 6];
+        uint64_t *alive = &sweep->alive[offset >> 6];
+
+        if (sweep->warm && !(*seen & bit)) {
+            bool was_alive = (*alive & bit) != 0;
+            *alive &= ~bit;
+            engine->stats.timeouts++;
+            monitor_record_sweep(engine->monitor, (int)index, offset, -1, was_alive);
+        }
+        *seen &= ~bit;
+
+        add_probe(engine, index, offset, slot->sequence);
+
+        if (++sweep->cursor == sweep->count) {
+            sweep->cursor = 0;
+            sweep->warm = true;
+            slot->sequence++;
+        }
+    }
+
+    if (due) {
+        slot->next_send_ns += sweep->step_ns;
+        if (slot->next_send_ns <= now) {
+            slot->next_send_ns = now + sweep->step_ns;
+        }
+    }
+}
+
+static long reply_rtt_us(ProbeEngine *engine, const IcmpReply *reply) {
+    if (engine->tx_stamps) {
+        const TxStamp *stamp = &engine->tx_stamps[reply->tag & (ENGINE_TX_STAMPS - 1)];
+        if (stamp->sent_ns && stamp->tag == reply->tag) {
+            IcmpReply timed = *reply;
+            timed.sent.tv_sec = (time_t)(stamp->sent_ns / NSEC_PER_SEC);
+            timed.sent.tv_nsec = (long)(stamp->sent_ns % NSEC_PER_SEC);
+            engine->stats.tx_stamped++;
+            return icmp_rtt_us(&timed);
+        }
+    }
+    return icmp_rtt_us(reply);
+}
+
+static void handle_sweep_reply(ProbeEngine *engine, const IcmpReply *reply) {
+    ProbeSlot *slot = &engine->slots[reply->cookie];
+    RangeSweep *sweep = slot->sweep;
+    if (!IN6_IS_ADDR_V4MAPPED(&reply->from)) {
+        return;     // Foreign reply
+    }
+
+    uint32_t from;
+    memcpy(&from, &reply->from.s6_addr[12], sizeof(from));
+    uint32_t offset = ntohl(from) - sweep->first;
+    if (offset >= sweep->count) {
+        return;
+    }
+
+    // Addresses behind the cursor were probed in this sweep, the others in the previous one
+    bool current = offset < sweep->cursor;
+    if ((!current && !sweep->warm) ||
+        reply->sequence != (uint16_t)(current ? slot->sequence : slot->sequence - 1)) {
+        return;     // Late reply
+    }
+
+    uint64_t bit = 1ULL << (offset & 63);
+    uint64_t *seen = &sweep->seen[offset >> 6];
+    uint64_t *alive = &sweep->alive[offset >> 6];
+    long rtt_us = reply_rtt_us(engine, reply);
+    if ((*seen & bit) || rtt_us > (long)engine->monitor->store.timeout_ms[reply->cookie] * 1000) {
+        return;     // Duplicate, or too late to count
+    }
+
+    bool was_alive = (*alive & bit) != 0;
+    *seen |= bit;
+    *alive |= bit;
+    engine->stats.replies++;
+    monitor_record_sweep(engine->monitor, (int)reply->cookie, offset, rtt_us, was_alive);
+}
+
+static void handle_reply(ProbeEngine *engine, const IcmpReply *reply) {
+    if (reply->cookie >= (uint32_t)engine->slot_count) {
+        return;
+    }
+
+    ProbeSlot *slot = &engine->slots[reply->cookie];
+    if (slot->sweep) {
+        handle_sweep_reply(engine, reply);
+        return;
+    }
+
+    const IPStore *store = &engine->monitor->store;
+    if (!slot->timeout_ns || reply->sequence != slot->sequence || store->probe_type[reply->cookie] != PROBE_ICMP ||
+        !IN6_ARE_ADDR_EQUAL(&reply->from, &store->addr[reply->cookie])) {
+        return;     // Late or foreign reply
+    }
+
+    slot->timeout_ns = 0;
+    engine->stats.replies++;
+    monitor_record_result(engine->monitor, (int)reply->cookie, reply_rtt_us(engine, reply));
+    adapt_period(engine, reply->cookie, true, monotonic_ns());
+    scheduler_set(&engine->schedule, reply->cookie, slot_deadline(slot));
+}
+
+// Read a batch of datagrams, or of error queue messages, into the receive buffers
+static int receive_batch(ProbeEngine *engine, const IcmpSocket *sock, int flags) {
+    RxBatch *rx = &engine->rx;
+
+    for (;;) {
+        for (int i = 0; i < ENGINE_BATCH; i++) {
+            struct msghdr *hdr = &rx->msgs[i].msg_hdr;
+            rx->iov[i].iov_base = rx->buffers[i];
+            rx->iov[i].iov_len = ENGINE_RX_SIZE;
+            hdr->msg_name = &rx->from[i];
+            hdr->msg_namelen = sizeof(rx->from[i]);
+            hdr->msg_iov = &rx->iov[i];
+            hdr->msg_iovlen = 1;
+            hdr->msg_control = rx->control[i];
+            hdr->msg_controllen = ENGINE_CONTROL_SIZE;
+            hdr->msg_flags = 0;
+        }
+
+        int received = recvmmsg(sock->fd, rx->msgs, ENGINE_BATCH, MSG_DONTWAIT | flags, NULL);
+        if (received >= 0 || errno != EINTR) {
+            return received;
+        }
+    }
+}
+
+static void drain_replies(ProbeEngine *engine, const IcmpSocket *sock) {
+    RxBatch *rx = &engine->rx;
+
+    for (;;) {
+        int received = receive_batch(engine, sock, 0);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_message(LOG_ERROR, "Failed to receive ICMP replies: %s", strerror(errno));
+            }
+            return;
+        }
+
+        for (int i = 0; i < received; i++) {
+            IcmpReply reply;
+            if (icmp_parse_reply(sock, &rx->msgs[i].msg_hdr, rx->msgs[i].msg_len, &reply)) {
+                handle_reply(engine, &reply);
+            }
+        }
+
+        if (received < ENGINE_BATCH) {
+            return;
+        }
+    }
+}
+
+static void drain_tx_timestamps(ProbeEngine *engine, const IcmpSocket *sock) {
+    RxBatch *rx = &engine->rx;
+
+    for (;;) {
+        int received = receive_batch(engine, sock, MSG_ERRQUEUE);
+        if (received < 0) {
+            // An empty error queue means a pending socket error raised EPOLLERR, clear it
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                int error;
+                socklen_t error_len = sizeof(error);
+                getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+            }
+            return;
+        }
+
+        for (int i = 0; i < received; i++) {
+            uint32_t tag;
+            struct timespec sent;
+            if (engine->tx_stamps &&
+                icmp_parse_tx_timestamp(sock, &rx->msgs[i].msg_hdr, rx->msgs[i].msg_len, &tag, &sent)) {
+                TxStamp *stamp = &engine->tx_stamps[tag & (ENGINE_TX_STAMPS - 1)];
+                stamp->tag = tag;
+                stamp->sent_ns = (uint64_t)sent.tv_sec * NSEC_PER_SEC + (uint64_t)sent.tv_nsec;
+            }
+        }
+
+        if (received < ENGINE_BATCH) {
+            return;
+        }
+    }
+}
+
+static void service_channel(ProbeEngine *engine, ProbeChannel *channel, uint32_t events) {
+    // Transmit timestamps first, so that the replies they belong to find them
+    if (events & EPOLLERR) {
+        drain_tx_timestamps(engine, &channel->sock);
+    }
+    if (events & EPOLLIN) {
+        drain_replies(engine, &channel->sock);
+    }
+}
+
+static void service_session(ProbeEngine *engine, uint64_t data, uint32_t events) {
+    uint32_t index = (uint32_t)data;
+    if (index >= (uint32_t)engine->slot_count) {
+        return;
+    }
+
+    // Events queued for a socket closed earlier in the same batch belong to an older probe
+    ProbeSlot *slot = &engine->slots[index];
+    ProbeSession *session = slot->session;
+    if (!session || session->fd < 0 || !slot->timeout_ns || (uint16_t)(data >> 32) != slot->sequence) {
+        return;
+    }
+
+    ProbeProgress progress = session->ops->poll(session, events);
+    if (progress == PROBE_PENDING) {
+        if (session->events != session->armed) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = session->events;
+            ev.data.u64 = data;
+            if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, session->fd, &ev) != 0) {
+                log_message(LOG_ERROR, "Failed to rearm probe socket: %s", strerror(errno));
+                progress = PROBE_FAILED;
+            } else {
+                session->armed = session->events;
+            }
+        }
+        if (progress == PROBE_PENDING) {
+            return;
+        }
+    }
+
+    uint64_t now = monotonic_ns();
+    long rtt_us = (long)((now - session->started_ns) / 1000);
+    end_session(slot);
+    slot->timeout_ns = 0;
+    if (progress == PROBE_ANSWERED) {
+        engine->stats.replies++;
+        monitor_record_result(engine->monitor, (int)index, rtt_us);
+        adapt_period(engine, index, true, now);
+    } else {
+        record_timeout(engine, index, now);
+    }
+    scheduler_set(&engine->schedule, index, slot_deadline(slot));
+}
+
+static void service_slot(ProbeEngine *engine, uint32_t index, uint64_t now) {
+    ProbeSlot *slot = &engine->slots[index];
+
+    if (!engine->monitor->store.active[index]) {
+        return;
+    }
+
+    if (slot->sweep) {
+        if (now >= slot->next_send_ns || (slot->paced_ns && now >= slot->paced_ns)) {
+            queue_sweep(engine, index, now);
+        }
+        scheduler_set(&engine->schedule, index, slot_send_time(slot));
+        return;
+    }
+
+    if (slot->timeout_ns && now >= slot->timeout_ns) {
+        slot->timeout_ns = 0;
+        record_timeout(engine, index, now);
+    }
+    if (now >= slot->next_send_ns && pace_probe(engine, index, 0, now)) {
+        queue_probe(engine, index, now);
+    }
+
+    scheduler_set(&engine->schedule, index, slot_deadline(slot));
+}
+
+static void run_due_probes(ProbeEngine *engine) {
+    uint64_t now = monotonic_ns();
+    uint32_t index;
+
+    while (scheduler_pop_due(&engine->schedule, now, &index)) {
+        service_slot(engine, index, now);
+    }
+    flush_probes(engine);
+}
+
+static void arm_timer(ProbeEngine *engine) {
+    uint64_t deadline = 0;
+    scheduler_peek(&engine->schedule, NULL, &deadline);
+    if (deadline == engine->timer_deadline) {
+        return;
+    }
+
+    // An all-zero it_value disarms the timer when nothing is scheduled
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)(deadline / NSEC_PER_SEC);
+    spec.it_value.tv_nsec = (long)(deadline % NSEC_PER_SEC);
+    if (timerfd_settime(engine->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        log_message(LOG_ERROR, "Failed to arm probe timer: %s", strerror(errno));
+        return;
+    }
+    engine->timer_deadline = deadline;
+}
+
+static void drain_counter(int fd) {
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        log_message(LOG_WARNING, "Failed to drain engine event: %s", strerror(errno));
+    }
+}
+
+static void run_pending_call(ProbeEngine *engine) {
+    pthread_mutex_lock(&engine->call_lock);
+    if (engine->call_pending) {
+        engine->call_fn(engine->call_arg);
+        engine->call_pending = false;
+        pthread_cond_broadcast(&engine->call_done);
+    }
+    pthread_mutex_unlock(&engine->call_lock);
+}
+
+static void *engine_thread(void *arg) {
+    ProbeEngine *engine = (ProbeEngine *)arg;
+    struct epoll_event events[ENGINE_MAX_EVENTS];
+
+    while (engine->monitor->running) {
+        run_due_probes(engine);
+        arm_timer(engine);
+
+        int count = epoll_wait(engine->epoll_fd, events, ENGINE_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_message(LOG_ERROR, "Probe engine wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            // Probe sockets first, the low half of their data could pass for a descriptor
+            if (events[i].data.u64 & ENGINE_SESSION_EVENT) {
+                service_session(engine, events[i].data.u64, events[i].events);
+            } else if (events[i].data.fd == engine->channels[0].sock.fd) {
+                service_channel(engine, &engine->channels[0], events[i].events);
+            } else if (events[i].data.fd == engine->channels[1].sock.fd) {
+                service_channel(engine, &engine->channels[1], events[i].events);
+            } else if (events[i].data.fd == engine->timer_fd) {
+                drain_counter(engine->timer_fd);
+                engine->timer_deadline = 0;
+            } else if (events[i].data.fd == engine->wake_fd) {
+                drain_counter(engine->wake_fd);
+                run_pending_call(engine);
+            }
+        }
+    }
+
+    // Serve a caller that raced with shutdown, later callers run inline
+    pthread_mutex_lock(&engine->call_lock);
+    engine->exited = true;
+    pthread_mutex_unlock(&engine->call_lock);
+    run_pending_call(engine);
+
+    return NULL;
+}
+
+void probe_engine_call(ProbeEngine *engine, void (*fn)(void *arg), void *arg) {
+    pthread_mutex_lock(&engine->call_lock);
+    if (!engine->started || engine->exited || pthread_equal(pthread_self(), engine->thread)) {
+        pthread_mutex_unlock(&engine->call_lock);
+        fn(arg);
+        return;
+    }
+
+    while (engine->call_pending) {
+        pthread_cond_wait(&engine->call_done, &engine->call_lock);
+    }
+    // The engine may have left its loop while we waited for the previous call
+    if (engine->exited) {
+        pthread_mutex_unlock(&engine->call_lock);
+        fn(arg);
+        return;
+    }
+    engine->call_fn = fn;
+    engine->call_arg = arg;
+    engine->call_pending = true;
+
+    uint64_t value = 1;
+    if (write(engine->wake_fd, &value, sizeof(value)) < 0) {
+        log_message(LOG_WARNING, "Failed to wake probe engine: %s", strerror(errno));
+    }
+    while (engine->call_pending) {
+        pthread_cond_wait(&engine->call_done, &engine->call_lock);
+    }
+    pthread_mutex_unlock(&engine->call_lock);
+}
+
+typedef struct {
+    ProbeEngine *engine;
+    ProbeEngineStats *stats;
+} StatsRequest;
+
+static void copy_stats(void *arg) {
+    StatsRequest *request = (StatsRequest *)arg;
+    *request->stats = request->engine->stats;
+}
+
+void probe_engine_set_rate_limits(ProbeEngine *engine, const ProbeRateLimits *limits) {
+    rate_limiter_configure(&engine->limiter, limits);
+}
+
+void probe_engine_get_stats(ProbeEngine *engine, ProbeEngineStats *stats) {
+    // Copied on the engine thread so the counters need no atomics on the probe path
+    StatsRequest request = { engine, stats };
+    probe_engine_call(engine, copy_stats, &request);
+}
+
+static int reserve_slots(ProbeEngine *engine, int count) {
+    if (count <= engine->slot_capacity) {
+        return 0;
+    }
+
+    int capacity = engine->slot_capacity ? engine->slot_capacity : 16;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    ProbeSlot *slots = (ProbeSlot *)realloc(engine->slots, capacity * sizeof(ProbeSlot));
+    if (!slots) {
+        log_message(LOG_ERROR, "Memory allocation failed for probe slots");
+        return -1;
+    }
+    memset(slots + engine->slot_capacity, 0, (capacity - engine->slot_capacity) * sizeof(ProbeSlot));
+    engine->slots = slots;
+    engine->slot_capacity = capacity;
+
+    return scheduler_reserve(&engine->schedule, capacity);
+}
+
+static void pace_sweep(RangeSweep *sweep, uint64_t interval) {
+    // Enough addresses per burst that a range wakes the loop at most once per tick
+    uint64_t burst = ((uint64_t)sweep->count * ENGINE_SWEEP_TICK_NS + interval - 1) / interval;
+    sweep->burst = burst < 1 ? 1 : burst > sweep->count ? sweep->count : (uint32_t)burst;
+    sweep->step_ns = interval * sweep->burst / sweep->count;
+    if (!sweep->step_ns) {
+        sweep->step_ns = 1;
+    }
+}
+
+static void free_sweep(ProbeSlot *slot) {
+    if (slot->sweep) {
+        free(slot->sweep->seen);
+        free(slot->sweep->alive);
+        free(slot->sweep);
+        slot->sweep = NULL;
+    }
+}
+
+static int reset_sweep(ProbeEngine *engine, uint32_t index) {
+    const IPStore *store = &engine->monitor->store;
+    ProbeSlot *slot = &engine->slots[index];
+    uint32_t count = store->range_size[index];
+
+    free_sweep(slot);
+    slot->period_ns = interval_ns(store, index);
+    slot->streak = 0;
+    slot->paced_ns = 0;
+    slot->pace = PACE_NONE;
+    if (!count || store->status[index] == IP_STORE_REMOVED) {
+        return 0;
+    }
+
+    size_t words = (count + 63) / 64;
+    RangeSweep *sweep = (RangeSweep *)calloc(1, sizeof(RangeSweep));
+    if (sweep) {
+        sweep->seen = (uint64_t *)calloc(words, sizeof(uint64_t));
+        sweep->alive = (uint64_t *)calloc(words, sizeof(uint64_t));
+    }
+    if (!sweep || !sweep->seen || !sweep->alive) {
+        log_message(LOG_ERROR, "Memory allocation failed for sweep of %s", ip_store_name(store, (int)index));
+        if (sweep) {
+            free(sweep->seen);
+            free(sweep->alive);
+            free(sweep);
+        }
+        return -1;
+    }
+
+    uint32_t first;
+    memcpy(&first, &store->addr[index].s6_addr[12], sizeof(first));
+    sweep->first = ntohl(first);
+    sweep->count = count;
+    pace_sweep(sweep, interval_ns(store, index));
+    slot->sweep = sweep;
+    return 0;
+}
+
+int probe_engine_refresh(ProbeEngine *engine, int index, bool reset) {
+    const IPStore *store = &engine->monitor->store;
+
+    if (reserve_slots(engine, index + 1) != 0) {
+        return -1;
+    }
+    if (index >= engine->slot_count) {
+        engine->slot_count = index + 1;
+    }
+
+    ProbeSlot *slot = &engine->slots[index];
+    uint64_t now = monotonic_ns();
+
+    if (reset) {
+        // The sequence keeps counting so replies meant for the old target are ignored
+        end_session(slot);
+        slot->timeout_ns = 0;
+        slot->sequence++;
+        if (reset_sweep(engine, (uint32_t)index) != 0) {
+            scheduler_remove(&engine->schedule, (uint32_t)index);
+            return -1;
+        }
+        slot->next_send_ns = now + next_random(engine) % slot_period(slot);
+    } else {
+        // New settings restart adaptation from the configured interval
+        if (slot->sweep) {
+            pace_sweep(slot->sweep, interval_ns(store, (uint32_t)index));
+        } else {
+            slot->period_ns = interval_ns(store, (uint32_t)index);
+            slot->streak = 0;
+        }
+        uint64_t period = slot_period(slot);
+        if (slot->next_send_ns > now + period) {
+            slot->next_send_ns = now + period;
+        }
+    }
+
+    if (!store->active[index] || store->status[index] == IP_STORE_REMOVED) {
+        end_session(slot);
+        slot->timeout_ns = 0;
+        if (store->status[index] == IP_STORE_REMOVED) {
+            free_sweep(slot);
+            free_session(slot);
+        }
+        scheduler_remove(&engine->schedule, (uint32_t)index);
+        return 0;
+    }
+
+    scheduler_set(&engine->schedule, (uint32_t)index, slot_deadline(slot));
+    return 0;
+}
+
+static int watch_fd(ProbeEngine *engine, int fd) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        log_message(LOG_ERROR, "Failed to add descriptor to probe engine: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+ProbeEngine* probe_engine_create(Monitor *monitor) {
+    if (!monitor || monitor->ip_count <= 0) {
+        log_message(LOG_ERROR, "Invalid monitor for probe engine creation");
+        return NULL;
+    }
+
+    ProbeEngine *engine = (ProbeEngine *)calloc(1, sizeof(ProbeEngine));
+    if (!engine) {
+        log_message(LOG_ERROR, "Memory allocation failed for probe engine");
+        return NULL;
+    }
+    engine->monitor = monitor;
+    engine->channels[0].sock.fd = -1;
+    engine->channels[1].sock.fd = -1;
+    engine->epoll_fd = -1;
+    engine->wake_fd = -1;
+    engine->timer_fd = -1;
+
+    pthread_mutex_init(&engine->call_lock, NULL);
+    pthread_cond_init(&engine->call_done, NULL);
+    rate_limiter_init(&engine->limiter, &monitor->rate_limits);
+
+    engine->slot_count = monitor->ip_count;
+    if (scheduler_init(&engine->schedule, 0) != 0 ||
+        reserve_slots(engine, engine->slot_count) != 0) {
+        probe_engine_free(engine);
+        return NULL;
+    }
+
+    // Spread first probes over one interval so equal intervals do not fire together
+    uint64_t now = monotonic_ns();
+    engine->rng_state = now ^ ((uint64_t)getpid() << 32) ^ 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < engine->slot_count; i++) {
+        ProbeSlot *slot = &engine->slots[i];
+        if (reset_sweep(engine, (uint32_t)i) != 0) {
+            probe_engine_free(engine);
+            return NULL;
+        }
+        slot->next_send_ns = now + next_random(engine) % slot_period(slot);
+        if (monitor->store.active[i]) {
+            scheduler_set(&engine->schedule, (uint32_t)i, slot->next_send_ns);
+        }
+    }
+
+    // Either family may be unavailable on the host, its ICMP targets then fail like unresolved ones
+    bool have_v4 = icmp_open(&engine->channels[0].sock, AF_INET) == 0;
+    bool have_v6 = icmp_open(&engine->channels[1].sock, AF_INET6) == 0;
+    if (!have_v4 && !have_v6) {
+        log_message(LOG_WARNING, "No ICMP socket available, only TCP, UDP and HTTP probes can succeed");
+    }
+
+    // Room for a full burst of requests and replies between two wakeups, timestamps count against SO_RCVBUF
+    int buffer_size = ENGINE_SOCKET_BUFFER;
+    bool tx_stamps = false;
+    for (int i = 0; i < 2; i++) {
+        if (engine->channels[i].sock.fd >= 0) {
+            setsockopt(engine->channels[i].sock.fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+            setsockopt(engine->channels[i].sock.fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+            tx_stamps |= icmp_enable_tx_timestamps(&engine->channels[i].sock) == 0;
+        }
+    }
+    if (tx_stamps) {
+        engine->tx_stamps = (TxStamp *)calloc(ENGINE_TX_STAMPS, sizeof(TxStamp));
+        if (!engine->tx_stamps) {
+            log_message(LOG_ERROR, "Memory allocation failed for transmit timestamps");
+            probe_engine_free(engine);
+            return NULL;
+        }
+    }
+
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    engine->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    engine->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (engine->epoll_fd < 0 || engine->wake_fd < 0 || engine->timer_fd < 0) {
+        log_message(LOG_ERROR, "Failed to create probe engine event loop: %s", strerror(errno));
+        probe_engine_free(engine);
+        return NULL;
+    }
+
+    if ((have_v4 && watch_fd(engine, engine->channels[0].sock.fd) != 0) ||
+        (have_v6 && watch_fd(engine, engine->channels[1].sock.fd) != 0) ||
+        watch_fd(engine, engine->wake_fd) != 0 ||
+        watch_fd(engine, engine->timer_fd) != 0) {
+        probe_engine_free(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+int probe_engine_start(ProbeEngine *engine) {
+    if (!engine || engine->started) {
+        return -1;
+    }
+
+    int result = pthread_create(&engine->thread, NULL, engine_thread, engine);
+    if (result != 0) {
+        log_message(LOG_ERROR, "Failed to create probe engine thread: %s", strerror(result));
+        return -1;
+    }
+
+    engine->started = true;
+    return 0;
+}
+
+void probe_engine_stop(ProbeEngine *engine) {
+    if (!engine || !engine->started) {
+        return;
+    }
+
+    // The loop re-checks monitor->running after every wakeup
+    uint64_t value = 1;
+    if (write(engine->wake_fd, &value, sizeof(value)) < 0) {
+        log_message(LOG_WARNING, "Failed to wake probe engine: %s", strerror(errno));
+    }
+    pthread_join(engine->thread, NULL);
+    engine->started = false;
+}
+
+void probe_engine_free(ProbeEngine *engine) {
+    if (!engine) {
+        return;
+    }
+
+    probe_engine_stop(engine);
+    icmp_close(&engine->channels[0].sock);
+    icmp_close(&engine->channels[1].sock);
+    if (engine->epoll_fd >= 0) {
+        close(engine->epoll_fd);
+    }
+    if (engine->wake_fd >= 0) {
+        close(engine->wake_fd);
+    }
+    if (engine->timer_fd >= 0) {
+        close(engine->timer_fd);
+    }
+    for (int i = 0; i < engine->slot_count; i++) {
+        free_sweep(&engine->slots[i]);
+        free_session(&engine->slots[i]);
+    }
+    scheduler_free(&engine->schedule);
+    pthread_mutex_destroy(&engine->call_lock);
+    pthread_cond_destroy(&engine->call_done);
+    rate_limiter_free(&engine->limiter);
+    free(engine->tx_stamps);
+    free(engine->slots);
+    free(engine);
+}
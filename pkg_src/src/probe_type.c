@@ -0,0 +1,199 @@
+/**
+ * @file probe_type.c
+ * @brief Implementation of the TCP connect, UDP echo and HTTP HEAD probes
+ */
+
+#include "../include/probe_type.h"
+#include "../include/logger.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#define UDP_PROBE_PAYLOAD "ip_monitor probe"
+#define HTTP_STATUS_LINE_MIN 12     // "HTTP/1.1 200"
+#define HTTP_REQUEST_SIZE 512
+
+// Connect a non-blocking socket, the connection may still be under way on return
+static int open_socket(ProbeSession *session, int type, const struct sockaddr *addr, socklen_t addr_len) {
+    int fd = socket(addr->sa_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_message(LOG_WARNING, "Failed to create probe socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (connect(fd, addr, addr_len) != 0 && errno != EINPROGRESS) {
+        log_message(LOG_DEBUG, "Failed to connect to %s port %u: %s",
+                    session->host, session->port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    session->fd = fd;
+    session->stage = 0;
+    session->length = 0;
+    return 0;
+}
+
+// Outcome of a connection attempt once its socket became writable or reported an error
+static ProbeProgress connect_result(const ProbeSession *session) {
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+
+    if (getsockopt(session->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0) {
+        error = errno;
+    }
+    if (error) {
+        log_message(LOG_DEBUG, "Connection to %s port %u failed: %s",
+                    session->host, session->port, strerror(error));
+        return PROBE_FAILED;
+    }
+    return PROBE_ANSWERED;
+}
+
+static int tcp_start(ProbeSession *session, const struct sockaddr *addr, socklen_t addr_len) {
+    if (open_socket(session, SOCK_STREAM, addr, addr_len) != 0) {
+        return -1;
+    }
+    session->events = EPOLLOUT;
+    return 0;
+}
+
+static ProbeProgress tcp_poll(ProbeSession *session, uint32_t events) {
+    (void)events;
+    return connect_result(session);
+}
+
+static void tcp_complete(ProbeSession *session) {
+    // Reset rather than close gracefully, so probing never fills the table with TIME_WAIT sockets
+    struct linger reset = { 1, 0 };
+    setsockopt(session->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(session->fd);
+    session->fd = -1;
+}
+
+static int udp_start(ProbeSession *session, const struct sockaddr *addr, socklen_t addr_len) {
+    if (open_socket(session, SOCK_DGRAM, addr, addr_len) != 0) {
+        return -1;
+    }
+    if (send(session->fd, UDP_PROBE_PAYLOAD, sizeof(UDP_PROBE_PAYLOAD) - 1, 0) < 0) {
+        log_message(LOG_DEBUG, "Failed to send UDP probe to %s port %u: %s",
+                    session->host, session->port, strerror(errno));
+        close(session->fd);
+        session->fd = -1;
+        return -1;
+    }
+    session->events = EPOLLIN;
+    return 0;
+}
+
+// Any datagram from the connected port is the echo, a port unreachable error fails the probe
+static ProbeProgress udp_poll(ProbeSession *session, uint32_t events) {
+    (void)events;
+    if (recv(session->fd, session->buffer, sizeof(session->buffer), 0) >= 0) {
+        return PROBE_ANSWERED;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return PROBE_PENDING;
+    }
+    log_message(LOG_DEBUG, "UDP probe of %s port %u failed: %s", session->host, session->port, strerror(errno));
+    return PROBE_FAILED;
+}
+
+static void udp_complete(ProbeSession *session) {
+    close(session->fd);
+    session->fd = -1;
+}
+
+static ProbeProgress http_send_request(ProbeSession *session) {
+    char request[HTTP_REQUEST_SIZE];
+    bool literal_v6 = strchr(session->host, ':') != NULL;
+    char port[8] = "";
+
+    if (session->port != 80) {
+        snprintf(port, sizeof(port), ":%u", session->port);
+    }
+    int length = snprintf(request, sizeof(request),
+                          "HEAD / HTTP/1.1\r\nHost: %s%s%s%s\r\nUser-Agent: ip_monitor\r\n"
+                          "Connection: close\r\n\r\n",
+                          literal_v6 ? "[" : "", session->host, literal_v6 ? "]" : "", port);
+    if (length < 0 || length >= (int)sizeof(request)) {
+        log_message(LOG_WARNING, "HTTP probe request for %s is too long", session->host);
+        return PROBE_FAILED;
+    }
+
+    // The fresh connection's send buffer takes a request this small in one go
+    if (send(session->fd, request, (size_t)length, MSG_NOSIGNAL) != length) {
+        log_message(LOG_DEBUG, "Failed to send HTTP probe to %s: %s", session->host, strerror(errno));
+        return PROBE_FAILED;
+    }
+
+    session->stage = 1;
+    session->events = EPOLLIN;
+    return PROBE_PENDING;
+}
+
+// Only the status line matters: 1xx to 3xx is an answer, 4xx and 5xx a failure
+static ProbeProgress http_poll(ProbeSession *session, uint32_t events) {
+    (void)events;
+    if (session->stage == 0) {
+        return connect_result(session) == PROBE_ANSWERED ? http_send_request(session) : PROBE_FAILED;
+    }
+
+    ssize_t received = recv(session->fd, session->buffer + session->length,
+                            sizeof(session->buffer) - session->length, 0);
+    if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return PROBE_PENDING;
+        }
+        log_message(LOG_DEBUG, "HTTP probe of %s failed: %s", session->host, strerror(errno));
+        return PROBE_FAILED;
+    }
+    if (received == 0) {
+        log_message(LOG_DEBUG, "HTTP probe of %s: connection closed before a status line", session->host);
+        return PROBE_FAILED;
+    }
+
+    session->length += (uint8_t)received;
+    if (session->length < HTTP_STATUS_LINE_MIN) {
+        return PROBE_PENDING;
+    }
+
+    const char *line = session->buffer;
+    if (strncmp(line, "HTTP/", 5) != 0 || line[8] != ' ' ||
+        line[9] < '1' || line[9] > '5' || line[10] < '0' || line[10] > '9' || line[11] < '0' || line[11] > '9') {
+        log_message(LOG_DEBUG, "HTTP probe of %s: malformed status line", session->host);
+        return PROBE_FAILED;
+    }
+    if (line[9] >= '4') {
+        log_message(LOG_DEBUG, "HTTP probe of %s: status %.3s", session->host, line + 9);
+        return PROBE_FAILED;
+    }
+    return PROBE_ANSWERED;
+}
+
+static const ProbeOps probe_types[] = {
+    [PROBE_ICMP] = { "icmp", 0, NULL, NULL, NULL },
+    [PROBE_TCP] = { "tcp", 80, tcp_start, tcp_poll, tcp_complete },
+    [PROBE_UDP] = { "udp", 7, udp_start, udp_poll, udp_complete },
+    [PROBE_HTTP] = { "http", 80, tcp_start, http_poll, tcp_complete },
+};
+
+const ProbeOps* probe_type_ops(ProbeType type) {
+    if ((unsigned int)type >= sizeof(probe_types) / sizeof(probe_types[0])) {
+        return NULL;
+    }
+    return &probe_types[type];
+}
+
+int probe_type_from_name(const char *name) {
+    for (size_t i = 0; i < sizeof(probe_types) / sizeof(probe_types[0]); i++) {
+        if (strcasecmp(name, probe_types[i].name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file publisher.c
+ * @brief Implementation of the batched result publisher
+ */
+
+#include "../include/publisher.h"
+#include "../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#define PUBLISHER_RING_SIZE 65536   // Results the ring holds, a power of two
+
+struct Publisher {
+    Monitor *monitor;           // Source of the address strings
+    int batch_size;             // Results per payload at most
+    int interval_ms;            // Longest wait before a partial batch is flushed
+    PublishSink sink;           // Receives each payload
+    void *user_data;            // Passed to the sink
+    ProbeResult *ring;          // Results waiting to be published
+    _Alignas(64) atomic_size_t head;    // Next slot the producer writes
+    _Alignas(64) atomic_size_t tail;    // Next slot the publisher thread reads
+    atomic_size_t wake_at;      // Queued results that warrant waking the thread
+    atomic_bool waiting;        // Publisher thread is (about to be) asleep
+    atomic_bool stop;           // Publisher thread should flush and exit
+    atomic_ulong dropped;       // Results lost because the ring was full
+    int wake_fd;                // eventfd the producer rings
+    pthread_t thread;           // Publisher thread
+    bool started;               // Whether the thread is running
+    ResultBatch batch;          // Payload being built
+    long long batch_deadline;   // When the payload must be flushed, in monotonic ms
+};
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void flush_batch(Publisher *publisher) {
+    if (!publisher->batch.count) {
+        return;
+    }
+
+    size_t length;
+    const char *payload = result_batch_finish(&publisher->batch, &length);
+    publisher->sink(publisher->user_data, payload, length);
+    result_batch_clear(&publisher->batch);
+}
+
+static void drain_ring(Publisher *publisher) {
+    IPStore *store = &publisher->monitor->store;
+    size_t tail = atomic_load_explicit(&publisher->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&publisher->head, memory_order_acquire);
+
+    while (tail != head) {
+        // Names never move in the pool, nor leave it, so no lock is needed to read them
+        while (tail != head && (int)publisher->batch.count < publisher->batch_size) {
+            const ProbeResult *result = &publisher->ring[tail & (PUBLISHER_RING_SIZE - 1)];
+            if (result_batch_append(&publisher->batch, store, result) != 0) {
+                break;
+            }
+            if (publisher->batch.count == 1) {
+                publisher->batch_deadline = monotonic_ms() + publisher->interval_ms;
+            }
+            tail++;
+        }
+        atomic_store_explicit(&publisher->tail, tail, memory_order_release);
+
+        if ((int)publisher->batch.count < publisher->batch_size) {
+            break;
+        }
+        flush_batch(publisher);
+    }
+}
+
+static void *publisher_thread(void *arg) {
+    Publisher *publisher = (Publisher *)arg;
+
+    for (;;) {
+        drain_ring(publisher);
+
+        unsigned long lost = atomic_exchange(&publisher->dropped, 0);
+        if (lost) {
+            log_message(LOG_WARNING, "Dropped %lu probe results, publisher queue full", lost);
+        }
+
+        if (atomic_load(&publisher->stop)) {
+            flush_batch(publisher);
+            break;
+        }
+
+        int timeout = -1;
+        if (publisher->batch.count) {
+            long long remaining = publisher->batch_deadline - monotonic_ms();
+            if (remaining <= 0) {
+                flush_batch(publisher);
+                continue;
+            }
+            timeout = (int)remaining;
+        }
+
+        // Sleep until the batch could fill up, or until the first result if it is empty
+        int batched = (int)publisher->batch.count;
+        size_t wake_at = batched ? (size_t)(publisher->batch_size - batched) : 1;
+        atomic_store(&publisher->wake_at, wake_at);
+        atomic_store(&publisher->waiting, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&publisher->head) - atomic_load(&publisher->tail) >= atomic_load(&publisher->wake_at) ||
+            atomic_load(&publisher->stop)) {
+            atomic_store(&publisher->waiting, false);
+            continue;
+        }
+
+        struct pollfd pfd = { .fd = publisher->wake_fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout) > 0) {
+            uint64_t value;
+            if (read(publisher->wake_fd, &value, sizeof(value)) < 0) {
+                // Already drained, nothing to do
+            }
+        }
+        atomic_store(&publisher->waiting, false);
+    }
+
+    return NULL;
+}
+
+static void wake_publisher(Publisher *publisher) {
+    uint64_t value = 1;
+    if (write(publisher->wake_fd, &value, sizeof(value)) < 0) {
+        log_message(LOG_WARNING, "Failed to wake publisher: %s", strerror(errno));
+    }
+}
+
+void publisher_push(void *arg, const ProbeResult *result) {
+    Publisher *publisher = (Publisher *)arg;
+    size_t head = atomic_load_explicit(&publisher->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&publisher->tail, memory_order_acquire);
+
+    if (head - tail >= PUBLISHER_RING_SIZE) {
+        atomic_fetch_add_explicit(&publisher->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    publisher->ring[head & (PUBLISHER_RING_SIZE - 1)] = *result;
+    atomic_store_explicit(&publisher->head, head + 1, memory_order_release);
+
+    // Only ring the doorbell when the sleeping thread has something to do
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&publisher->waiting, memory_order_relaxed) &&
+        head + 1 - tail >= atomic_load_explicit(&publisher->wake_at, memory_order_relaxed) &&
+        atomic_exchange(&publisher->waiting, false)) {
+        wake_publisher(publisher);
+    }
+}
+
+Publisher* publisher_create(Monitor *monitor, int batch_size, int interval_ms,
+                            PublishEncoding encoding, PublishSink sink, void *user_data) {
+    if (!monitor || !sink) {
+        log_message(LOG_ERROR, "Invalid arguments for publisher creation");
+        return NULL;
+    }
+
+    Publisher *publisher = (Publisher *)calloc(1, sizeof(Publisher));
+    if (!publisher) {
+        log_message(LOG_ERROR, "Memory allocation failed for publisher");
+        return NULL;
+    }
+    publisher->monitor = monitor;
+    publisher->batch_size = batch_size > 0 ? batch_size : PUBLISHER_DEFAULT_BATCH;
+    publisher->interval_ms = interval_ms >= 0 ? interval_ms : PUBLISHER_DEFAULT_INTERVAL_MS;
+    publisher->sink = sink;
+    publisher->user_data = user_data;
+    publisher->wake_fd = -1;
+
+    publisher->ring = (ProbeResult *)malloc(PUBLISHER_RING_SIZE * sizeof(ProbeResult));
+    if (!publisher->ring || result_batch_init(&publisher->batch, encoding) != 0) {
+        log_message(LOG_ERROR, "Memory allocation failed for publisher");
+        publisher_free(publisher);
+        return NULL;
+    }
+
+    publisher->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (publisher->wake_fd < 0) {
+        log_message(LOG_ERROR, "Failed to create publisher eventfd: %s", strerror(errno));
+        publisher_free(publisher);
+        return NULL;
+    }
+
+    if (pthread_create(&publisher->thread, NULL, publisher_thread, publisher) != 0) {
+        log_message(LOG_ERROR, "Failed to create publisher thread");
+        publisher_free(publisher);
+        return NULL;
+    }
+    publisher->started = true;
+
+    return publisher;
+}
+
+void publisher_free(Publisher *publisher) {
+    if (!publisher) {
+        return;
+    }
+
+    if (publisher->started) {
+        atomic_store(&publisher->stop, true);
+        wake_publisher(publisher);
+        pthread_join(publisher->thread, NULL);
+    }
+    if (publisher->wake_fd >= 0) {
+        close(publisher->wake_fd);
+    }
+    free(publisher->ring);
+    result_batch_free(&publisher->batch);
+    free(publisher);
+}
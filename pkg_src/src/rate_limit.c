@@ -0,0 +1,172 @@
+/**
+ * @file rate_limit.c
+ * @brief Implementation of the global and per-subnet probe rate limits
+ */
+
+#include "../include/rate_limit.h"
+#include "../include/logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+#define RATE_LIMIT_DEFAULT_BURST_DIVISOR 100    // Default burst is 10 ms worth of probes
+#define RATE_LIMIT_INITIAL_SUBNETS 64
+
+static void set_limit(RateLimit *limit, int rate, int burst) {
+    if (rate <= 0) {
+        limit->interval_ns = 0;
+        limit->tolerance_ns = 0;
+        return;
+    }
+
+    if (burst <= 0) {
+        burst = rate / RATE_LIMIT_DEFAULT_BURST_DIVISOR;
+    }
+    if (burst < 1) {
+        burst = 1;
+    }
+    limit->interval_ns = NSEC_PER_SEC / (uint64_t)rate;
+    if (!limit->interval_ns) {
+        limit->interval_ns = 1;
+    }
+    limit->tolerance_ns = (uint64_t)(burst - 1) * limit->interval_ns;
+}
+
+// Earliest time at or after now that a bucket has a token for
+static uint64_t conform_time(const RateLimit *limit, uint64_t tat, uint64_t now_ns) {
+    uint64_t earliest = tat > limit->tolerance_ns ? tat - limit->tolerance_ns : 0;
+    return earliest > now_ns ? earliest : now_ns;
+}
+
+static uint64_t reserve(const RateLimit *limit, uint64_t *tat, uint64_t now_ns) {
+    uint64_t at = conform_time(limit, *tat, now_ns);
+    *tat = (*tat > at ? *tat : at) + limit->interval_ns;
+    return at;
+}
+
+void rate_limiter_init(RateLimiter *limiter, const ProbeRateLimits *limits) {
+    memset(limiter, 0, sizeof(*limiter));
+    rate_limiter_configure(limiter, limits);
+}
+
+static void clear_subnets(RateLimiter *limiter) {
+    free(limiter->subnets);
+    free(limiter->subnet_tat);
+    limiter->subnets = NULL;
+    limiter->subnet_tat = NULL;
+    limiter->capacity = 0;
+    limiter->count = 0;
+}
+
+void rate_limiter_configure(RateLimiter *limiter, const ProbeRateLimits *limits) {
+    set_limit(&limiter->global, limits->probe_rate, limits->probe_burst);
+    set_limit(&limiter->subnet, limits->subnet_rate, limits->subnet_burst);
+
+    // Subnets of another size share nothing with the old ones
+    if (!limiter->subnet.interval_ns ||
+        limiter->prefix_v4 != limits->subnet_prefix_v4 || limiter->prefix_v6 != limits->subnet_prefix_v6) {
+        clear_subnets(limiter);
+    }
+    limiter->prefix_v4 = limits->subnet_prefix_v4;
+    limiter->prefix_v6 = limits->subnet_prefix_v6;
+}
+
+void rate_limiter_free(RateLimiter *limiter) {
+    clear_subnets(limiter);
+}
+
+static void subnet_of(const RateLimiter *limiter, const struct in6_addr *addr, struct in6_addr *subnet) {
+    int bits = IN6_IS_ADDR_V4MAPPED(addr) ? 96 + limiter->prefix_v4 : limiter->prefix_v6;
+
+    *subnet = *addr;
+    for (int byte = 0; byte < 16; byte++) {
+        int keep = bits - byte * 8;
+        if (keep <= 0) {
+            subnet->s6_addr[byte] = 0;
+        } else if (keep < 8) {
+            subnet->s6_addr[byte] &= (uint8_t)(0xFF << (8 - keep));
+        }
+    }
+}
+
+static uint32_t hash_subnet(const struct in6_addr *subnet) {
+    uint64_t high, low;
+    memcpy(&high, &subnet->s6_addr[0], sizeof(high));
+    memcpy(&low, &subnet->s6_addr[8], sizeof(low));
+
+    uint64_t x = high ^ (low * 0x9E3779B97F4A7C15ULL);
+    x ^= x >> 31;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 29;
+    return (uint32_t)x;
+}
+
+// Slot holding a subnet, or the empty slot where it belongs
+static uint32_t find_slot(const RateLimiter *limiter, const struct in6_addr *subnet) {
+    uint32_t mask = limiter->capacity - 1;
+    uint32_t slot = hash_subnet(subnet) & mask;
+
+    while (limiter->subnet_tat[slot] && !IN6_ARE_ADDR_EQUAL(&limiter->subnets[slot], subnet)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static int grow_subnets(RateLimiter *limiter) {
+    uint32_t capacity = limiter->capacity ? limiter->capacity * 2 : RATE_LIMIT_INITIAL_SUBNETS;
+    struct in6_addr *subnets = (struct in6_addr *)calloc(capacity, sizeof(struct in6_addr));
+    uint64_t *subnet_tat = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+    if (!subnets || !subnet_tat) {
+        log_message(LOG_ERROR, "Memory allocation failed for subnet rate limits");
+        free(subnets);
+        free(subnet_tat);
+        return -1;
+    }
+
+    RateLimiter grown = *limiter;
+    grown.subnets = subnets;
+    grown.subnet_tat = subnet_tat;
+    grown.capacity = capacity;
+    for (uint32_t i = 0; i < limiter->capacity; i++) {
+        if (limiter->subnet_tat[i]) {
+            uint32_t slot = find_slot(&grown, &limiter->subnets[i]);
+            subnets[slot] = limiter->subnets[i];
+            subnet_tat[slot] = limiter->subnet_tat[i];
+        }
+    }
+
+    free(limiter->subnets);
+    free(limiter->subnet_tat);
+    limiter->subnets = subnets;
+    limiter->subnet_tat = subnet_tat;
+    limiter->capacity = capacity;
+    return 0;
+}
+
+uint64_t rate_limiter_reserve_subnet(RateLimiter *limiter, const struct in6_addr *addr, uint64_t now_ns) {
+    if (!limiter->subnet.interval_ns) {
+        return now_ns;
+    }
+
+    // Half full at most keeps probe sequences short; a full table leaves new subnets unlimited
+    if (limiter->count * 2 >= limiter->capacity && grow_subnets(limiter) != 0 &&
+        limiter->count + 1 >= limiter->capacity) {
+        return now_ns;
+    }
+
+    struct in6_addr subnet;
+    subnet_of(limiter, addr, &subnet);
+    uint32_t slot = find_slot(limiter, &subnet);
+    if (!limiter->subnet_tat[slot]) {
+        limiter->subnets[slot] = subnet;
+        limiter->count++;
+    }
+    return reserve(&limiter->subnet, &limiter->subnet_tat[slot], now_ns);
+}
+
+uint64_t rate_limiter_reserve_global(RateLimiter *limiter, uint64_t now_ns) {
+    if (!limiter->global.interval_ns) {
+        return now_ns;
+    }
+    return reserve(&limiter->global, &limiter->global_tat, now_ns);
+}
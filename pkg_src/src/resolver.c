@@ -0,0 +1,227 @@
+/**
+ * @file resolver.c
+ * @brief Implementation of the periodic host name resolver
+ */
+
+#include "../include/resolver.h"
+#include "../include/logger.h"
+#include "../include/probe_engine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+struct Resolver {
+    Monitor *monitor;           // Monitor whose names are looked up
+    pthread_t thread;           // Resolver thread
+    pthread_mutex_t lock;       // Guards stop
+    pthread_cond_t wake;        // Signalled to stop the thread
+    bool stop;                  // Resolver thread should exit
+    bool started;               // Whether the thread is running
+};
+
+typedef struct {
+    int index;                  // Index of the IP in the store
+    uint32_t name;              // Pool offset of its name, tells a reused index apart
+    char *host;                 // Copy of the name, looked up without the layout lock
+    IPStoreAddress address;     // Result of the lookup
+} NameLookup;
+
+typedef struct {
+    Monitor *monitor;
+    NameLookup *lookups;
+    int count;
+    int changed;                // Addresses that differed from the stored ones
+} AddressChange;
+
+// Runs on the engine thread, so the store and the schedule change between two probe rounds
+static void apply_addresses(void *arg) {
+    AddressChange *change = (AddressChange *)arg;
+    IPStore *store = &change->monitor->store;
+
+    for (int i = 0; i < change->count; i++) {
+        const NameLookup *lookup = &change->lookups[i];
+        int index = lookup->index;
+
+        // The IP may have been removed, or its index reused, during the lookups
+        if (index >= store->count || store->status[index] == IP_STORE_REMOVED ||
+            store->name[index] != lookup->name) {
+            continue;
+        }
+        if (!ip_store_set_address(store, index, &lookup->address)) {
+            continue;
+        }
+
+        char text[INET6_ADDRSTRLEN] = "nothing";
+        if (lookup->address.family == AF_INET) {
+            inet_ntop(AF_INET, &lookup->address.addr.s6_addr[12], text, sizeof(text));
+        } else if (lookup->address.family == AF_INET6) {
+            inet_ntop(AF_INET6, &lookup->address.addr, text, sizeof(text));
+        }
+        log_message(LOG_INFO, "Host name %s now resolves to %s", lookup->host, text);
+
+        // Replies to probes of the old address must not count for the new one
+        probe_engine_refresh(change->monitor->engine, index, true);
+        change->changed++;
+    }
+}
+
+// Copies the names due for a lookup, the caller frees them
+static int collect_names(Resolver *resolver, bool refresh, NameLookup **lookups) {
+    IPStore *store = &resolver->monitor->store;
+    int count = 0;
+    int capacity = 0;
+
+    *lookups = NULL;
+    pthread_rwlock_rdlock(&store->layout_lock);
+    for (int i = 0; i < store->count; i++) {
+        if (!store->host_name[i] || store->status[i] == IP_STORE_REMOVED) {
+            continue;
+        }
+
+        // The family is the engine thread's to change, read it like the status fields
+        uint8_t family;
+        unsigned int seq;
+        do {
+            seq = ip_store_read_begin(store, i);
+            family = store->family[i];
+        } while (ip_store_read_retry(store, i, seq));
+        if (family != AF_UNSPEC && !refresh) {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            NameLookup *grown = (NameLookup *)realloc(*lookups, capacity * sizeof(NameLookup));
+            if (!grown) {
+                log_message(LOG_ERROR, "Memory allocation failed for host name lookups");
+                break;
+            }
+            *lookups = grown;
+        }
+        NameLookup *lookup = &(*lookups)[count];
+        lookup->index = i;
+        lookup->name = store->name[i];
+        lookup->host = strdup(ip_store_name(store, i));
+        if (!lookup->host) {
+            log_message(LOG_ERROR, "Memory allocation failed for host name lookups");
+            break;
+        }
+        count++;
+    }
+    pthread_rwlock_unlock(&store->layout_lock);
+    return count;
+}
+
+// Sleeps until the deadline or until asked to stop, returns whether to stop
+static bool wait_until(Resolver *resolver, const struct timespec *deadline) {
+    pthread_mutex_lock(&resolver->lock);
+    while (!resolver->stop &&
+           pthread_cond_timedwait(&resolver->wake, &resolver->lock, deadline) != ETIMEDOUT) {
+        // Spurious wakeup or stop request, the loop condition tells them apart
+    }
+    bool stop = resolver->stop;
+    pthread_mutex_unlock(&resolver->lock);
+    return stop;
+}
+
+static bool stopping(Resolver *resolver) {
+    pthread_mutex_lock(&resolver->lock);
+    bool stop = resolver->stop;
+    pthread_mutex_unlock(&resolver->lock);
+    return stop;
+}
+
+static void *resolver_thread(void *arg) {
+    Resolver *resolver = (Resolver *)arg;
+    struct timespec deadline;
+    int rounds = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (;;) {
+        deadline.tv_sec += RESOLVER_RETRY_MS / 1000;
+        if (wait_until(resolver, &deadline)) {
+            break;
+        }
+
+        // Every round retries the names that failed, every few rounds all of them are refreshed
+        bool refresh = ++rounds % (RESOLVER_REFRESH_MS / RESOLVER_RETRY_MS) == 0;
+        NameLookup *lookups;
+        int count = collect_names(resolver, refresh, &lookups);
+
+        int done = 0;
+        while (done < count && !stopping(resolver)) {
+            NameLookup *lookup = &lookups[done];
+            if (ip_store_resolve(lookup->host, &lookup->address) != 0) {
+                break;
+            }
+            done++;
+        }
+
+        if (done) {
+            AddressChange change = { .monitor = resolver->monitor, .lookups = lookups, .count = done };
+            probe_engine_call(resolver->monitor->engine, apply_addresses, &change);
+            if (change.changed) {
+                log_message(LOG_INFO, "Looked up %d host names, %d addresses changed", done, change.changed);
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            free(lookups[i].host);
+        }
+        free(lookups);
+    }
+
+    return NULL;
+}
+
+Resolver* resolver_create(Monitor *monitor) {
+    if (!monitor || !monitor->engine) {
+        log_message(LOG_ERROR, "Invalid monitor for resolver creation");
+        return NULL;
+    }
+
+    Resolver *resolver = (Resolver *)calloc(1, sizeof(Resolver));
+    if (!resolver) {
+        log_message(LOG_ERROR, "Memory allocation failed for resolver");
+        return NULL;
+    }
+    resolver->monitor = monitor;
+
+    // The thread waits on the monotonic clock, wall-clock steps must not stall it
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&resolver->lock, NULL);
+    pthread_cond_init(&resolver->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&resolver->thread, NULL, resolver_thread, resolver) != 0) {
+        log_message(LOG_ERROR, "Failed to create resolver thread");
+        resolver_free(resolver);
+        return NULL;
+    }
+    resolver->started = true;
+
+    return resolver;
+}
+
+void resolver_free(Resolver *resolver) {
+    if (!resolver) {
+        return;
+    }
+
+    if (resolver->started) {
+        pthread_mutex_lock(&resolver->lock);
+        resolver->stop = true;
+        pthread_cond_signal(&resolver->wake);
+        pthread_mutex_unlock(&resolver->lock);
+        pthread_join(resolver->thread, NULL);
+    }
+    pthread_cond_destroy(&resolver->wake);
+    pthread_mutex_destroy(&resolver->lock);
+    free(resolver);
+}
@@ -0,0 +1,239 @@
+/**
+ * @file result_codec.c
+ * @brief Implementation of probe result batch encoding
+ */
+
+#include "../include/result_codec.h"
+#include "../include/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define RESULT_JSON_ENTRY_SIZE 128  // JSON bytes per result, name excluded
+#define RESULT_JSON_ESCAPE 6        // Longest escape of one character, \u00XX
+#define RESULT_COUNT_OFFSET 8       // Header offset of the record count
+#define RESULT_BASE_TIME_OFFSET 12  // Header offset of the base time
+
+static const char* status_name(uint8_t status) {
+    switch (status) {
+        case STATUS_UP:
+            return "UP";
+        case STATUS_DOWN:
+            return "DOWN";
+        case STATUS_FLAPPING:
+            return "FLAPPING";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+static void put_u16(uint8_t *out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void put_u64(uint8_t *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint16_t get_u16(const uint8_t *in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+static uint64_t get_u64(const uint8_t *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+static int reserve(ResultBatch *batch, size_t needed) {
+    if (needed <= batch->capacity) {
+        return 0;
+    }
+
+    size_t capacity = batch->capacity ? batch->capacity * 2 : 4096;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    char *data = (char *)realloc(batch->data, capacity);
+    if (!data) {
+        log_message(LOG_ERROR, "Memory allocation failed for result payload");
+        return -1;
+    }
+    batch->data = data;
+    batch->capacity = capacity;
+    return 0;
+}
+
+int result_batch_init(ResultBatch *batch, PublishEncoding encoding) {
+    memset(batch, 0, sizeof(*batch));
+    batch->encoding = encoding;
+    return reserve(batch, 4096);
+}
+
+// Appends a JSON string literal, the caller reserved RESULT_JSON_ESCAPE bytes per character
+static void put_json_string(ResultBatch *batch, const char *string) {
+    char *out = batch->data + batch->length;
+    *out++ = '"';
+    for (const unsigned char *c = (const unsigned char *)string; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            *out++ = '\\';
+            *out++ = (char)*c;
+        } else if (*c < 0x20) {
+            out += sprintf(out, "\\u%04x", *c);
+        } else {
+            *out++ = (char)*c;
+        }
+    }
+    *out++ = '"';
+    batch->length = (size_t)(out - batch->data);
+}
+
+static int append_json(ResultBatch *batch, const IPStore *store, const ProbeResult *result) {
+    const char *name = store->names.data + result->name;
+    size_t name_length = strlen(name);
+    if (reserve(batch, batch->length + RESULT_JSON_ESCAPE * name_length + INET_ADDRSTRLEN + RESULT_JSON_ENTRY_SIZE) != 0) {
+        return -1;
+    }
+
+    batch->length += snprintf(batch->data + batch->length, batch->capacity - batch->length, "%s",
+                              batch->count ? "," : "{\"encoding\":\"json\",\"results\":[");
+
+    // A result from a range names the probed address, and the range as its target
+    batch->length += snprintf(batch->data + batch->length, batch->capacity - batch->length, "{\"ip\":");
+    if (result->range) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &result->addr.s6_addr[12], ip, sizeof(ip));
+        put_json_string(batch, ip);
+        batch->length += snprintf(batch->data + batch->length, batch->capacity - batch->length, ",\"target\":");
+    }
+    put_json_string(batch, name);
+
+    batch->length += snprintf(batch->data + batch->length, batch->capacity - batch->length,
+                              ",\"status\":\"%s\",\"rtt_us\":%d,\"time\":%lld}",
+                              status_name(result->status), result->rtt_us, (long long)result->time_ms);
+    return 0;
+}
+
+static int append_binary(ResultBatch *batch, const ProbeResult *result) {
+    size_t needed = batch->length + RESULT_CODEC_RECORD_SIZE;
+    if (!batch->count) {
+        needed += RESULT_CODEC_HEADER_SIZE;
+    }
+    if (reserve(batch, needed) != 0) {
+        return -1;
+    }
+
+    // The header is written with the first record, its count when the batch is finished
+    if (!batch->count) {
+        uint8_t *header = (uint8_t *)batch->data;
+        memcpy(header, RESULT_CODEC_MAGIC, 4);
+        header[4] = RESULT_CODEC_VERSION;
+        header[5] = 0;
+        put_u16(header + 6, RESULT_CODEC_RECORD_SIZE);
+        put_u32(header + RESULT_COUNT_OFFSET, 0);
+        put_u64(header + RESULT_BASE_TIME_OFFSET, (uint64_t)result->time_ms);
+        batch->base_time_ms = result->time_ms;
+        batch->length = RESULT_CODEC_HEADER_SIZE;
+    }
+
+    uint8_t *record = (uint8_t *)batch->data + batch->length;
+    memcpy(record, &result->addr, 16);
+    record[16] = result->family == AF_INET ? 4 : result->family == AF_INET6 ? 6 : 0;
+    record[17] = result->status;
+    put_u16(record + 18, 0);
+    put_u32(record + 20, (uint32_t)result->rtt_us);
+    put_u32(record + 24, (uint32_t)(int32_t)(result->time_ms - batch->base_time_ms));
+    batch->length += RESULT_CODEC_RECORD_SIZE;
+    return 0;
+}
+
+int result_batch_append(ResultBatch *batch, const IPStore *store, const ProbeResult *result) {
+    int ret;
+    if (batch->encoding == PUBLISH_ENCODING_BINARY) {
+        ret = append_binary(batch, result);
+    } else {
+        ret = append_json(batch, store, result);
+    }
+    if (ret == 0) {
+        batch->count++;
+    }
+    return ret;
+}
+
+const char* result_batch_finish(ResultBatch *batch, size_t *length) {
+    if (batch->encoding == PUBLISH_ENCODING_BINARY) {
+        put_u32((uint8_t *)batch->data + RESULT_COUNT_OFFSET, batch->count);
+    } else {
+        // Close the array opened by the first result, append_json() left room for it
+        batch->length += snprintf(batch->data + batch->length, batch->capacity - batch->length, "]}");
+    }
+
+    *length = batch->length;
+    return batch->data;
+}
+
+void result_batch_clear(ResultBatch *batch) {
+    batch->length = 0;
+    batch->count = 0;
+}
+
+void result_batch_free(ResultBatch *batch) {
+    free(batch->data);
+    batch->data = NULL;
+    batch->length = 0;
+    batch->capacity = 0;
+    batch->count = 0;
+}
+
+int result_batch_decode(const void *payload, size_t length,
+                        void (*fn)(void *user_data, const ResultRecord *record), void *user_data) {
+    const uint8_t *data = (const uint8_t *)payload;
+    if (length < RESULT_CODEC_HEADER_SIZE || memcmp(data, RESULT_CODEC_MAGIC, 4) != 0) {
+        return -1;
+    }
+
+    // Later versions may append fields to a record, skip what this version does not know
+    size_t record_size = get_u16(data + 6);
+    uint32_t count = get_u32(data + RESULT_COUNT_OFFSET);
+    if (record_size < RESULT_CODEC_RECORD_SIZE ||
+        (length - RESULT_CODEC_HEADER_SIZE) / record_size < count) {
+        return -1;
+    }
+
+    int64_t base_time_ms = (int64_t)get_u64(data + RESULT_BASE_TIME_OFFSET);
+    const uint8_t *in = data + RESULT_CODEC_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++, in += record_size) {
+        ResultRecord record;
+        memcpy(&record.addr, in, 16);
+        record.family = in[16];
+        record.status = in[17];
+        record.rtt_us = (int32_t)get_u32(in + 20);
+        record.time_ms = base_time_ms + (int32_t)get_u32(in + 24);
+        if (fn) {
+            fn(user_data, &record);
+        }
+    }
+
+    return (int)count;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file rtt_stats.c
+ * @brief Implementation of per-target round-trip time statistics
+ */
+
+#include "../include/rtt_stats.h"
+#include <string.h>
+
+#define RTT_STATS_HALF_MS (RTT_STATS_WINDOW_MS / 2)
+#define RTT_STATS_SUB_BITS 2        // log2(RTT_STATS_SUB_BUCKETS)
+
+static int bucket_of(uint32_t rtt_us) {
+    if (rtt_us < RTT_STATS_SUB_BUCKETS) {
+        return (int)rtt_us;
+    }
+
+    // The top bits below the leading one pick the sub-bucket within its power of two
+    int octave = 31 - __builtin_clz(rtt_us);
+    int shift = octave - RTT_STATS_SUB_BITS;
+    int index = (shift + 1) * RTT_STATS_SUB_BUCKETS + (int)((rtt_us >> shift) & (RTT_STATS_SUB_BUCKETS - 1));
+    return index < RTT_STATS_BUCKETS ? index : RTT_STATS_BUCKETS - 1;
+}
+
+// Midpoint of a bucket, the value reported for the samples it holds
+static int64_t bucket_value(int index) {
+    if (index < RTT_STATS_SUB_BUCKETS) {
+        return index;
+    }
+
+    int shift = index / RTT_STATS_SUB_BUCKETS - 1;
+    int64_t low = (int64_t)(RTT_STATS_SUB_BUCKETS + index % RTT_STATS_SUB_BUCKETS) << shift;
+    return low + ((1LL << shift) >> 1);
+}
+
+void rtt_stats_init(RttStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->last_us = -1;
+}
+
+static void rotate(RttStats *stats, int64_t now_ms) {
+    int64_t age = now_ms - stats->start_ms;
+
+    if (!stats->start_ms || age >= 2 * RTT_STATS_HALF_MS) {
+        memset(stats->halves, 0, sizeof(stats->halves));
+        stats->start_ms = now_ms ? now_ms : 1;
+        return;
+    }
+
+    // The previous half slides out and is reused as the new current one
+    stats->current ^= 1;
+    memset(&stats->halves[stats->current], 0, sizeof(stats->halves[stats->current]));
+    stats->start_ms += RTT_STATS_HALF_MS;
+}
+
+void rtt_stats_record(RttStats *stats, long rtt_us, int64_t now_ms) {
+    if (!stats->start_ms || now_ms - stats->start_ms >= RTT_STATS_HALF_MS) {
+        rotate(stats, now_ms);
+    }
+
+    RttWindow *half = &stats->halves[stats->current];
+    half->probes++;
+    if (rtt_us < 0) {
+        return;
+    }
+
+    int32_t rtt = rtt_us > INT32_MAX ? INT32_MAX : (int32_t)rtt_us;
+    uint16_t *count = &half->counts[bucket_of((uint32_t)rtt)];
+    if (*count < UINT16_MAX) {
+        (*count)++;
+    }
+    if (!half->replies || rtt < half->min_us) {
+        half->min_us = rtt;
+    }
+    if (!half->replies || rtt > half->max_us) {
+        half->max_us = rtt;
+    }
+    half->replies++;
+    half->sum_us += (uint64_t)rtt;
+
+    // Interarrival jitter of RFC 3550, J += (|D| - J) / 16, kept scaled by 16
+    if (stats->last_us >= 0) {
+        int64_t delta = (int64_t)rtt - stats->last_us;
+        if (delta < 0) {
+            delta = -delta;
+        }
+        stats->jitter_x16 += (int32_t)(delta - ((stats->jitter_x16 + 8) >> 4));
+    }
+    stats->last_us = rtt;
+}
+
+static int32_t percentile(const RttWindow *halves[], int count, int permille,
+                          int32_t min_us, int32_t max_us) {
+    // Rank against the histogram itself, saturated buckets hold fewer samples than replies
+    uint64_t total = 0;
+    for (int index = 0; index < RTT_STATS_BUCKETS; index++) {
+        for (int h = 0; h < count; h++) {
+            total += halves[h]->counts[index];
+        }
+    }
+
+    // Rank of the sample at or below which permille/1000 of the replies fall
+    uint64_t rank = (total * (uint64_t)permille + 999) / 1000;
+    uint64_t seen = 0;
+    int index = 0;
+
+    if (!rank) {
+        rank = 1;
+    }
+    for (; index < RTT_STATS_BUCKETS; index++) {
+        for (int h = 0; h < count; h++) {
+            seen += halves[h]->counts[index];
+        }
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    // The exact extremes are known, a bucket midpoint never lies outside them
+    int64_t value = index < RTT_STATS_BUCKETS ? bucket_value(index) : max_us;
+    if (value < min_us) {
+        value = min_us;
+    }
+    if (value > max_us) {
+        value = max_us;
+    }
+    return (int32_t)value;
+}
+
+void rtt_stats_summarize(const RttStats *stats, int64_t now_ms, RttSummary *summary) {
+    const RttWindow *halves[2];
+    int count = 0;
+    int64_t age = now_ms - stats->start_ms;
+
+    memset(summary, 0, sizeof(*summary));
+    summary->min_us = summary->avg_us = summary->max_us = -1;
+    summary->jitter_us = summary->p50_us = summary->p95_us = summary->p99_us = -1;
+
+    // Halves that slid out of the window since the last sample no longer count
+    if (stats->start_ms && age < 2 * RTT_STATS_HALF_MS) {
+        halves[count++] = &stats->halves[stats->current];
+        if (age < RTT_STATS_HALF_MS) {
+            halves[count++] = &stats->halves[stats->current ^ 1];
+        }
+    }
+
+    uint64_t sum_us = 0;
+    for (int h = 0; h < count; h++) {
+        const RttWindow *half = halves[h];
+        summary->probes += half->probes;
+        if (!half->replies) {
+            continue;
+        }
+        if (!summary->replies || half->min_us < summary->min_us) {
+            summary->min_us = half->min_us;
+        }
+        if (!summary->replies || half->max_us > summary->max_us) {
+            summary->max_us = half->max_us;
+        }
+        summary->replies += half->replies;
+        sum_us += half->sum_us;
+    }
+
+    if (summary->probes) {
+        summary->loss_percent = 100.0 * (summary->probes - summary->replies) / summary->probes;
+    }
+    if (!summary->replies) {
+        return;
+    }
+
+    summary->avg_us = (int32_t)(sum_us / summary->replies);
+    summary->jitter_us = (stats->jitter_x16 + 8) >> 4;
+    summary->p50_us = percentile(halves, count, 500, summary->min_us, summary->max_us);
+    summary->p95_us = percentile(halves, count, 950, summary->min_us, summary->max_us);
+    summary->p99_us = percentile(halves, count, 990, summary->min_us, summary->max_us);
+}
@@ -0,0 +1,170 @@
+/**
+ * @file scheduler.c
+ * @brief Implementation of the indexed min-heap deadline scheduler
+ */
+
+#include "../include/scheduler.h"
+#include "../include/logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void heap_place(Scheduler *scheduler, int pos, uint32_t id) {
+    scheduler->heap[pos] = id;
+    scheduler->position[id] = pos;
+}
+
+static void sift_up(Scheduler *scheduler, int pos) {
+    uint32_t id = scheduler->heap[pos];
+    uint64_t deadline = scheduler->deadline[id];
+
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        uint32_t parent_id = scheduler->heap[parent];
+        if (scheduler->deadline[parent_id] <= deadline) {
+            break;
+        }
+        heap_place(scheduler, pos, parent_id);
+        pos = parent;
+    }
+    heap_place(scheduler, pos, id);
+}
+
+static void sift_down(Scheduler *scheduler, int pos) {
+    uint32_t id = scheduler->heap[pos];
+    uint64_t deadline = scheduler->deadline[id];
+
+    for (;;) {
+        int child = pos * 2 + 1;
+        if (child >= scheduler->size) {
+            break;
+        }
+        if (child + 1 < scheduler->size &&
+            scheduler->deadline[scheduler->heap[child + 1]] < scheduler->deadline[scheduler->heap[child]]) {
+            child++;
+        }
+        uint32_t child_id = scheduler->heap[child];
+        if (deadline <= scheduler->deadline[child_id]) {
+            break;
+        }
+        heap_place(scheduler, pos, child_id);
+        pos = child;
+    }
+    heap_place(scheduler, pos, id);
+}
+
+int scheduler_init(Scheduler *scheduler, int capacity) {
+    if (!scheduler || capacity < 0) {
+        return -1;
+    }
+
+    memset(scheduler, 0, sizeof(*scheduler));
+    return scheduler_reserve(scheduler, capacity);
+}
+
+int scheduler_reserve(Scheduler *scheduler, int capacity) {
+    if (capacity <= scheduler->capacity) {
+        return 0;
+    }
+
+    uint32_t *heap = (uint32_t *)realloc(scheduler->heap, capacity * sizeof(uint32_t));
+    if (heap) {
+        scheduler->heap = heap;
+    }
+    uint64_t *deadline = (uint64_t *)realloc(scheduler->deadline, capacity * sizeof(uint64_t));
+    if (deadline) {
+        scheduler->deadline = deadline;
+    }
+    int32_t *position = (int32_t *)realloc(scheduler->position, capacity * sizeof(int32_t));
+    if (position) {
+        scheduler->position = position;
+    }
+    if (!heap || !deadline || !position) {
+        log_message(LOG_ERROR, "Memory allocation failed for scheduler");
+        return -1;
+    }
+
+    for (int i = scheduler->capacity; i < capacity; i++) {
+        scheduler->position[i] = -1;
+    }
+    scheduler->capacity = capacity;
+    return 0;
+}
+
+void scheduler_free(Scheduler *scheduler) {
+    if (!scheduler) {
+        return;
+    }
+
+    free(scheduler->heap);
+    free(scheduler->deadline);
+    free(scheduler->position);
+    memset(scheduler, 0, sizeof(*scheduler));
+}
+
+void scheduler_set(Scheduler *scheduler, uint32_t id, uint64_t deadline) {
+    if (id >= (uint32_t)scheduler->capacity) {
+        return;
+    }
+
+    int pos = scheduler->position[id];
+    if (pos < 0) {
+        scheduler->deadline[id] = deadline;
+        heap_place(scheduler, scheduler->size++, id);
+        sift_up(scheduler, scheduler->size - 1);
+        return;
+    }
+
+    uint64_t previous = scheduler->deadline[id];
+    scheduler->deadline[id] = deadline;
+    if (deadline < previous) {
+        sift_up(scheduler, pos);
+    } else if (deadline > previous) {
+        sift_down(scheduler, pos);
+    }
+}
+
+void scheduler_remove(Scheduler *scheduler, uint32_t id) {
+    if (id >= (uint32_t)scheduler->capacity || scheduler->position[id] < 0) {
+        return;
+    }
+
+    int pos = scheduler->position[id];
+    scheduler->position[id] = -1;
+    scheduler->size--;
+    if (pos == scheduler->size) {
+        return;
+    }
+
+    // Move the last entry into the hole and restore the heap order around it
+    uint32_t last = scheduler->heap[scheduler->size];
+    heap_place(scheduler, pos, last);
+    if (pos > 0 && scheduler->deadline[last] < scheduler->deadline[scheduler->heap[(pos - 1) / 2]]) {
+        sift_up(scheduler, pos);
+    } else {
+        sift_down(scheduler, pos);
+    }
+}
+
+bool scheduler_peek(const Scheduler *scheduler, uint32_t *id, uint64_t *deadline) {
+    if (scheduler->size == 0) {
+        return false;
+    }
+
+    if (id) {
+        *id = scheduler->heap[0];
+    }
+    if (deadline) {
+        *deadline = scheduler->deadline[scheduler->heap[0]];
+    }
+    return true;
+}
+
+bool scheduler_pop_due(Scheduler *scheduler, uint64_t now, uint32_t *id) {
+    if (scheduler->size == 0 || scheduler->deadline[scheduler->heap[0]] > now) {
+        return false;
+    }
+
+    *id = scheduler->heap[0];
+    scheduler_remove(scheduler, *id);
+    return true;
+}